@@ -70,6 +70,13 @@
 #define CPUID_FEAT_ECX_F16C                 (1 << 29)
 #define CPUID_FEAT_ECX_RDRND                (1 << 30)
 #define CPUID_FEAT_ECX_HYPERVISOR           (1 << 31)
+//CPUID features: leaf 5 ECX (MONITOR/MWAIT)
+#define CPUID_FEAT_5_ECX_EMX                (1 <<  0)
+#define CPUID_FEAT_5_ECX_IBE                (1 <<  1)
+//CPUID features: leaf 6 EAX (thermal and power management)
+#define CPUID_FEAT_6_EAX_ARAT               (1 <<  2)
+//CPUID features: leaf 0x80000007 EDX (advanced power management)
+#define CPUID_FEAT_80000007_EDX_INVTSC      (1 <<  8)
 
 void cpuid_get_leaf(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
 void cpuid_get_vendor(char str[13], uint32_t* max);
@@ -11,6 +11,22 @@
 
 EFI_SYSTEM_TABLE* krnl_get_efi_systable(void);
 
+//Table index: signature -> table
+//Every table in it has passed the checksum test
+typedef struct {
+    uint32_t sig;
+    acpi_sdt_hdr_t* hdr;
+} acpi_index_entry_t;
+acpi_index_entry_t acpi_index[ACPI_INDEX_SIZE];
+
+//Parsed tables
+acpi_fadt_t* acpi_fadt;
+acpi_hpet_t* acpi_hpet_tbl;
+acpi_madt_info_t acpi_madt_info;
+uint8_t acpi_madt_found;
+acpi_mcfg_info_t acpi_mcfg_info;
+uint8_t acpi_mcfg_found;
+
 uint32_t acpi_smi_cmd;
 uint8_t acpi_en;
 uint8_t acpi_dis;
@@ -21,6 +37,165 @@ uint16_t acpi_slp_typ_b;
 uint16_t acpi_slp_en;
 uint16_t acpi_sci_en;
 uint8_t acpi_pm1_ctl_len;
+uint16_t acpi_pm_tmr_port;
+uint8_t acpi_pm_tmr_ext;
+uint64_t acpi_hpet_addr;
+//Has the \_S5 package been looked for yet?
+uint8_t acpi_s5_parsed;
+
+/*
+ * Returns the index slot a signature hashes to
+ */
+uint32_t acpi_index_hash(uint32_t sig){
+    return (sig * 0x9E3779B1) >> 26;
+}
+
+/*
+ * Adds a table to the index if its checksum is valid
+ * Only the first table with a certain signature is kept
+ */
+void acpi_index_add(acpi_sdt_hdr_t* hdr){
+    if(hdr == NULL || !acpi_sdt_checksum(hdr))
+        return;
+    uint32_t sig = ACPI_SIG(hdr->signature);
+    uint32_t slot = acpi_index_hash(sig);
+    for(uint32_t i = 0; i < ACPI_INDEX_SIZE; i++){
+        acpi_index_entry_t* entry = &acpi_index[(slot + i) & (ACPI_INDEX_SIZE - 1)];
+        if(entry->hdr == NULL){
+            entry->sig = sig;
+            entry->hdr = hdr;
+            return;
+        }
+        if(entry->sig == sig)
+            return;
+    }
+}
+
+/*
+ * Finds an ACPI table by its signature (NULL if there's no valid one)
+ */
+void* acpi_find(char* sig){
+    uint32_t sig_val = ACPI_SIG(sig);
+    uint32_t slot = acpi_index_hash(sig_val);
+    for(uint32_t i = 0; i < ACPI_INDEX_SIZE; i++){
+        acpi_index_entry_t* entry = &acpi_index[(slot + i) & (ACPI_INDEX_SIZE - 1)];
+        if(entry->hdr == NULL)
+            return NULL;
+        if(entry->sig == sig_val)
+            return entry->hdr;
+    }
+    return NULL;
+}
+
+/*
+ * Parses the MADT into acpi_madt_info
+ */
+void acpi_parse_madt(acpi_madt_t* madt){
+    acpi_madt_info.lapic_addr = madt->lapic_addr;
+    acpi_madt_info.pic_present = (madt->flags & ACPI_MADT_PCAT_COMPAT) ? 1 : 0;
+    acpi_madt_info.cpu_cnt = 0;
+    acpi_madt_info.ioapic_cnt = 0;
+    acpi_madt_info.iso_cnt = 0;
+    uint8_t* ptr = (uint8_t*)madt + sizeof(acpi_madt_t);
+    uint8_t* end = (uint8_t*)madt + madt->hdr.len;
+    while(ptr + sizeof(acpi_madt_entry_t) <= end){
+        acpi_madt_entry_t* entry = (acpi_madt_entry_t*)ptr;
+        if(entry->len < sizeof(acpi_madt_entry_t) || ptr + entry->len > end)
+            break;
+        switch(entry->type){
+            case ACPI_MADT_LAPIC: {
+                acpi_madt_lapic_t* lapic = (acpi_madt_lapic_t*)entry;
+                if((lapic->flags & (ACPI_MADT_LAPIC_ENABLED | ACPI_MADT_LAPIC_ONLINE_CAP)) &&
+                   acpi_madt_info.cpu_cnt < ACPI_MAX_CPUS)
+                    acpi_madt_info.cpu_apic_ids[acpi_madt_info.cpu_cnt++] = lapic->apic_id;
+                break;
+            }
+            case ACPI_MADT_X2APIC: {
+                acpi_madt_x2apic_t* lapic = (acpi_madt_x2apic_t*)entry;
+                if((lapic->flags & (ACPI_MADT_LAPIC_ENABLED | ACPI_MADT_LAPIC_ONLINE_CAP)) &&
+                   acpi_madt_info.cpu_cnt < ACPI_MAX_CPUS)
+                    acpi_madt_info.cpu_apic_ids[acpi_madt_info.cpu_cnt++] = lapic->x2apic_id;
+                break;
+            }
+            case ACPI_MADT_IOAPIC: {
+                acpi_madt_ioapic_t* ioapic = (acpi_madt_ioapic_t*)entry;
+                if(acpi_madt_info.ioapic_cnt < ACPI_MAX_IOAPICS){
+                    acpi_ioapic_t* info = &acpi_madt_info.ioapics[acpi_madt_info.ioapic_cnt++];
+                    info->id = ioapic->id;
+                    info->addr = ioapic->addr;
+                    info->gsi_base = ioapic->gsi_base;
+                }
+                break;
+            }
+            case ACPI_MADT_ISO: {
+                acpi_madt_iso_t* iso = (acpi_madt_iso_t*)entry;
+                if(iso->bus == 0 && acpi_madt_info.iso_cnt < ACPI_MAX_ISOS){
+                    acpi_iso_t* info = &acpi_madt_info.isos[acpi_madt_info.iso_cnt++];
+                    info->irq = iso->irq;
+                    info->gsi = iso->gsi;
+                    info->flags = iso->flags;
+                }
+                break;
+            }
+            case ACPI_MADT_LAPIC_ADDR:
+                acpi_madt_info.lapic_addr = ((acpi_madt_lapic_addr_t*)entry)->addr;
+                break;
+        }
+        ptr += entry->len;
+    }
+    acpi_madt_found = 1;
+}
+
+/*
+ * Parses the MCFG into acpi_mcfg_info
+ */
+void acpi_parse_mcfg(acpi_mcfg_t* mcfg){
+    acpi_mcfg_entry_t* entries = (acpi_mcfg_entry_t*)((uint8_t*)mcfg + sizeof(acpi_mcfg_t));
+    uint32_t cnt = (mcfg->hdr.len - sizeof(acpi_mcfg_t)) / sizeof(acpi_mcfg_entry_t);
+    acpi_mcfg_info.cnt = 0;
+    for(uint32_t i = 0; i < cnt && acpi_mcfg_info.cnt < ACPI_MAX_MCFG; i++)
+        acpi_mcfg_info.entries[acpi_mcfg_info.cnt++] = entries[i];
+    acpi_mcfg_found = 1;
+}
+
+/*
+ * Looks for the \_S5 package in the DSDT to get the sleep type values for shutdown
+ */
+void acpi_parse_s5(void){
+    acpi_s5_parsed = 1;
+    acpi_sdt_hdr_t* dsdt = acpi_find("DSDT");
+    if(dsdt == NULL)
+        return;
+    //Search for the \_S5 name
+    //The AML is scanned for '_' first, and only then the whole name is compared
+    uint8_t* aml = (uint8_t*)dsdt + sizeof(acpi_sdt_hdr_t);
+    uint32_t aml_len = dsdt->len - sizeof(acpi_sdt_hdr_t);
+    uint8_t* s5_addr = NULL;
+    for(uint32_t i = 2; i + 8 < aml_len; i++){
+        if(aml[i] != '_' || *(uint32_t*)&aml[i] != ACPI_SIG("_S5_"))
+            continue;
+        s5_addr = &aml[i];
+        break;
+    }
+    if(s5_addr == NULL)
+        return;
+    //Check if AML structure is valid
+    if((*(s5_addr - 1) == 0x08 || (*(s5_addr - 2) == 0x08 && *(s5_addr - 1) == '\\')) && *(s5_addr + 4) == 0x12){
+        s5_addr += 5;
+        //Calculate PkgLen size
+        s5_addr += ((*s5_addr & 0xC0) >> 6) + 2;
+
+        //True black magic
+        if(*s5_addr == 0x0A)
+            s5_addr++;
+        acpi_slp_typ_a = *(s5_addr) << 10;
+        s5_addr++;
+
+        if(*s5_addr == 0x0A)
+            s5_addr++;
+        acpi_slp_typ_b = *(s5_addr) << 10;
+    }
+}
 
 /*
  * Initializes ACPI
@@ -34,93 +209,122 @@ uint32_t acpi_init(void){
         return 0;
     }
 
-    //Fetch RSDT from RSDP
-    acpi_rsdt_t* rsdt = (acpi_rsdt_t*)(uint64_t)rsdp->rsdt_ptr;
-    //Check if it's valid
-    if(!acpi_sdt_checksum(&rsdt->hdr)){
-        gfx_verbose_println("Error: RSDP is not valid");
-        return 0;
+    //Index the tables listed in the XSDT (ACPI 2.0+) or in the RSDT
+    for(uint32_t i = 0; i < ACPI_INDEX_SIZE; i++)
+        acpi_index[i].hdr = NULL;
+    acpi_xsdt_t* xsdt = (rsdp->rev >= 2) ? (acpi_xsdt_t*)rsdp->xsdt_ptr : NULL;
+    if(xsdt != NULL && acpi_sdt_checksum(&xsdt->hdr)){
+        uint32_t entries = (xsdt->hdr.len - sizeof(xsdt->hdr)) / 8;
+        for(uint32_t e = 0; e < entries; e++){
+            uint64_t ptr;
+            //The pointers are only 4-byte aligned
+            memcpy(&ptr, (uint8_t*)&xsdt->ptrs + (e * 8), 8);
+            acpi_index_add((acpi_sdt_hdr_t*)ptr);
+        }
+    } else {
+        acpi_rsdt_t* rsdt = (acpi_rsdt_t*)(uint64_t)rsdp->rsdt_ptr;
+        if(!acpi_sdt_checksum(&rsdt->hdr)){
+            gfx_verbose_println("Error: RSDT is not valid");
+            return 0;
+        }
+        uint32_t entries = (rsdt->hdr.len - sizeof(rsdt->hdr)) / 4;
+        for(uint32_t e = 0; e < entries; e++)
+            acpi_index_add((acpi_sdt_hdr_t*)(uint64_t)(&rsdt->ptrs)[e]);
     }
 
+    //Parse the tables drivers need
+    acpi_hpet_tbl = acpi_find("HPET");
+    if(acpi_hpet_tbl != NULL && acpi_hpet_tbl->addr.addr_space == ACPI_GAS_MEM)
+        acpi_hpet_addr = acpi_hpet_tbl->addr.addr;
+    acpi_madt_t* madt = acpi_find("APIC");
+    if(madt != NULL)
+        acpi_parse_madt(madt);
+    acpi_mcfg_t* mcfg = acpi_find("MCFG");
+    if(mcfg != NULL)
+        acpi_parse_mcfg(mcfg);
+
     //Find FADT
-    acpi_fadt_t* fadt = rsdt_find(rsdt, "FACP");
-    if(fadt == NULL){
+    acpi_fadt = acpi_find("FACP");
+    if(acpi_fadt == NULL){
         gfx_verbose_println("Error: FADT not found");
         return 0;
     }
+    acpi_fadt_t* fadt = acpi_fadt;
+    //The DSDT isn't listed in the RSDT/XSDT, index it too
+    uint64_t dsdt = fadt->dsdt;
+    if(fadt->hdr.len >= __builtin_offsetof(acpi_fadt_t, x_pm1a_evt_blk) && fadt->x_dsdt != 0)
+        dsdt = fadt->x_dsdt;
+    acpi_index_add((acpi_sdt_hdr_t*)dsdt);
 
-    //Check the DSDT
-    if(!acpi_sdt_checksum((acpi_sdt_hdr_t*)(uint64_t)fadt->dsdt)){
-        gfx_verbose_println("Error: DSDT is not valid");
-        return 0;
-    }
-    //Search for the \_S5 package in DSDT
-    char* s5_addr = (char*)(uint64_t)fadt->dsdt + sizeof(acpi_sdt_hdr_t);
-    uint32_t dsdt_len = *((uint32_t*)(uint64_t)fadt->dsdt + 1) - sizeof(acpi_sdt_hdr_t);
-    while(dsdt_len-- > 0){
-        if(memcmp(s5_addr, "_S5_", 4) == 0)
-            break;
-        s5_addr++;
-    }
-    //If DSDT was found
-    if(dsdt_len > 0){
-        //Check if AML structure is valid
-        if ((*(s5_addr - 1) == 0x08 || (*(s5_addr - 2) == 0x08 && *(s5_addr - 1) == '\\')) && *(s5_addr + 4) == 0x12){
-            s5_addr += 5;
-            //Calculate PkgLen size
-            s5_addr += ((*s5_addr & 0xC0) >> 6) + 2;
-
-            //True black magic
-            if(*s5_addr == 0x0A)
-                s5_addr++;
-            acpi_slp_typ_a = *(s5_addr) << 10;
-            s5_addr++;
+    //Fetch the PM timer port
+    acpi_pm_tmr_port = fadt->pm_tim_blk;
+    if(acpi_pm_tmr_port == 0 && fadt->hdr.len >= sizeof(acpi_fadt_t) &&
+       fadt->x_pm_tim_blk.addr_space == ACPI_GAS_IO)
+        acpi_pm_tmr_port = fadt->x_pm_tim_blk.addr;
+    if(fadt->pm_tim_len < 4)
+        acpi_pm_tmr_port = 0;
+    acpi_pm_tmr_ext = (fadt->flags & ACPI_FADT_TMR_VAL_EXT) ? 1 : 0;
 
-            if(*s5_addr == 0x0A)
-                s5_addr++;
-            acpi_slp_typ_b = *(s5_addr) << 10;
-
-            acpi_smi_cmd = fadt->smi_comm_port;
-            acpi_en = fadt->acpi_en;
-            acpi_dis = fadt->acpi_dis;
-
-            acpi_pm1a_ctl = fadt->pm1a_ctl_blk;
-            acpi_pm1b_ctl = fadt->pm1b_ctl_blk;
-
-            acpi_pm1_ctl_len = fadt->pm1_ctl_len;
-
-            acpi_slp_en = 1 << 13;
-            acpi_sci_en = 1;
-        }
-    }
+    //Fetch the power management registers
+    //  (the \_S5 package is only looked for when it's needed)
+    acpi_smi_cmd = fadt->smi_comm_port;
+    acpi_en = fadt->acpi_en;
+    acpi_dis = fadt->acpi_dis;
+    acpi_pm1a_ctl = fadt->pm1a_ctl_blk;
+    acpi_pm1b_ctl = fadt->pm1b_ctl_blk;
+    acpi_pm1_ctl_len = fadt->pm1_ctl_len;
+    acpi_slp_en = ACPI_PM1_SLP_EN;
+    acpi_sci_en = ACPI_PM1_SCI_EN;
 
-    gfx_verbose_println("Sending enable commands (this might take a while)");
-    //Enable ACPI
-    outb(acpi_smi_cmd, acpi_en);
-    /*
-    uint32_t start = pit_ticks();
-    while((pit_ticks() - start <= 1500) &&
-          ((inw(acpi_pm1a_ctl) & acpi_sci_en) == 0));
-    if(fadt->pm1b_ctl_blk != 0){
-        start = pit_ticks();
-        while((pit_ticks() - start <= 1500) &&
-              ((inw(acpi_pm1b_ctl) & acpi_sci_en) == 0));
+    //Enable ACPI if the firmware hasn't done that already
+    if(acpi_smi_cmd != 0 && acpi_en != 0 && !(inw(acpi_pm1a_ctl) & acpi_sci_en)){
+        gfx_verbose_println("Sending enable commands");
+        outb(acpi_smi_cmd, acpi_en);
     }
-    */
 
     gfx_verbose_println("ACPI successfully initialized");
     
     return 1;
 }
 
+/*
+ * Returns the FADT (NULL if there's none)
+ */
+acpi_fadt_t* acpi_get_fadt(void){
+    return acpi_fadt;
+}
+
+/*
+ * Returns the parsed MADT (NULL if there's none)
+ */
+acpi_madt_info_t* acpi_get_madt(void){
+    return acpi_madt_found ? &acpi_madt_info : NULL;
+}
+
+/*
+ * Returns the parsed MCFG (NULL if there's none)
+ */
+acpi_mcfg_info_t* acpi_get_mcfg(void){
+    return acpi_mcfg_found ? &acpi_mcfg_info : NULL;
+}
+
+/*
+ * Returns the HPET table (NULL if there's none)
+ */
+acpi_hpet_t* acpi_get_hpet(void){
+    return acpi_hpet_tbl;
+}
+
 /*
  * Send ACPI shutdown signal
  */
 void acpi_shutdown(void){
+    if(!acpi_s5_parsed)
+        acpi_parse_s5();
     //Issue the shutdown command
     outw(acpi_pm1a_ctl, acpi_slp_typ_a | acpi_slp_en);
     if(acpi_pm1b_ctl != 0)
-        outw(acpi_pm1b_ctl, acpi_slp_typ_a | acpi_slp_en);
+        outw(acpi_pm1b_ctl, acpi_slp_typ_b | acpi_slp_en);
 }
 
 /*
@@ -135,6 +339,23 @@ void acpi_reboot(void){
     outb(0x64, 0xFE);
 }
 
+/*
+ * Returns the ACPI PM timer I/O port (0 if there's none)
+ * and whether the timer is 32 bits wide
+ */
+uint16_t acpi_pm_timer(uint8_t* ext){
+    if(ext != NULL)
+        *ext = acpi_pm_tmr_ext;
+    return acpi_pm_tmr_port;
+}
+
+/*
+ * Returns the physical address of the HPET registers (0 if there's no HPET)
+ */
+uint64_t acpi_hpet(void){
+    return acpi_hpet_addr;
+}
+
 /*
  * Do checksumming of the ACPI RSDT table
  */
@@ -154,29 +375,15 @@ uint8_t acpi_sdt_checksum(acpi_sdt_hdr_t* rsdt){
  */
 acpi_rsdp_t* acpi_find_rsdp(void){
     //Search for the pointer in the UEFI config table
+    //The ACPI 2.0 one is preferred, as it points to the XSDT
     EFI_CONFIGURATION_TABLE* config_table =  krnl_get_efi_systable()->ConfigurationTable;
+    acpi_rsdp_t* rsdp = NULL;
     for(uint32_t i = 0; i < krnl_get_efi_systable()->NumberOfTableEntries; i++){
-        //If the GUID is ACPI 1.0 RSDP pointer GUID, return it
-        if(memcmp(&(config_table[i].VendorGuid), &(EFI_GUID)ACPI_TABLE_GUID, sizeof(EFI_GUID)) == 0)
+        if(memcmp(&(config_table[i].VendorGuid), &(EFI_GUID)ACPI_20_TABLE_GUID, sizeof(EFI_GUID)) == 0)
             return config_table[i].VendorTable;
+        //If the GUID is ACPI 1.0 RSDP pointer GUID, remember it
+        if(memcmp(&(config_table[i].VendorGuid), &(EFI_GUID)ACPI_TABLE_GUID, sizeof(EFI_GUID)) == 0)
+            rsdp = config_table[i].VendorTable;
     }
-    return NULL;
+    return rsdp;
 }
-
-/*
- * Finds an ACPI table in ACPI RSDT
- */
-void* rsdt_find(acpi_rsdt_t* rsdt, char* table){
-    //Calculate the number of entries RSDT has
-    uint32_t rsdt_entries = (rsdt->hdr.len - sizeof(rsdt->hdr)) / 4;
-    //Cycle through each entry
-    for(uint32_t e = 0; e < rsdt_entries; e++){
-        //Get the SDT header
-        acpi_sdt_hdr_t* hdr = (acpi_sdt_hdr_t*)(uint64_t)(rsdt->ptrs + e);
-        //Compare its signature with the desired one
-        if(*(uint32_t*)(hdr) == *(uint32_t*)(table))
-            return (void*)hdr;
-    }
-    //No tables were found - return null
-    return NULL;
-}
\ No newline at end of file
@@ -22,13 +22,24 @@ typedef struct {
     uint32_t ptrs;
 } __attribute__((packed)) acpi_rsdt_t;
 
+//ACPI XSDT table
+typedef struct {
+    acpi_sdt_hdr_t hdr;
+    uint64_t ptrs;
+} __attribute__((packed)) acpi_xsdt_t;
+
 //ACPI RSDP structure
+//(the fields after rsdt_ptr are only there in revision 2 and above)
 typedef struct {
     char signature[8];
     uint8_t checksum;
     char oem[6];
     uint8_t rev;
     uint32_t rsdt_ptr;
+    uint32_t len;
+    uint64_t xsdt_ptr;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
 } __attribute__((packed)) acpi_rsdp_t;
 
 //ACPI Generic Address Structure (GAS)
@@ -104,12 +115,181 @@ typedef struct {
     acpi_gas_t x_gpe1_blk;
 } __attribute__((packed)) acpi_fadt_t;
 
+//ACPI HPET table
+typedef struct {
+    acpi_sdt_hdr_t hdr;
+    uint8_t hw_rev;
+    //Comparator count, counter size, legacy replacement capability
+    uint8_t info;
+    uint16_t pci_vendor;
+    acpi_gas_t addr;
+    uint8_t hpet_no;
+    uint16_t min_tick;
+    uint8_t page_prot;
+} __attribute__((packed)) acpi_hpet_t;
+
+//ACPI MADT table (followed by the entries)
+typedef struct {
+    acpi_sdt_hdr_t hdr;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+//ACPI MADT entry header
+typedef struct {
+    uint8_t type;
+    uint8_t len;
+} __attribute__((packed)) acpi_madt_entry_t;
+
+//ACPI MADT entries
+typedef struct {
+    acpi_madt_entry_t hdr;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+typedef struct {
+    acpi_madt_entry_t hdr;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t addr;
+    uint32_t gsi_base;
+} __attribute__((packed)) acpi_madt_ioapic_t;
+
+typedef struct {
+    acpi_madt_entry_t hdr;
+    uint8_t bus;
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) acpi_madt_iso_t;
+
+typedef struct {
+    acpi_madt_entry_t hdr;
+    uint16_t reserved;
+    uint64_t addr;
+} __attribute__((packed)) acpi_madt_lapic_addr_t;
+
+typedef struct {
+    acpi_madt_entry_t hdr;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t acpi_id;
+} __attribute__((packed)) acpi_madt_x2apic_t;
+
+//ACPI MCFG table (followed by the entries)
+typedef struct {
+    acpi_sdt_hdr_t hdr;
+    uint64_t reserved;
+} __attribute__((packed)) acpi_mcfg_t;
+
+//ACPI MCFG entry (one per PCIe segment group)
+typedef struct {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t bus_start;
+    uint8_t bus_end;
+    uint32_t reserved;
+} __attribute__((packed)) acpi_mcfg_entry_t;
+
+//Parsed views of the tables
+
+#define ACPI_MAX_CPUS                       64
+#define ACPI_MAX_IOAPICS                    8
+#define ACPI_MAX_ISOS                       24
+#define ACPI_MAX_MCFG                       8
+
+//I/O APIC
+typedef struct {
+    uint8_t id;
+    uint32_t addr;
+    uint32_t gsi_base;
+} acpi_ioapic_t;
+
+//Interrupt source override: ISA IRQ -> GSI
+typedef struct {
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} acpi_iso_t;
+
+//MADT
+typedef struct {
+    uint64_t lapic_addr;
+    //Set if there are 8259 PICs that have to be masked
+    uint8_t pic_present;
+    uint32_t cpu_cnt;
+    uint32_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint8_t ioapic_cnt;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    uint8_t iso_cnt;
+    acpi_iso_t isos[ACPI_MAX_ISOS];
+} acpi_madt_info_t;
+
+//MCFG
+typedef struct {
+    uint8_t cnt;
+    acpi_mcfg_entry_t entries[ACPI_MAX_MCFG];
+} acpi_mcfg_info_t;
+
+//MADT entry types
+#define ACPI_MADT_LAPIC                     0
+#define ACPI_MADT_IOAPIC                    1
+#define ACPI_MADT_ISO                       2
+#define ACPI_MADT_LAPIC_ADDR                5
+#define ACPI_MADT_X2APIC                    9
+
+//MADT flags
+#define ACPI_MADT_PCAT_COMPAT               (1 << 0)
+//MADT LAPIC flags
+#define ACPI_MADT_LAPIC_ENABLED             (1 << 0)
+#define ACPI_MADT_LAPIC_ONLINE_CAP          (1 << 1)
+
+//MPS INTI flags (used by interrupt source overrides)
+#define ACPI_INTI_POLARITY_MASK             0x3
+#define ACPI_INTI_POLARITY_HIGH             0x1
+#define ACPI_INTI_POLARITY_LOW              0x3
+#define ACPI_INTI_TRIGGER_MASK              0xC
+#define ACPI_INTI_TRIGGER_EDGE              0x4
+#define ACPI_INTI_TRIGGER_LEVEL             0xC
+
+//Table index (open addressing, keyed by signature)
+#define ACPI_INDEX_SIZE                     64
+
+//Makes a table signature out of a string
+#define ACPI_SIG(S)                         (*(uint32_t*)(S))
+
+//GAS address spaces
+#define ACPI_GAS_MEM                        0
+#define ACPI_GAS_IO                         1
+
+//PM1 control register bits
+#define ACPI_PM1_SCI_EN                     (1 << 0)
+#define ACPI_PM1_SLP_EN                     (1 << 13)
+
+//FADT flags
+#define ACPI_FADT_TMR_VAL_EXT               (1 << 8)
+
+//PM timer frequency
+#define ACPI_PM_TMR_FREQ                    3579545
+
 //Initialization functions
 
 uint32_t acpi_init(void);
 uint8_t acpi_sdt_checksum(acpi_sdt_hdr_t* rsdt);
 acpi_rsdp_t* acpi_find_rsdp(void);
-void* rsdt_find(acpi_rsdt_t* rsdt, char* table);
+
+//Table access
+
+void* acpi_find(char* sig);
+acpi_fadt_t* acpi_get_fadt(void);
+acpi_madt_info_t* acpi_get_madt(void);
+acpi_mcfg_info_t* acpi_get_mcfg(void);
+acpi_hpet_t* acpi_get_hpet(void);
+uint16_t acpi_pm_timer(uint8_t* ext);
+uint64_t acpi_hpet(void);
 
 //Power management
 
@@ -0,0 +1,487 @@
+//Neutron Project
+//AHCI driver
+//SATA drives get up to 32 commands in flight (READ/WRITE FPDMA QUEUED
+//  if the drive does NCQ, READ/WRITE DMA EXT otherwise), completions
+//  are signalled through MSI or found by polling if there's no MSI
+
+#include "./ahci.h"
+#include "./pci.h"
+#include "./clock.h"
+#include "../stdlib.h"
+#include "../irq.h"
+#include "../mtask/mtask.h"
+
+ahci_hba_t* ahci_hbas[AHCI_MAX_HBAS];
+uint32_t ahci_hba_cnt = 0;
+ahci_port_t* ahci_disks[AHCI_MAX_DISKS];
+uint32_t ahci_disks_cnt = 0;
+
+/*
+ * Waits until (*reg & mask) == val
+ * Returns 0 on timeout
+ */
+uint8_t ahci_wait(volatile uint32_t* reg, uint32_t mask, uint32_t val, uint32_t timeout_ms){
+    uint64_t till = clock_monotonic_ns() + ((uint64_t)timeout_ms * 1000000);
+    while((*reg & mask) != val)
+        if(clock_monotonic_ns() >= till)
+            return 0;
+    return 1;
+}
+
+/*
+ * Stops command processing on a port
+ */
+uint8_t ahci_port_stop(volatile uint32_t* regs){
+    regs[AHCI_PxCMD / 4] &= ~AHCI_PxCMD_ST;
+    if(!ahci_wait(&regs[AHCI_PxCMD / 4], AHCI_PxCMD_CR, 0, AHCI_TIMEOUT_PORT))
+        return 0;
+    regs[AHCI_PxCMD / 4] &= ~AHCI_PxCMD_FRE;
+    return ahci_wait(&regs[AHCI_PxCMD / 4], AHCI_PxCMD_FR, 0, AHCI_TIMEOUT_PORT);
+}
+
+/*
+ * Starts command processing on a port
+ */
+void ahci_port_start(volatile uint32_t* regs){
+    //Clear the errors and pending interrupts left over
+    regs[AHCI_PxSERR / 4] = 0xFFFFFFFF;
+    regs[AHCI_PxIS / 4] = 0xFFFFFFFF;
+    regs[AHCI_PxCMD / 4] |= AHCI_PxCMD_FRE;
+    ahci_wait(&regs[AHCI_PxTFD / 4], AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ, 0, AHCI_TIMEOUT_PORT);
+    regs[AHCI_PxCMD / 4] |= AHCI_PxCMD_ST;
+}
+
+/*
+ * Checks that the HBA can address a buffer
+ *   (HBAs without 64-bit addressing only reach the first 4 GB)
+ */
+uint8_t ahci_reachable(ahci_hba_t* hba, void* buf, uint64_t bytes){
+    return (hba->cap & AHCI_CAP_S64A) || ((uint64_t)buf + bytes <= 0x100000000ULL);
+}
+
+/*
+ * Fills in the command FIS and the PRDT of a slot
+ * Returns the command header flags
+ */
+uint32_t ahci_build_cmd(ahci_port_t* port, uint8_t slot, uint8_t cmd, uint64_t lba, uint32_t count, void* buf, uint32_t bytes){
+    ahci_cmd_tbl_t* tbl = &port->tables[slot];
+    memset(tbl->cfis, 0, sizeof(tbl->cfis));
+    uint8_t* fis = tbl->cfis;
+    fis[0] = AHCI_FIS_REG_H2D;
+    fis[1] = AHCI_FIS_H2D_CMD;
+    fis[2] = cmd;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[8] = (lba >> 24) & 0xFF;
+    fis[9] = (lba >> 32) & 0xFF;
+    fis[10] = (lba >> 40) & 0xFF;
+    if(cmd == AHCI_ATA_READ_FPDMA || cmd == AHCI_ATA_WRITE_FPDMA){
+        //The sector count goes into the features, the count field holds the tag
+        fis[3] = count & 0xFF;
+        fis[11] = (count >> 8) & 0xFF;
+        fis[12] = slot << 3;
+        fis[7] = AHCI_ATA_DEV_LBA;
+    } else if(cmd != AHCI_ATA_IDENTIFY){
+        fis[12] = count & 0xFF;
+        fis[13] = (count >> 8) & 0xFF;
+        fis[7] = AHCI_ATA_DEV_LBA;
+    }
+    //Split the buffer into regions
+    uint32_t prds = 0;
+    for(uint32_t offs = 0; offs < bytes; offs += AHCI_PRD_MAX_BYTES){
+        uint32_t len = bytes - offs;
+        if(len > AHCI_PRD_MAX_BYTES)
+            len = AHCI_PRD_MAX_BYTES;
+        tbl->prdt[prds].dba = (uint64_t)buf + offs;
+        tbl->prdt[prds].reserved = 0;
+        tbl->prdt[prds].dbc = len - 1;
+        prds++;
+    }
+    tbl->prdt[prds - 1].dbc |= AHCI_PRD_INTR;
+    //Five dwords of the FIS
+    return 5 | ((uint32_t)prds << 16) | AHCI_CMDH_CLEAR_BUSY;
+}
+
+/*
+ * Issues a command that has been built in a slot
+ * (must be called in a critical section)
+ */
+void ahci_issue(ahci_port_t* port, uint8_t slot, uint32_t flags, uint8_t queued){
+    ahci_cmd_hdr_t* hdr = &port->cmd_list[slot];
+    hdr->flags = flags;
+    hdr->prdbc = 0;
+    hdr->ctba = (uint64_t)&port->tables[slot];
+    port->active |= 1U << slot;
+    //Queued commands have to be marked active before they're issued
+    if(queued)
+        port->regs[AHCI_PxSACT / 4] = 1U << slot;
+    port->regs[AHCI_PxCI / 4] = 1U << slot;
+}
+
+/*
+ * Fails all commands in flight and restarts the port
+ * (must be called in a critical section)
+ */
+void ahci_port_recover(ahci_port_t* port){
+    ahci_port_stop(port->regs);
+    ahci_port_start(port->regs);
+    uint32_t failed = port->active;
+    port->active = 0;
+    for(uint8_t slot = 0; slot < AHCI_MAX_SLOTS; slot++){
+        if(!(failed & (1U << slot)))
+            continue;
+        ahci_done_t done = port->done[slot];
+        void* arg = port->done_arg[slot];
+        port->busy &= ~(1U << slot);
+        if(done != NULL)
+            done(arg, 0);
+    }
+}
+
+/*
+ * Finishes the commands the port has completed
+ */
+void ahci_port_complete(ahci_port_t* port){
+    uint64_t rflags = mtask_crit_enter();
+    uint32_t is = port->regs[AHCI_PxIS / 4];
+    port->regs[AHCI_PxIS / 4] = is;
+    if(is & AHCI_PxIS_ERROR){
+        //With NCQ, the failed command can't be told apart without reading the log
+        ahci_port_recover(port);
+        mtask_crit_leave(rflags);
+        return;
+    }
+    //The ones that are neither outstanding nor issued anymore are done
+    uint32_t done_mask = port->active & ~(port->regs[AHCI_PxSACT / 4] | port->regs[AHCI_PxCI / 4]);
+    port->active &= ~done_mask;
+    for(uint8_t slot = 0; done_mask != 0; slot++){
+        if(!(done_mask & (1U << slot)))
+            continue;
+        done_mask &= ~(1U << slot);
+        ahci_done_t done = port->done[slot];
+        void* arg = port->done_arg[slot];
+        //Free the slot before the callback so that it can issue another command
+        port->busy &= ~(1U << slot);
+        if(done != NULL)
+            done(arg, 1);
+    }
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * HBA interrupt handler
+ */
+void ahci_irq(void* arg){
+    ahci_hba_t* hba = (ahci_hba_t*)arg;
+    volatile uint32_t* is = (volatile uint32_t*)(hba->abar + AHCI_REG_IS);
+    uint32_t pending = *is;
+    for(uint8_t p = 0; p < AHCI_MAX_PORTS; p++)
+        if((pending & (1U << p)) && hba->ports[p] != NULL)
+            ahci_port_complete(hba->ports[p]);
+    //The port bits can only be cleared after the ports' own status
+    *is = pending;
+}
+
+/*
+ * Runs a command synchronously without interrupts (used during the initialization)
+ * Returns 0 if it has failed
+ */
+uint8_t ahci_cmd_polled(ahci_port_t* port, uint8_t cmd, void* buf, uint32_t bytes){
+    uint32_t flags = ahci_build_cmd(port, 0, cmd, 0, 0, buf, bytes);
+    port->done[0] = NULL;
+    port->busy |= 1;
+    ahci_issue(port, 0, flags, 0);
+    uint8_t ok = ahci_wait(&port->regs[AHCI_PxCI / 4], 1, 0, AHCI_TIMEOUT_CMD);
+    if(port->regs[AHCI_PxIS / 4] & AHCI_PxIS_ERROR)
+        ok = 0;
+    port->regs[AHCI_PxIS / 4] = 0xFFFFFFFF;
+    port->active &= ~1;
+    port->busy &= ~1;
+    if(!ok)
+        ahci_port_recover(port);
+    return ok;
+}
+
+/*
+ * Reads the drive parameters
+ */
+uint8_t ahci_identify(ahci_port_t* port){
+    uint16_t* id = (uint16_t*)calloc_aligned(512, 2);
+    if(id == NULL || !ahci_reachable(port->hba, id, 512) || !ahci_cmd_polled(port, AHCI_ATA_IDENTIFY, id, 512)){
+        free_aligned(id);
+        return 0;
+    }
+    //Capacity: LBA48 if supported, LBA28 otherwise
+    if(id[83] & (1 << 10))
+        port->sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) | ((uint64_t)id[102] << 32) | ((uint64_t)id[103] << 48);
+    else
+        port->sectors = (uint64_t)id[60] | ((uint64_t)id[61] << 16);
+    //NCQ and the queue depth
+    uint8_t depth = (id[75] & 0x1F) + 1;
+    port->ncq = (port->hba->cap & AHCI_CAP_SNCQ) && (id[76] & (1 << 8));
+    port->slots = port->hba->slots;
+    if(port->ncq && depth < port->slots)
+        port->slots = depth;
+    //The model string is stored as big-endian words
+    for(uint32_t i = 0; i < 20; i++){
+        port->model[i * 2] = id[27 + i] >> 8;
+        port->model[(i * 2) + 1] = id[27 + i] & 0xFF;
+    }
+    port->model[40] = 0;
+    for(int32_t i = 39; i >= 0 && port->model[i] == ' '; i--)
+        port->model[i] = 0;
+    free_aligned(id);
+    return 1;
+}
+
+/*
+ * Frees the memory of a port that isn't used
+ */
+void ahci_port_free(ahci_port_t* port){
+    free_aligned(port->cmd_list);
+    free_aligned(port->rfis);
+    free_aligned(port->tables);
+    free(port);
+}
+
+/*
+ * Sets up a port and the drive attached to it
+ */
+void ahci_port_init(ahci_hba_t* hba, uint8_t no){
+    volatile uint32_t* regs = (volatile uint32_t*)(hba->abar + AHCI_PORT_BASE + (no * AHCI_PORT_SIZE));
+    if(!ahci_port_stop(regs))
+        return;
+    //Spin the drive up if the HBA supports staggered spin-up
+    if(hba->cap & AHCI_CAP_SSS)
+        regs[AHCI_PxCMD / 4] |= AHCI_PxCMD_SUD;
+    //Only SATA drives are supported
+    if(!ahci_wait(&regs[AHCI_PxSSTS / 4], AHCI_SSTS_DET_MASK, AHCI_SSTS_DET_PRESENT, 10))
+        return;
+    ahci_port_t* port = (ahci_port_t*)calloc(1, sizeof(ahci_port_t));
+    port->hba = hba;
+    port->no = no;
+    port->regs = regs;
+    port->slots = 1;
+    //The command list has to be 1 kB aligned, the received FIS area - 256 B aligned,
+    //  command tables - 128 B aligned
+    port->cmd_list = (ahci_cmd_hdr_t*)calloc_aligned(AHCI_MAX_SLOTS * sizeof(ahci_cmd_hdr_t), 1024);
+    port->rfis = (uint8_t*)calloc_aligned(256, 256);
+    port->tables = (ahci_cmd_tbl_t*)calloc_aligned(hba->slots * sizeof(ahci_cmd_tbl_t), 128);
+    if(port->cmd_list == NULL || port->rfis == NULL || port->tables == NULL ||
+       !ahci_reachable(hba, port->cmd_list, AHCI_MAX_SLOTS * sizeof(ahci_cmd_hdr_t)) ||
+       !ahci_reachable(hba, port->rfis, 256) ||
+       !ahci_reachable(hba, port->tables, hba->slots * sizeof(ahci_cmd_tbl_t))){
+        ahci_port_free(port);
+        return;
+    }
+    regs[AHCI_PxCLB / 4] = (uint64_t)port->cmd_list & 0xFFFFFFFF;
+    regs[AHCI_PxCLBU / 4] = (uint64_t)port->cmd_list >> 32;
+    regs[AHCI_PxFB / 4] = (uint64_t)port->rfis & 0xFFFFFFFF;
+    regs[AHCI_PxFBU / 4] = (uint64_t)port->rfis >> 32;
+    ahci_port_start(regs);
+    if(regs[AHCI_PxSIG / 4] != AHCI_SIG_ATA || !ahci_identify(port) || port->sectors == 0){
+        //The memory can only be given back once the HBA has let go of it
+        if(ahci_port_stop(regs))
+            ahci_port_free(port);
+        return;
+    }
+    hba->ports[no] = port;
+    if(ahci_disks_cnt < AHCI_MAX_DISKS)
+        ahci_disks[ahci_disks_cnt++] = port;
+}
+
+/*
+ * Initializes an HBA (called through the PCI driver table)
+ */
+void ahci_probe(pci_dev_t* dev){
+    if(ahci_hba_cnt >= AHCI_MAX_HBAS)
+        return;
+    //The registers are behind BAR5
+    volatile uint8_t* abar = (volatile uint8_t*)pci_map_bar(dev, 5);
+    if(abar == NULL)
+        return;
+    pci_bus_master(dev, 1);
+    ahci_hba_t* hba = (ahci_hba_t*)calloc(1, sizeof(ahci_hba_t));
+    hba->dev = dev;
+    hba->abar = abar;
+    volatile uint32_t* ghc = (volatile uint32_t*)(abar + AHCI_REG_GHC);
+    //Take the HBA over from the firmware
+    volatile uint32_t* bohc = (volatile uint32_t*)(abar + AHCI_REG_BOHC);
+    if(*(volatile uint32_t*)(abar + AHCI_REG_CAP2) & AHCI_CAP2_BOH){
+        *bohc |= AHCI_BOHC_OOS;
+        ahci_wait(bohc, AHCI_BOHC_BOS | AHCI_BOHC_BB, 0, AHCI_TIMEOUT_HANDOFF);
+    }
+    //Reset it
+    *ghc |= AHCI_GHC_AE;
+    *ghc |= AHCI_GHC_HR;
+    if(!ahci_wait(ghc, AHCI_GHC_HR, 0, AHCI_TIMEOUT_RESET))
+        return;
+    *ghc |= AHCI_GHC_AE;
+    hba->cap = *(volatile uint32_t*)(abar + AHCI_REG_CAP);
+    hba->slots = ((hba->cap >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    //Without 64-bit addressing (CAP.S64A) the structures and buffers have to be below 4 GB;
+    //  ports whose structures aren't are skipped, transfers to buffers above that are rejected
+    //Set up the ports
+    uint32_t pi = *(volatile uint32_t*)(abar + AHCI_REG_PI);
+    for(uint8_t p = 0; p < AHCI_MAX_PORTS; p++)
+        if(pi & (1U << p))
+            ahci_port_init(hba, p);
+    ahci_hbas[ahci_hba_cnt++] = hba;
+    //Use MSI if possible, poll otherwise
+    hba->vector = irq_alloc(ahci_irq, hba);
+    if(hba->vector != 0 && !pci_msi_enable(dev->bus, dev->slot, dev->func, hba->vector)){
+        irq_free(hba->vector);
+        hba->vector = 0;
+    }
+    if(hba->vector == 0)
+        return;
+    for(uint8_t p = 0; p < AHCI_MAX_PORTS; p++){
+        if(hba->ports[p] == NULL)
+            continue;
+        hba->ports[p]->regs[AHCI_PxIS / 4] = 0xFFFFFFFF;
+        hba->ports[p]->regs[AHCI_PxIE / 4] = AHCI_PxIS_DONE | AHCI_PxIS_ERROR;
+    }
+    *(volatile uint32_t*)(abar + AHCI_REG_IS) = 0xFFFFFFFF;
+    *ghc |= AHCI_GHC_IE;
+}
+
+/*
+ * Returns the number of SATA drives found
+ */
+uint32_t ahci_disk_cnt(void){
+    return ahci_disks_cnt;
+}
+
+/*
+ * Returns the capacity of a drive in sectors
+ */
+uint64_t ahci_disk_sectors(uint32_t disk){
+    return (disk < ahci_disks_cnt) ? ahci_disks[disk]->sectors : 0;
+}
+
+/*
+ * Returns the model string of a drive
+ */
+char* ahci_disk_model(uint32_t disk){
+    return (disk < ahci_disks_cnt) ? ahci_disks[disk]->model : NULL;
+}
+
+/*
+ * Checks that a transfer is within the drive and the HBA limits
+ */
+uint8_t ahci_check(uint32_t disk, uint64_t lba, uint32_t count, void* buf){
+    if(disk >= ahci_disks_cnt || count == 0 || count > AHCI_MAX_SECT)
+        return 0;
+    ahci_port_t* port = ahci_disks[disk];
+    if(lba + count > port->sectors)
+        return 0;
+    //NCQ commands can transfer 65536 sectors at most
+    if(port->ncq && count > 65536)
+        return 0;
+    return ahci_reachable(port->hba, buf, (uint64_t)count * AHCI_SECT_SIZE);
+}
+
+/*
+ * Queues a transfer; done() is called once it completes
+ * The buffer has to be physically contiguous (kernel memory is) and, if the HBA
+ *   lacks 64-bit addressing, below 4 GB
+ * Returns 0 if the request is invalid or all command slots are taken
+ */
+uint8_t ahci_submit(uint32_t disk, uint64_t lba, uint32_t count, void* buf, uint8_t write, ahci_done_t done, void* arg){
+    if(!ahci_check(disk, lba, count, buf))
+        return 0;
+    ahci_port_t* port = ahci_disks[disk];
+    //Take a slot
+    uint64_t rflags = mtask_crit_enter();
+    uint32_t free = ~port->busy & ((port->slots >= 32) ? 0xFFFFFFFF : ((1U << port->slots) - 1));
+    if(free == 0){
+        mtask_crit_leave(rflags);
+        return 0;
+    }
+    uint8_t slot = __builtin_ctz(free);
+    port->busy |= 1U << slot;
+    mtask_crit_leave(rflags);
+    //Build the command
+    uint8_t cmd;
+    if(port->ncq)
+        cmd = write ? AHCI_ATA_WRITE_FPDMA : AHCI_ATA_READ_FPDMA;
+    else
+        cmd = write ? AHCI_ATA_WRITE_DMA_EXT : AHCI_ATA_READ_DMA_EXT;
+    //A count of 65536 is encoded as 0
+    uint32_t flags = ahci_build_cmd(port, slot, cmd, lba, count & 0xFFFF, buf, count * AHCI_SECT_SIZE);
+    if(write)
+        flags |= AHCI_CMDH_WRITE;
+    //Issue it
+    rflags = mtask_crit_enter();
+    port->done[slot] = done;
+    port->done_arg[slot] = arg;
+    ahci_issue(port, slot, flags, port->ncq);
+    mtask_crit_leave(rflags);
+    return 1;
+}
+
+//Synchronous transfer state
+typedef struct {
+    volatile uint8_t done;
+    volatile uint8_t ok;
+    task_t* task;
+} ahci_waiter_t;
+
+void ahci_sync_done(void* arg, uint8_t ok){
+    ahci_waiter_t* waiter = (ahci_waiter_t*)arg;
+    waiter->ok = ok;
+    waiter->done = 1;
+    if(waiter->task != NULL)
+        mtask_wake(waiter->task);
+}
+
+/*
+ * Transfers sectors and waits for the transfer to complete
+ * The task sleeps if the HBA has an interrupt, otherwise the port is polled
+ * Returns 0 if the transfer has failed
+ */
+uint8_t ahci_transfer(uint32_t disk, uint64_t lba, uint32_t count, void* buf, uint8_t write){
+    if(!ahci_check(disk, lba, count, buf))
+        return 0;
+    ahci_port_t* port = ahci_disks[disk];
+    uint8_t sleep = (port->hba->vector != 0) && mtask_is_enabled();
+    ahci_waiter_t waiter = {.done = 0, .ok = 0, .task = sleep ? mtask_get_task(mtask_get_uid()) : NULL};
+    //Wait for a free slot
+    while(!ahci_submit(disk, lba, count, buf, write, ahci_sync_done, &waiter)){
+        if(sleep)
+            mtask_yield();
+        else
+            ahci_port_complete(port);
+    }
+    //Wait for the completion
+    uint64_t till = clock_monotonic_ns() + ((uint64_t)AHCI_TIMEOUT_CMD * 1000000);
+    while(!waiter.done){
+        if(clock_monotonic_ns() >= till){
+            uint64_t rflags = mtask_crit_enter();
+            if(!waiter.done)
+                ahci_port_recover(port);
+            mtask_crit_leave(rflags);
+            break;
+        }
+        if(sleep)
+            mtask_wait_till(clock_monotonic_to_tsc(till));
+        else
+            ahci_port_complete(port);
+    }
+    return waiter.ok;
+}
+
+/*
+ * Reads sectors from a drive
+ */
+uint8_t ahci_read(uint32_t disk, uint64_t lba, uint32_t count, void* buf){
+    return ahci_transfer(disk, lba, count, buf, 0);
+}
+
+/*
+ * Writes sectors to a drive
+ */
+uint8_t ahci_write(uint32_t disk, uint64_t lba, uint32_t count, void* buf){
+    return ahci_transfer(disk, lba, count, buf, 1);
+}
@@ -0,0 +1,185 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "../stdlib.h"
+#include "./pci.h"
+
+//Limits
+
+#define AHCI_MAX_HBAS                       4
+#define AHCI_MAX_PORTS                      32
+#define AHCI_MAX_DISKS                      8
+#define AHCI_MAX_SLOTS                      32
+//PRDT entries per command and bytes per entry
+#define AHCI_PRDT_ENTRIES                   8
+#define AHCI_PRD_MAX_BYTES                  (4 * 1024 * 1024)
+//Largest transfer a command can do (in sectors)
+#define AHCI_MAX_SECT                       ((AHCI_PRDT_ENTRIES * AHCI_PRD_MAX_BYTES) / 512)
+#define AHCI_SECT_SIZE                      512
+
+//Timeouts (ms)
+#define AHCI_TIMEOUT_HANDOFF                2000
+#define AHCI_TIMEOUT_RESET                  1000
+#define AHCI_TIMEOUT_PORT                   500
+#define AHCI_TIMEOUT_CMD                    5000
+
+//Generic host control registers
+#define AHCI_REG_CAP                        0x00
+#define AHCI_REG_GHC                        0x04
+#define AHCI_REG_IS                         0x08
+#define AHCI_REG_PI                         0x0C
+#define AHCI_REG_VS                         0x10
+#define AHCI_REG_CAP2                       0x24
+#define AHCI_REG_BOHC                       0x28
+
+#define AHCI_CAP_NCS_SHIFT                  8
+#define AHCI_CAP_NCS_MASK                   0x1F
+#define AHCI_CAP_SSS                        (1 << 27)
+#define AHCI_CAP_SNCQ                       (1 << 30)
+#define AHCI_CAP_S64A                       (1U << 31)
+#define AHCI_CAP2_BOH                       (1 << 0)
+
+#define AHCI_GHC_HR                         (1 << 0)
+#define AHCI_GHC_IE                         (1 << 1)
+#define AHCI_GHC_AE                         (1U << 31)
+
+#define AHCI_BOHC_BOS                       (1 << 0)
+#define AHCI_BOHC_OOS                       (1 << 1)
+#define AHCI_BOHC_BB                        (1 << 4)
+
+//Port registers (offsets from the port register block)
+#define AHCI_PORT_BASE                      0x100
+#define AHCI_PORT_SIZE                      0x80
+
+#define AHCI_PxCLB                          0x00
+#define AHCI_PxCLBU                         0x04
+#define AHCI_PxFB                           0x08
+#define AHCI_PxFBU                          0x0C
+#define AHCI_PxIS                           0x10
+#define AHCI_PxIE                           0x14
+#define AHCI_PxCMD                          0x18
+#define AHCI_PxTFD                          0x20
+#define AHCI_PxSIG                          0x24
+#define AHCI_PxSSTS                         0x28
+#define AHCI_PxSCTL                         0x2C
+#define AHCI_PxSERR                         0x30
+#define AHCI_PxSACT                         0x34
+#define AHCI_PxCI                           0x38
+
+#define AHCI_PxCMD_ST                       (1 << 0)
+#define AHCI_PxCMD_SUD                      (1 << 1)
+#define AHCI_PxCMD_FRE                      (1 << 4)
+#define AHCI_PxCMD_FR                       (1 << 14)
+#define AHCI_PxCMD_CR                       (1 << 15)
+
+#define AHCI_PxIS_DHRS                      (1 << 0)
+#define AHCI_PxIS_PSS                       (1 << 1)
+#define AHCI_PxIS_DSS                       (1 << 2)
+#define AHCI_PxIS_SDBS                      (1 << 3)
+#define AHCI_PxIS_IFS                       (1 << 27)
+#define AHCI_PxIS_HBDS                      (1 << 28)
+#define AHCI_PxIS_HBFS                      (1 << 29)
+#define AHCI_PxIS_TFES                      (1 << 30)
+#define AHCI_PxIS_DONE                      (AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS)
+#define AHCI_PxIS_ERROR                     (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_PxTFD_ERR                      (1 << 0)
+#define AHCI_PxTFD_DRQ                      (1 << 3)
+#define AHCI_PxTFD_BSY                      (1 << 7)
+
+#define AHCI_SSTS_DET_MASK                  0x0F
+#define AHCI_SSTS_DET_PRESENT               0x03
+
+//Device signatures
+#define AHCI_SIG_ATA                        0x00000101
+#define AHCI_SIG_ATAPI                      0xEB140101
+
+//FIS types
+#define AHCI_FIS_REG_H2D                    0x27
+#define AHCI_FIS_H2D_CMD                    (1 << 7)
+
+//ATA commands
+#define AHCI_ATA_IDENTIFY                   0xEC
+#define AHCI_ATA_READ_DMA_EXT               0x25
+#define AHCI_ATA_WRITE_DMA_EXT              0x35
+#define AHCI_ATA_READ_FPDMA                 0x60
+#define AHCI_ATA_WRITE_FPDMA                0x61
+#define AHCI_ATA_DEV_LBA                    (1 << 6)
+
+//Command header
+#define AHCI_CMDH_WRITE                     (1 << 6)
+#define AHCI_CMDH_CLEAR_BUSY                (1 << 10)
+typedef struct {
+    //Command FIS length (dwords), flags, PRDT length
+    uint32_t flags;
+    //Bytes transferred
+    volatile uint32_t prdbc;
+    uint64_t ctba;
+    uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_hdr_t;
+
+//Physical region descriptor
+#define AHCI_PRD_INTR                       (1U << 31)
+typedef struct {
+    uint64_t dba;
+    uint32_t reserved;
+    //Byte count - 1, interrupt on completion
+    uint32_t dbc;
+} __attribute__((packed)) ahci_prd_t;
+
+//Command table
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed)) ahci_cmd_tbl_t;
+
+//Called when a command completes (ok = 0 if it has failed)
+//Runs with interrupts disabled
+typedef void(*ahci_done_t)(void* arg, uint8_t ok);
+
+struct _ahci_hba_s;
+
+//Port with a SATA drive
+typedef struct {
+    struct _ahci_hba_s* hba;
+    uint8_t no;
+    volatile uint32_t* regs;
+    ahci_cmd_hdr_t* cmd_list;
+    uint8_t* rfis;
+    ahci_cmd_tbl_t* tables;
+    //Usable command slots
+    uint8_t slots;
+    //Does the drive support NCQ?
+    uint8_t ncq;
+    //Slots that have been taken and the ones that have been issued
+    uint32_t busy;
+    uint32_t active;
+    ahci_done_t done[AHCI_MAX_SLOTS];
+    void* done_arg[AHCI_MAX_SLOTS];
+    uint64_t sectors;
+    char model[41];
+} ahci_port_t;
+
+//Host bus adapter
+typedef struct _ahci_hba_s {
+    pci_dev_t* dev;
+    volatile uint8_t* abar;
+    uint32_t cap;
+    uint8_t slots;
+    //Interrupt vector (0 if the HBA is polled)
+    uint8_t vector;
+    ahci_port_t* ports[AHCI_MAX_PORTS];
+} ahci_hba_t;
+
+void ahci_probe(pci_dev_t* dev);
+
+uint32_t ahci_disk_cnt(void);
+uint64_t ahci_disk_sectors(uint32_t disk);
+char* ahci_disk_model(uint32_t disk);
+uint8_t ahci_submit(uint32_t disk, uint64_t lba, uint32_t count, void* buf, uint8_t write, ahci_done_t done, void* arg);
+uint8_t ahci_read(uint32_t disk, uint64_t lba, uint32_t count, void* buf);
+uint8_t ahci_write(uint32_t disk, uint64_t lba, uint32_t count, void* buf);
+
+#endif
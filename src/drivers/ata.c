@@ -2,7 +2,14 @@
 //ATA driver
 
 #include "./ata.h"
+#include "./clock.h"
 #include "../stdlib.h"
+#include "../irq.h"
+
+//State of the primary and secondary channels
+ata_channel_t ata_channels[2];
+//Parameters of the devices, indexed by (bus << 1) | device
+ata_drive_t ata_drives[4];
 
 /*
  * Get the I/O base for an ATA bus
@@ -22,11 +29,11 @@ uint16_t ata_devct(uint8_t bus){
  * Wait some time, the unit for time is 100us
  */
 void ata_wait_100us(uint32_t periods){
-    //Reading the same I/O port several times in a row yields a higher delay of 100us
-    //Yes, I know this is not the right way to do it, but that's kind of a replacement
-    //  while i didn't implement the APIC timer driver
+    //Each read of the alternate status register takes about 1us,
+    //  so 100 of them make up a period; it works before the clock is up
     while(periods--)
-        inb(ATA_PRIM_DEVCT);
+        for(uint8_t i = 0; i < 100; i++)
+            inb(ATA_PRIM_DEVCT);
 }
 
 /*
@@ -34,23 +41,100 @@ void ata_wait_100us(uint32_t periods){
  */
 void ata_soft_reset(uint8_t bus){
     //Set SRST bit in Device Control Register
-    outb(ata_devct(bus), 1 << 2);
+    outb(ata_devct(bus), ATA_DC_SRST);
     //Wait 100us
     ata_wait_100us(1);
     //Reset SRST bit in Device Control Register
     outb(ata_devct(bus), 0);
+    //The reset selects the master
+    ata_channels[bus & 1].selected = 0;
+    //The devices only set BSY within 2ms
+    ata_wait_100us(20);
 }
 
 /*
- * Read ATA device type
+ * Waits until the device is not busy and, if drq is set, is ready to transfer data
+ * Reports device errors and timeouts
  */
-uint8_t ata_get_type(uint8_t bus, uint8_t device){
-    //Reset the bus
-    ata_soft_reset(bus);
+ata_status_t ata_wait(uint8_t bus, uint8_t drq, uint32_t timeout_ms){
+    uint16_t port = ata_iobas(bus) + ATA_REG_STATUS;
+    //Before the clock is up the time is counted in delay periods
+    uint64_t till = clock_tsc_hz() ? clock_monotonic_ns() + ((uint64_t)timeout_ms * 1000000) : 0;
+    uint32_t periods = timeout_ms * 10;
+    while(1){
+        uint8_t status = inb(port);
+        if(!(status & ATA_SR_BSY)){
+            if(status & (ATA_SR_ERR | ATA_SR_DF))
+                return ATA_ERR_DEVICE;
+            if(!drq || (status & ATA_SR_DRQ))
+                return ATA_OK;
+        }
+        if(till != 0){
+            if(clock_monotonic_ns() >= till)
+                return ATA_ERR_TIMEOUT;
+        } else {
+            if(periods-- == 0)
+                return ATA_ERR_TIMEOUT;
+            ata_wait_100us(1);
+        }
+    }
+}
+
+/*
+ * Selects a device on the bus; the 400ns settle delay is only paid when it changes
+ */
+void ata_select(uint8_t bus, uint8_t device){
+    ata_channel_t* ch = &ata_channels[bus & 1];
+    if(ch->selected == device)
+        return;
+    outb(ata_iobas(bus) + ATA_REG_DEVSEL, 0xA0 | (device << 4));
+    //Each read of the alternate status register takes at least 100ns
+    for(uint8_t i = 0; i < 4; i++)
+        inb(ata_devct(bus));
+    ch->selected = device;
+}
+
+/*
+ * Writes the task file of a read/write command and issues it
+ * Uses the 48-bit form if lba48 is set
+ */
+void ata_issue(uint8_t bus, uint8_t device, uint64_t lba, uint32_t count, uint8_t lba48, uint8_t command){
+    uint16_t iobas = ata_iobas(bus);
+    if(lba48){
+        //The high bytes go first, the registers are two bytes deep
+        outb(iobas + ATA_REG_SECTCOUNT, (count >> 8) & 0xFF);
+        outb(iobas + ATA_REG_LBA_LO, (lba >> 24) & 0xFF);
+        outb(iobas + ATA_REG_LBA_MID, (lba >> 32) & 0xFF);
+        outb(iobas + ATA_REG_LBA_HI, (lba >> 40) & 0xFF);
+        outb(iobas + ATA_REG_SECTCOUNT, count & 0xFF);
+        outb(iobas + ATA_REG_LBA_LO, lba & 0xFF);
+        outb(iobas + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+        outb(iobas + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+        outb(iobas + ATA_REG_DEVSEL, 0xA0 | ATA_DEVSEL_LBA | (device << 4));
+    } else {
+        //A count of 0 means 256 sectors
+        outb(iobas + ATA_REG_SECTCOUNT, count & 0xFF);
+        outb(iobas + ATA_REG_LBA_LO, lba & 0xFF);
+        outb(iobas + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+        outb(iobas + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+        outb(iobas + ATA_REG_DEVSEL, 0xA0 | ATA_DEVSEL_LBA | (device << 4) | ((lba >> 24) & 0x0F));
+    }
+    outb(iobas + ATA_REG_COMMAND, command);
+}
+
+/*
+ * Reads the type of a device from the signature left by the last reset
+ */
+uint8_t ata_read_type(uint8_t bus, uint8_t device){
     //Select the device
     outb(ata_iobas(bus) + ATA_REG_DEVSEL, 0xA0 | (device << 4));
+    ata_channels[bus & 1].selected = device;
     //Wait 400us
     ata_wait_100us(4);
+    //The signature is only there once the device has finished the reset
+    //  (a floating bus reads as 0xFF, there's nothing to wait for)
+    if(inb(ata_iobas(bus) + ATA_REG_STATUS) != 0xFF && ata_wait(bus, 0, ATA_TIMEOUT_RESET) == ATA_ERR_TIMEOUT)
+        return ATA_DEV_UNKNOWN;
     //Read the signature bytes
     uint8_t ch = inb(ata_iobas(bus) + ATA_REG_CYL_HI);
     uint8_t cl = inb(ata_iobas(bus) + ATA_REG_CYL_LO);
@@ -63,29 +147,352 @@ uint8_t ata_get_type(uint8_t bus, uint8_t device){
 }
 
 /*
- * Read ATA device sectors
+ * Read ATA device type
+ */
+uint8_t ata_get_type(uint8_t bus, uint8_t device){
+    return ata_get_drive(bus, device)->type;
+}
+
+/*
+ * Reads the IDENTIFY DEVICE data of an ATA device (256 words)
+ * The channel has to be taken and the device known to be an ATA one
+ * Returns 0 if the device doesn't answer
+ */
+uint8_t ata_identify(uint8_t bus, uint8_t device, uint16_t* buffer){
+    ata_select(bus, device);
+    if(ata_wait(bus, 0, ATA_TIMEOUT_RESET) == ATA_ERR_TIMEOUT)
+        return 0;
+    outb(ata_iobas(bus) + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    //No device if the status is zero
+    if(inb(ata_iobas(bus) + ATA_REG_STATUS) == 0)
+        return 0;
+    //Wait for the data or an error
+    if(ata_wait(bus, 1, ATA_TIMEOUT_IDENTIFY) != ATA_OK)
+        return 0;
+    rep_insw(ata_iobas(bus), 256, buffer);
+    return 1;
+}
+
+/*
+ * Finishes the DMA transfer of a channel if the device has raised its interrupt
+ * Returns 0 if it hasn't
+ */
+uint8_t ata_dma_complete(ata_channel_t* ch){
+    uint8_t bm_status = inb(ch->bm + ATA_BM_STATUS);
+    if(!(bm_status & ATA_BM_STATUS_IRQ))
+        return 0;
+    //Stop the engine, reading the status register acknowledges the device
+    outb(ch->bm + ATA_BM_CMD, inb(ch->bm + ATA_BM_CMD) & ~ATA_BM_CMD_START);
+    uint8_t ata_status = inb(ata_iobas(ch->bus) + ATA_REG_STATUS);
+    outb(ch->bm + ATA_BM_STATUS, bm_status | ATA_BM_STATUS_IRQ | ATA_BM_STATUS_ERR);
+    //The interrupt might come from a PIO command
+    if(!ch->busy || ch->done)
+        return 1;
+    ch->bm_status = bm_status;
+    ch->ata_status = ata_status;
+    ch->done = 1;
+    if(ch->task != NULL)
+        mtask_wake(ch->task);
+    return 1;
+}
+
+/*
+ * IRQ 14/15 handler
+ */
+void ata_irq(void* arg){
+    ata_dma_complete((ata_channel_t*)arg);
+}
+
+/*
+ * Sets bus-master DMA up on a PIIX-style IDE controller (called through the PCI driver table)
+ * Only channels in compatibility mode are used, as that's where the legacy ports and IRQs are
+ */
+void ata_probe(pci_dev_t* dev){
+    if(!(dev->prog_if & ATA_PROGIF_BUS_MASTER) || !(dev->bar_flags[4] & PCI_BAR_IO) || dev->bar[4] == 0)
+        return;
+    //Only one controller can sit at the legacy ports
+    if(ata_channels[0].bm != 0 || ata_channels[1].bm != 0)
+        return;
+    uint16_t cmd = pci_read_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    pci_write_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd | PCI_CMD_IO);
+    pci_bus_master(dev, 1);
+    for(uint8_t bus = 0; bus < 2; bus++){
+        if(dev->prog_if & (bus ? ATA_PROGIF_SECO_NATIVE : ATA_PROGIF_PRIM_NATIVE))
+            continue;
+        ata_channel_t* ch = &ata_channels[bus];
+        ch->bus = bus;
+        //The PRDT has to be dword-aligned and can't cross a 64 kB boundary,
+        //  both it and the bounce buffer have to lie in the first 4 GB
+        ch->prdt = (ata_prd_t*)calloc_aligned(ATA_PRDT_ENTRIES * sizeof(ata_prd_t), ATA_PRDT_ENTRIES * sizeof(ata_prd_t));
+        ch->bounce = (uint8_t*)calloc_aligned(ATA_DMA_MAX_BYTES, ATA_PRD_BOUNDARY);
+        if(ch->prdt == NULL || ch->bounce == NULL ||
+           (uint64_t)ch->prdt + (ATA_PRDT_ENTRIES * sizeof(ata_prd_t)) > 0x100000000ULL ||
+           (uint64_t)ch->bounce + ATA_DMA_MAX_BYTES > 0x100000000ULL)
+            continue;
+        //Find out which devices can do DMA (the first call identifies both)
+        if(!ata_get_drive(bus, 0)->dma && !ata_get_drive(bus, 1)->dma)
+            continue;
+        ch->bm = (dev->bar[4] & 0xFFFC) + (bus * ATA_BM_CHANNEL_SIZE);
+        outb(ch->bm + ATA_BM_CMD, 0);
+        outb(ch->bm + ATA_BM_STATUS, ATA_BM_STATUS_IRQ | ATA_BM_STATUS_ERR);
+        //Completions are signalled by IRQ 14/15; poll if they can't be routed
+        ch->irq = irq_register(irq_isa_gsi(bus ? IRQ_ISA_ATA_SEC : IRQ_ISA_ATA_PRI), ata_irq, ch);
+        outb(ata_devct(bus), ch->irq ? 0 : ATA_DC_NIEN);
+    }
+}
+
+/*
+ * Fills the PRDT of a channel for a buffer
+ * Returns 0 if the buffer doesn't meet the PRD limits
+ */
+uint8_t ata_dma_build_prdt(ata_channel_t* ch, uint8_t* buffer, uint32_t bytes){
+    uint64_t addr = (uint64_t)buffer;
+    if((addr & 1) || addr + bytes > 0x100000000ULL)
+        return 0;
+    uint8_t i = 0;
+    while(bytes > 0){
+        if(i == ATA_PRDT_ENTRIES)
+            return 0;
+        //Split at 64 kB boundaries
+        uint32_t len = ATA_PRD_BOUNDARY - (addr & (ATA_PRD_BOUNDARY - 1));
+        if(len > bytes)
+            len = bytes;
+        ch->prdt[i].addr = (uint32_t)addr;
+        ch->prdt[i].len = (uint16_t)len;
+        ch->prdt[i].flags = 0;
+        addr += len;
+        bytes -= len;
+        i++;
+    }
+    ch->prdt[i - 1].flags = ATA_PRD_EOT;
+    return 1;
+}
+
+/*
+ * Takes a channel for a command
+ */
+void ata_bus_take(ata_channel_t* ch, uint8_t sleep){
+    while(1){
+        uint64_t rflags = mtask_crit_enter();
+        uint8_t taken = !ch->busy;
+        if(taken){
+            ch->busy = 1;
+            //Nothing is pending until a DMA command is issued
+            ch->done = 1;
+            ch->task = sleep ? mtask_get_task(mtask_get_uid()) : NULL;
+        }
+        mtask_crit_leave(rflags);
+        if(taken)
+            return;
+        if(mtask_is_enabled())
+            mtask_yield();
+    }
+}
+
+/*
+ * Gives a channel back
+ */
+void ata_bus_give(ata_channel_t* ch){
+    uint64_t rflags = mtask_crit_enter();
+    ch->busy = 0;
+    ch->task = NULL;
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Identifies both devices of a channel the first time it's used (the channel has to be taken)
+ * The bus is only reset once, before any device is set up
  */
-void ata_read_sect(uint8_t bus, uint8_t device, uint32_t lba, uint8_t count, uint8_t* buffer){
-    //Reset the bus
+void ata_identify_channel(ata_channel_t* ch){
+    if(ch->identified)
+        return;
+    uint8_t bus = ch->bus;
     ata_soft_reset(bus);
-    //Select the device
-    outb(ata_iobas(bus) + ATA_REG_DEVSEL, 0xA0 | (device << 4));
-    //Wait 400us
-    ata_wait_100us(4);
-    //Output: sector count
-    outb(ata_iobas(bus) + ATA_REG_SECTCOUNT, count);
-    //Output: LBA[7:0]
-    outb(ata_iobas(bus) + ATA_REG_LBA_LO, lba & 0xFF);
-    //Output: LBA[15:8]
-    outb(ata_iobas(bus) + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
-    //Output: LBA[23:16]
-    outb(ata_iobas(bus) + ATA_REG_LBA_MID, (lba >> 16) & 0xFF);
-    //Output: LBA mode flag, LBA[27:24], drive number
-    outb(ata_iobas(bus) + ATA_REG_DEVSEL, 0b11100000 | ((lba & 0x0F) >> 24) | ((device & 1) << 4));
-    //Output: command: Read With Retry
-    outb(ata_iobas(bus) + ATA_REG_COMMAND, 0x20);
-    //Wait for the data to be ready
-    while(!(inb(ata_iobas(bus) + ATA_REG_STATUS) & (1 << 3)));
-    //Read the data
-    rep_insw(0x1F0, (uint32_t)count * 256, (uint16_t*)buffer);
-}
\ No newline at end of file
+    //Read both signatures before a command overwrites the task file
+    for(uint8_t device = 0; device < 2; device++)
+        ata_drives[(bus << 1) | device].type = ata_read_type(bus, device);
+    uint16_t* id = (uint16_t*)malloc(512);
+    for(uint8_t device = 0; device < 2; device++){
+        ata_drive_t* drive = &ata_drives[(bus << 1) | device];
+        if(drive->type != ATA_DEV_PATA || !ata_identify(bus, device, id))
+            continue;
+        drive->present = 1;
+        drive->dma = (id[ATA_ID_CAPS] & ATA_ID_CAPS_DMA) != 0;
+        drive->lba48 = (id[ATA_ID_CMDSET2] & ATA_ID_CMDSET2_LBA48) != 0;
+        drive->sectors = drive->lba48 ? *(uint64_t*)&id[ATA_ID_LBA48_SECT] : *(uint32_t*)&id[ATA_ID_LBA28_SECT];
+        //Transfer several sectors per DRQ block
+        uint8_t multiple = id[ATA_ID_MAX_MULTIPLE] & 0xFF;
+        if(multiple > ATA_MULTIPLE_MAX)
+            multiple = ATA_MULTIPLE_MAX;
+        if(multiple > 1){
+            outb(ata_iobas(bus) + ATA_REG_SECTCOUNT, multiple);
+            outb(ata_iobas(bus) + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+            if(ata_wait(bus, 0, ATA_TIMEOUT_CMD) == ATA_OK)
+                drive->multiple = multiple;
+        }
+    }
+    free(id);
+    ch->identified = 1;
+}
+
+/*
+ * Returns the parameters of a device, identifying the devices of its channel on the first call
+ */
+ata_drive_t* ata_get_drive(uint8_t bus, uint8_t device){
+    ata_channel_t* ch = &ata_channels[bus & 1];
+    if(!ch->identified){
+        ch->bus = bus & 1;
+        ata_bus_take(ch, 0);
+        ata_identify_channel(ch);
+        ata_bus_give(ch);
+    }
+    return &ata_drives[((bus & 1) << 1) | (device & 1)];
+}
+
+/*
+ * Transfers sectors with bus-master DMA (up to 256 sectors, the channel has to be taken)
+ * The task sleeps until the IRQ arrives if it's routed, otherwise the controller is polled
+ */
+ata_status_t ata_dma_transfer(ata_channel_t* ch, uint8_t device, uint64_t lba, uint32_t count,
+                              uint8_t* buffer, uint8_t write, uint8_t lba48){
+    uint8_t bus = ch->bus;
+    //Use the buffer directly if the controller can reach it
+    uint32_t bytes = count * 512;
+    uint8_t bounce = !ata_dma_build_prdt(ch, buffer, bytes);
+    if(bounce){
+        ata_dma_build_prdt(ch, ch->bounce, bytes);
+        if(write)
+            memcpy(ch->bounce, buffer, bytes);
+    }
+    ata_select(bus, device);
+    ata_status_t status = ata_wait(bus, 0, ATA_TIMEOUT_CMD);
+    if(status != ATA_OK)
+        return status;
+    //Set the engine up (READ means the controller writes to memory)
+    uint8_t dir = write ? 0 : ATA_BM_CMD_READ;
+    outl(ch->bm + ATA_BM_PRDT, (uint32_t)(uint64_t)ch->prdt);
+    outb(ch->bm + ATA_BM_STATUS, ATA_BM_STATUS_IRQ | ATA_BM_STATUS_ERR);
+    outb(ch->bm + ATA_BM_CMD, dir);
+    outb(ata_devct(bus), ch->irq ? 0 : ATA_DC_NIEN);
+    ch->done = 0;
+    uint8_t command = lba48 ? (write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT)
+                            : (write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    ata_issue(bus, device, lba, count, lba48, command);
+    outb(ch->bm + ATA_BM_CMD, dir | ATA_BM_CMD_START);
+    //Wait for the completion
+    uint64_t till = clock_monotonic_ns() + ((uint64_t)ATA_TIMEOUT_DMA * 1000000);
+    while(!ch->done && clock_monotonic_ns() < till){
+        if(ch->task != NULL){
+            mtask_wait_till(clock_monotonic_to_tsc(till));
+        } else {
+            uint64_t rflags = mtask_crit_enter();
+            ata_dma_complete(ch);
+            mtask_crit_leave(rflags);
+        }
+    }
+    uint64_t rflags = mtask_crit_enter();
+    if(!ch->done){
+        outb(ch->bm + ATA_BM_CMD, 0);
+        status = ATA_ERR_TIMEOUT;
+    } else if((ch->bm_status & ATA_BM_STATUS_ERR) || (ch->ata_status & (ATA_SR_ERR | ATA_SR_DF))){
+        status = ATA_ERR_DEVICE;
+    }
+    //Don't let a late interrupt complete the next transfer
+    ch->done = 1;
+    mtask_crit_leave(rflags);
+    if(status == ATA_OK && bounce && !write)
+        memcpy(buffer, ch->bounce, bytes);
+    return status;
+}
+
+/*
+ * Transfers sectors with PIO (the channel has to be taken)
+ * Data moves a DRQ block at a time, which is several sectors if READ/WRITE MULTIPLE is set up
+ */
+ata_status_t ata_pio_transfer(ata_channel_t* ch, ata_drive_t* drive, uint8_t device, uint64_t lba, uint32_t count,
+                              uint8_t* buffer, uint8_t write, uint8_t lba48){
+    uint8_t bus = ch->bus;
+    ata_select(bus, device);
+    ata_status_t status = ata_wait(bus, 0, ATA_TIMEOUT_CMD);
+    if(status != ATA_OK)
+        return status;
+    //The status is polled, keep the device quiet
+    outb(ata_devct(bus), ATA_DC_NIEN);
+    uint8_t command;
+    if(drive->multiple)
+        command = lba48 ? (write ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE_EXT)
+                        : (write ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_READ_MULTIPLE);
+    else
+        command = lba48 ? (write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT)
+                        : (write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+    ata_issue(bus, device, lba, count, lba48, command);
+    uint32_t block = drive->multiple ? drive->multiple : 1;
+    for(uint32_t done = 0; done < count; done += block){
+        if(count - done < block)
+            block = count - done;
+        status = ata_wait(bus, 1, ATA_TIMEOUT_CMD);
+        if(status != ATA_OK)
+            return status;
+        uint16_t* data = (uint16_t*)(buffer + (done * 512));
+        if(write)
+            rep_outsw(ata_iobas(bus), block * 256, data);
+        else
+            rep_insw(ata_iobas(bus), block * 256, data);
+    }
+    //Writes report errors after the last block
+    return write ? ata_wait(bus, 0, ATA_TIMEOUT_CMD) : ATA_OK;
+}
+
+/*
+ * Transfers sectors, splitting the request into commands the device can take
+ * DMA is used if the controller and device support it, PIO otherwise
+ */
+ata_status_t ata_transfer(uint8_t bus, uint8_t device, uint64_t lba, uint32_t count, uint8_t* buffer, uint8_t write){
+    bus &= 1;
+    device &= 1;
+    ata_channel_t* ch = &ata_channels[bus];
+    ch->bus = bus;
+    //The task only sleeps on DMA completions
+    ata_bus_take(ch, (ch->irq != 0) && mtask_is_enabled());
+    ata_identify_channel(ch);
+    ata_drive_t* drive = &ata_drives[(bus << 1) | device];
+    if(!drive->present || count == 0 || lba + count > drive->sectors){
+        ata_bus_give(ch);
+        return ATA_ERR_INVALID;
+    }
+    uint8_t dma = (ch->bm != 0) && drive->dma;
+    ata_status_t status = ATA_OK;
+    while(count > 0 && status == ATA_OK){
+        //The 48-bit commands are only used where the 28-bit ones can't reach
+        uint32_t max = dma ? ATA_DMA_MAX_SECT : (drive->lba48 ? ATA_PIO_MAX_SECT_LBA48 : ATA_MAX_SECT_LBA28);
+        uint32_t chunk = (count > max) ? max : count;
+        uint8_t lba48 = (lba + chunk > ATA_LBA28_SECT) || (chunk > ATA_MAX_SECT_LBA28);
+        if(lba48 && !drive->lba48){
+            status = ATA_ERR_INVALID;
+            break;
+        }
+        if(dma)
+            status = ata_dma_transfer(ch, device, lba, chunk, buffer, write, lba48);
+        else
+            status = ata_pio_transfer(ch, drive, device, lba, chunk, buffer, write, lba48);
+        lba += chunk;
+        count -= chunk;
+        buffer += chunk * 512;
+    }
+    ata_bus_give(ch);
+    return status;
+}
+
+/*
+ * Read ATA device sectors
+ */
+ata_status_t ata_read_sect(uint8_t bus, uint8_t device, uint64_t lba, uint32_t count, uint8_t* buffer){
+    return ata_transfer(bus, device, lba, count, buffer, 0);
+}
+
+/*
+ * Write ATA device sectors
+ */
+ata_status_t ata_write_sect(uint8_t bus, uint8_t device, uint64_t lba, uint32_t count, uint8_t* buffer){
+    return ata_transfer(bus, device, lba, count, buffer, 1);
+}
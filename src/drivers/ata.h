@@ -2,6 +2,8 @@
 #define ATA_H
 
 #include "../stdlib.h"
+#include "./pci.h"
+#include "../mtask/mtask.h"
 
 //ATA I/O ports
 
@@ -24,6 +26,128 @@
 #define ATA_REG_STATUS                      7
 #define ATA_REG_COMMAND                     7
 
+#define ATA_DEVSEL_LBA                      (1 << 6)
+
+#define ATA_SR_ERR                          (1 << 0)
+#define ATA_SR_DRQ                          (1 << 3)
+#define ATA_SR_DF                           (1 << 5)
+#define ATA_SR_DRDY                         (1 << 6)
+#define ATA_SR_BSY                          (1 << 7)
+
+#define ATA_DC_NIEN                         (1 << 1)
+#define ATA_DC_SRST                         (1 << 2)
+
+//ATA commands
+
+#define ATA_CMD_READ_PIO                    0x20
+#define ATA_CMD_READ_PIO_EXT                0x24
+#define ATA_CMD_READ_DMA_EXT                0x25
+#define ATA_CMD_READ_MULTIPLE_EXT           0x29
+#define ATA_CMD_WRITE_PIO                   0x30
+#define ATA_CMD_WRITE_PIO_EXT               0x34
+#define ATA_CMD_WRITE_DMA_EXT               0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT          0x39
+#define ATA_CMD_READ_MULTIPLE               0xC4
+#define ATA_CMD_WRITE_MULTIPLE              0xC5
+#define ATA_CMD_SET_MULTIPLE                0xC6
+#define ATA_CMD_READ_DMA                    0xC8
+#define ATA_CMD_WRITE_DMA                   0xCA
+#define ATA_CMD_IDENTIFY                    0xEC
+
+//IDENTIFY DEVICE words
+#define ATA_ID_MAX_MULTIPLE                 47
+#define ATA_ID_CAPS                         49
+#define ATA_ID_CAPS_DMA                     (1 << 8)
+#define ATA_ID_LBA28_SECT                   60
+#define ATA_ID_CMDSET2                      83
+#define ATA_ID_CMDSET2_LBA48                (1 << 10)
+#define ATA_ID_LBA48_SECT                   100
+
+//Transfer limits (in sectors)
+#define ATA_LBA28_SECT                      (1ULL << 28)
+#define ATA_MAX_SECT_LBA28                  256
+#define ATA_PIO_MAX_SECT_LBA48              65536
+//Largest DRQ block for READ/WRITE MULTIPLE
+#define ATA_MULTIPLE_MAX                    16
+
+//Bus-master IDE registers (offsets from the channel's part of BAR4)
+
+#define ATA_BM_CHANNEL_SIZE                 8
+#define ATA_BM_CMD                          0
+#define ATA_BM_STATUS                       2
+#define ATA_BM_PRDT                         4
+
+#define ATA_BM_CMD_START                    (1 << 0)
+#define ATA_BM_CMD_READ                     (1 << 3)
+#define ATA_BM_STATUS_ACTIVE                (1 << 0)
+#define ATA_BM_STATUS_ERR                   (1 << 1)
+#define ATA_BM_STATUS_IRQ                   (1 << 2)
+
+//PCI programming interface bits of IDE controllers
+#define ATA_PROGIF_PRIM_NATIVE              (1 << 0)
+#define ATA_PROGIF_SECO_NATIVE              (1 << 2)
+#define ATA_PROGIF_BUS_MASTER               (1 << 7)
+
+//DMA limits
+//A PRD can't cross a 64 kB boundary and has to lie in the first 4 GB
+#define ATA_PRDT_ENTRIES                    8
+#define ATA_PRD_BOUNDARY                    0x10000
+#define ATA_PRD_EOT                         (1 << 15)
+#define ATA_DMA_MAX_SECT                    256
+#define ATA_DMA_MAX_BYTES                   (ATA_DMA_MAX_SECT * 512)
+
+//Timeouts (ms)
+#define ATA_TIMEOUT_RESET                   3000
+#define ATA_TIMEOUT_IDENTIFY                1000
+#define ATA_TIMEOUT_CMD                     5000
+#define ATA_TIMEOUT_DMA                     5000
+
+//Command status
+typedef enum {ATA_OK = 0, ATA_ERR_TIMEOUT = 1, ATA_ERR_DEVICE = 2, ATA_ERR_INVALID = 3} ata_status_t;
+
+//Parameters of a device
+typedef struct {
+    //Device type (ATA_DEV_*)
+    uint8_t type;
+    uint8_t present;
+    uint8_t dma;
+    uint8_t lba48;
+    //Sectors per DRQ block (0 if READ/WRITE MULTIPLE isn't used)
+    uint8_t multiple;
+    uint64_t sectors;
+} ata_drive_t;
+
+//Physical region descriptor
+typedef struct {
+    uint32_t addr;
+    //Byte count (0 = 64 kB)
+    uint16_t len;
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+//State of a channel
+typedef struct {
+    uint8_t bus;
+    //Have the devices been identified?
+    uint8_t identified;
+    //Currently selected device
+    uint8_t selected;
+    //Bus-master register base (0 if the channel has no DMA)
+    uint16_t bm;
+    //Is IRQ 14/15 routed? (0 if the channel is polled)
+    uint8_t irq;
+    ata_prd_t* prdt;
+    //Buffer for transfers that don't fit the PRD limits
+    uint8_t* bounce;
+    //Is a command in progress?
+    uint8_t busy;
+    //Completion state of the current transfer
+    volatile uint8_t done;
+    volatile uint8_t bm_status;
+    volatile uint8_t ata_status;
+    task_t* task;
+} ata_channel_t;
+
 //ATA device types
 
 #define ATA_DEV_UNKNOWN                     0
@@ -42,8 +166,15 @@ uint16_t ata_devct(uint8_t bus);
 
 void ata_wait_100us(uint32_t periods);
 void ata_soft_reset(uint8_t bus);
+ata_status_t ata_wait(uint8_t bus, uint8_t drq, uint32_t timeout_ms);
 uint8_t ata_get_type(uint8_t bus, uint8_t device);
 
-void ata_read_sect(uint8_t bus, uint8_t device, uint32_t lba, uint8_t count, uint8_t* buffer);
+uint8_t ata_identify(uint8_t bus, uint8_t device, uint16_t* buffer);
+ata_drive_t* ata_get_drive(uint8_t bus, uint8_t device);
+
+void ata_probe(pci_dev_t* dev);
+
+ata_status_t ata_read_sect(uint8_t bus, uint8_t device, uint64_t lba, uint32_t count, uint8_t* buffer);
+ata_status_t ata_write_sect(uint8_t bus, uint8_t device, uint64_t lba, uint32_t count, uint8_t* buffer);
 
 #endif
\ No newline at end of file
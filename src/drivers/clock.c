@@ -0,0 +1,218 @@
+//Neutron Project
+//Clock source
+//Calibrates the TSC against the best reference clock available
+//  and turns TSC values into nanoseconds
+
+#include "./clock.h"
+#include "./timr.h"
+#include "./acpi.h"
+#include "./hpet.h"
+#include "../cpuid.h"
+#include "../stdlib.h"
+
+//TSC frequency in Hz
+uint64_t clock_hz = 0;
+//TSC value clock_monotonic_ns() counts from
+uint64_t clock_tsc_base = 0;
+//TSC cycles -> ns multiplier (CLOCK_NS_SHIFT fractional bits)
+uint64_t clock_ns_mult = 0;
+//ns -> TSC cycles multiplier (CLOCK_TSC_SHIFT fractional bits)
+uint64_t clock_tsc_mult = 0;
+//Does the TSC tick at a constant rate in all P-, C- and T-states?
+uint8_t clock_invariant = 0;
+//The reference clock the TSC was calibrated against
+uint8_t clock_ref_used = CLOCK_REF_PIT;
+//The counter clock_monotonic_ns() reads
+uint8_t clock_src_used = CLOCK_SRC_TSC;
+//HPET counter value clock_monotonic_ns() counts from
+uint64_t clock_hpet_base = 0;
+//HPET ticks -> ns multiplier (CLOCK_NS_SHIFT fractional bits)
+uint64_t clock_hpet_mult = 0;
+
+/*
+ * Measures the TSC frequency using PIT channel 2
+ */
+uint64_t clock_cal_pit(void){
+    uint16_t count = (uint64_t)PIT_FREQ * CLOCK_CAL_US / 1000000;
+    //Disable the speaker, stop the channel 2 gate
+    uint8_t ctl = inb(PIT_PORT_CTL) & ~(PIT_CTL_SPKR | PIT_CTL_GATE2);
+    outb(PIT_PORT_CTL, ctl);
+    //Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(PIT_PORT_CMD, 0xB0);
+    outb(PIT_PORT_CH2, count & 0xFF);
+    outb(PIT_PORT_CH2, count >> 8);
+    //Start counting and wait for the output to go high
+    outb(PIT_PORT_CTL, ctl | PIT_CTL_GATE2);
+    uint64_t tsc_start = rdtsc();
+    while(!(inb(PIT_PORT_CTL) & PIT_CTL_OUT2));
+    uint64_t tsc_end = rdtsc();
+    outb(PIT_PORT_CTL, ctl);
+    return (tsc_end - tsc_start) * PIT_FREQ / count;
+}
+
+/*
+ * Measures the TSC frequency using the HPET
+ */
+uint64_t clock_cal_hpet(void){
+    uint64_t count = hpet_freq() * CLOCK_CAL_US / 1000000;
+    uint64_t mask = hpet_is_64bit() ? 0xFFFFFFFFFFFFFFFF : 0xFFFFFFFF;
+    uint64_t start = hpet_read();
+    uint64_t tsc_start = rdtsc();
+    uint64_t passed;
+    do {
+        passed = (hpet_read() - start) & mask;
+    } while(passed < count);
+    uint64_t tsc_end = rdtsc();
+    return (tsc_end - tsc_start) * hpet_freq() / passed;
+}
+
+/*
+ * Measures the TSC frequency using the ACPI PM timer
+ */
+uint64_t clock_cal_pm_tmr(uint16_t port, uint8_t ext){
+    uint32_t mask = ext ? 0xFFFFFFFF : 0xFFFFFF;
+    uint32_t count = (uint64_t)ACPI_PM_TMR_FREQ * CLOCK_CAL_US / 1000000;
+    //Wait for the timer to tick, so that we start right at the edge
+    uint32_t start = inl(port) & mask;
+    uint32_t pm;
+    while((pm = inl(port) & mask) == start);
+    uint64_t tsc_start = rdtsc();
+    start = pm;
+    //Wait for the interval to pass
+    uint32_t passed;
+    do {
+        pm = inl(port) & mask;
+        passed = (pm - start) & mask;
+    } while(passed < count);
+    uint64_t tsc_end = rdtsc();
+    return (tsc_end - tsc_start) * ACPI_PM_TMR_FREQ / passed;
+}
+
+/*
+ * Fetches the TSC frequency from CPUID leaf 0x15 (0 if it's not reported)
+ */
+uint64_t clock_cal_cpuid(void){
+    uint32_t max, ebx, ecx, edx;
+    cpuid_get_leaf(0, 0, &max, &ebx, &ecx, &edx);
+    if(max < 0x15)
+        return 0;
+    uint32_t denom, numer, crystal_hz;
+    cpuid_get_leaf(0x15, 0, &denom, &numer, &crystal_hz, &edx);
+    if(denom == 0 || numer == 0 || crystal_hz == 0)
+        return 0;
+    return (uint64_t)crystal_hz * numer / denom;
+}
+
+/*
+ * Calibrates the TSC and sets up the nanosecond clock
+ */
+void clock_init(void){
+    //Check for the invariant TSC
+    uint32_t max, eax, ebx, ecx, edx;
+    cpuid_get_leaf(0x80000000, 0, &max, &ebx, &ecx, &edx);
+    if(max >= 0x80000007){
+        cpuid_get_leaf(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+        clock_invariant = (edx & CPUID_FEAT_80000007_EDX_INVTSC) ? 1 : 0;
+    }
+
+    //The frequency the CPU reports is exact
+    clock_hz = clock_cal_cpuid();
+    if(clock_hz != 0){
+        clock_ref_used = CLOCK_REF_CPUID;
+    } else {
+        //Otherwise measure it against the HPET, the PM timer or the PIT
+        uint8_t pm_ext;
+        uint16_t pm_port = acpi_pm_timer(&pm_ext);
+        if(hpet_present())
+            clock_ref_used = CLOCK_REF_HPET;
+        else
+            clock_ref_used = pm_port ? CLOCK_REF_PM_TMR : CLOCK_REF_PIT;
+        uint64_t runs[CLOCK_CAL_RUNS];
+        for(int i = 0; i < CLOCK_CAL_RUNS; i++){
+            uint64_t hz;
+            if(clock_ref_used == CLOCK_REF_HPET)
+                hz = clock_cal_hpet();
+            else if(clock_ref_used == CLOCK_REF_PM_TMR)
+                hz = clock_cal_pm_tmr(pm_port, pm_ext);
+            else
+                hz = clock_cal_pit();
+            //Keep the results sorted
+            int j = i;
+            for(; j > 0 && runs[j - 1] > hz; j--)
+                runs[j] = runs[j - 1];
+            runs[j] = hz;
+        }
+        clock_hz = runs[CLOCK_CAL_RUNS / 2];
+    }
+
+    //Precompute the multipliers
+    clock_ns_mult = (1000000000ULL << CLOCK_NS_SHIFT) / clock_hz;
+    clock_tsc_mult = (clock_hz << CLOCK_TSC_SHIFT) / 1000000000ULL;
+    //A TSC that changes its rate can't be trusted to keep time, use the HPET instead
+    //  (its 32-bit version wraps around too quickly for that)
+    if(!clock_invariant && hpet_present() && hpet_is_64bit()){
+        clock_src_used = CLOCK_SRC_HPET;
+        clock_hpet_mult = (hpet_period_fs() << CLOCK_NS_SHIFT) / 1000000;
+    }
+    clock_hpet_base = hpet_present() ? hpet_read() : 0;
+    clock_tsc_base = rdtsc();
+}
+
+/*
+ * Converts TSC cycles to nanoseconds
+ */
+uint64_t clock_tsc_to_ns(uint64_t cycles){
+    return (uint64_t)(((unsigned __int128)cycles * clock_ns_mult) >> CLOCK_NS_SHIFT);
+}
+
+/*
+ * Converts nanoseconds to TSC cycles
+ */
+uint64_t clock_ns_to_tsc(uint64_t ns){
+    return (uint64_t)(((unsigned __int128)ns * clock_tsc_mult) >> CLOCK_TSC_SHIFT);
+}
+
+/*
+ * Converts a clock_monotonic_ns() value into the matching TSC value
+ * (approximately if the clock doesn't run off the TSC)
+ */
+uint64_t clock_monotonic_to_tsc(uint64_t ns){
+    return clock_tsc_base + clock_ns_to_tsc(ns);
+}
+
+/*
+ * Returns the amount of nanoseconds that have passed since clock initialization
+ */
+uint64_t clock_monotonic_ns(void){
+    if(clock_src_used == CLOCK_SRC_HPET)
+        return (uint64_t)(((unsigned __int128)(hpet_read() - clock_hpet_base) * clock_hpet_mult) >> CLOCK_NS_SHIFT);
+    return clock_tsc_to_ns(rdtsc() - clock_tsc_base);
+}
+
+/*
+ * Returns the TSC frequency in Hz
+ */
+uint64_t clock_tsc_hz(void){
+    return clock_hz;
+}
+
+/*
+ * Returns 1 if the TSC is invariant
+ */
+uint8_t clock_tsc_invariant(void){
+    return clock_invariant;
+}
+
+/*
+ * Returns the reference clock the TSC was calibrated against
+ */
+uint8_t clock_ref(void){
+    return clock_ref_used;
+}
+
+/*
+ * Returns the counter clock_monotonic_ns() reads
+ */
+uint8_t clock_src(void){
+    return clock_src_used;
+}
@@ -0,0 +1,37 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "../stdlib.h"
+
+//Reference clocks the TSC can be calibrated against
+#define CLOCK_REF_PIT                       0
+#define CLOCK_REF_PM_TMR                    1
+#define CLOCK_REF_CPUID                     2
+#define CLOCK_REF_HPET                      3
+
+//Counters clock_monotonic_ns() can read
+#define CLOCK_SRC_TSC                       0
+#define CLOCK_SRC_HPET                      1
+
+//Calibration interval and the number of attempts (odd)
+//  (the median wins: an SMI can stretch either the reference interval
+//   or the TSC delta, so a sample may be off in both directions)
+#define CLOCK_CAL_US                        10000
+#define CLOCK_CAL_RUNS                      5
+
+//Fixed point shifts of the TSC->ns and ns->TSC multipliers
+#define CLOCK_NS_SHIFT                      32
+#define CLOCK_TSC_SHIFT                     24
+
+void clock_init(void);
+
+uint64_t clock_monotonic_ns(void);
+uint64_t clock_monotonic_to_tsc(uint64_t ns);
+uint64_t clock_tsc_to_ns(uint64_t cycles);
+uint64_t clock_ns_to_tsc(uint64_t ns);
+uint64_t clock_tsc_hz(void);
+uint8_t clock_tsc_invariant(void);
+uint8_t clock_ref(void);
+uint8_t clock_src(void);
+
+#endif
@@ -4,20 +4,54 @@
 #include "./diskio.h"
 #include "../stdlib.h"
 #include "./ata.h"
+#include "./ahci.h"
+#include "./nvme.h"
 #include "./gfx.h"
 
 disk_part_t* partitions;
 uint8_t* buffer;
 
+/*
+ * Loads the MBR partitions of a drive whose first sector is in the buffer
+ */
+void diskio_load_mbr(device_type_t type, uint32_t device_no, uint16_t* cur_part){
+    char temp[50];
+    char temp2[15];
+    //Go through all the partition entries
+    for(uint8_t p = 0; p < 4; p++){
+        uint64_t p_base = (uint64_t)buffer + 0x1BE + (p * 16);
+        //Write the partition disk type, number and MBR entry number
+        partitions[*cur_part].device_type = type;
+        partitions[*cur_part].device_no = device_no;
+        partitions[*cur_part].mbr_entry_no = p;
+        //Fetch the partition type
+        partitions[*cur_part].type = *(uint8_t*)(p_base + 4);
+        //Fetch the partition start sector
+        partitions[*cur_part].lba_start = *(uint32_t*)(p_base + 8);
+        //Fetch the partition length
+        partitions[*cur_part].size = *(uint32_t*)(p_base + 0xC);
+        //Fetch the partition status
+        partitions[*cur_part].valid = (partitions[*cur_part].type != 0);
+        //Increment the partition pointer
+        if(partitions[*cur_part].valid){
+            //Print the partition info
+            temp[0] = 0;
+            strcat(temp, "Found MBR partition type ");
+            strcat(temp, sprintu(temp2, partitions[*cur_part].type, 1));
+            gfx_verbose_println(temp);
+            //Go to the next one
+            (*cur_part)++;
+        }
+    }
+}
+
 /*
  * Initialize the disk I/O subsystem by initializing all known storage devices and loading all the partitions from them
  */
 void diskio_init(void){
     //Allocate a chunk of memory for the list
-    partitions = (disk_part_t*)malloc(4 * 4 * sizeof(disk_part_t));
+    partitions = (disk_part_t*)calloc((4 + AHCI_MAX_DISKS + NVME_MAX_DISKS) * 4, sizeof(disk_part_t));
     uint16_t cur_part = 0;
-    //A dummy partition
-    disk_part_t* dummy_part;
     //Allocate a chunk of memory as a read/write buffer
     buffer = (uint8_t*)malloc(DISK_IO_BUFFER_SIZE);
     //Go through the ATA devices
@@ -32,34 +66,29 @@ void diskio_init(void){
         if(ata_type == ATA_DEV_PATA){
             //Read the device's first sector that contains MBR
             ata_read_sect(i >> 1, i & 1, 0, 1, buffer);
-            //Go through all the partition entries
-            for(uint8_t p = 0; p < 4; p++){
-                uint64_t p_base = (uint64_t)buffer + 0x1BE + (p * 16);
-                //Write the partition disk type, number and MBR entry number
-                partitions[cur_part].device_type = DISK_PATA;
-                partitions[cur_part].device_no = i;
-                partitions[cur_part].mbr_entry_no = p;
-                //Fetch the partition type
-                partitions[cur_part].type = *(uint8_t*)(p_base + 4);
-                //Fetch the partition start sector
-                partitions[cur_part].lba_start = *(uint32_t*)(p_base + 8);
-                //Fetch the partition length
-                partitions[cur_part].size = *(uint32_t*)(p_base + 0xC);
-                //Fetch the partition status
-                partitions[cur_part].valid = (partitions[cur_part].type != 0);
-                //Increment the partition pointer
-                if(partitions[cur_part].valid){
-                    //Print the partition info
-                    temp[0] = 0;
-                    strcat(temp, "Found MBR partition type ");
-                    strcat(temp, sprintu(temp2, partitions[cur_part].type, 1));
-                    gfx_verbose_println(temp);
-                    //Go to the next one
-                    cur_part++;
-                }
-            }
+            diskio_load_mbr(DISK_PATA, i, &cur_part);
         }
     }
+    //Go through the SATA drives behind AHCI controllers
+    for(uint32_t i = 0; i < ahci_disk_cnt(); i++){
+        char temp[50] = "Detecting partitions on SATA drive ";
+        char temp2[15];
+        strcat(temp, sprintu(temp2, i, 1));
+        gfx_verbose_println(temp);
+        if(ahci_read(i, 0, 1, buffer))
+            diskio_load_mbr(DISK_SATA, i, &cur_part);
+    }
+    //Go through the NVMe namespaces (MBR needs 512-byte sectors)
+    for(uint32_t i = 0; i < nvme_disk_cnt(); i++){
+        if(nvme_disk_sect_size(i) != 512)
+            continue;
+        char temp[50] = "Detecting partitions on NVMe namespace ";
+        char temp2[15];
+        strcat(temp, sprintu(temp2, i, 1));
+        gfx_verbose_println(temp);
+        if(nvme_read(i, 0, 1, buffer))
+            diskio_load_mbr(DISK_NVME, i, &cur_part);
+    }
 }
 
 /*
@@ -77,6 +106,12 @@ void diskio_read_sect(uint16_t part_no, uint32_t sect, uint8_t count, uint8_t fr
             ata_read_sect(part->device_no >> 1, part->device_no & 1,
                           sect + (from_part ? part->lba_start : 0), count, buffer);
             break;
+        case DISK_SATA:
+            ahci_read(part->device_no, sect + (from_part ? part->lba_start : 0), count, buffer);
+            break;
+        case DISK_NVME:
+            nvme_read(part->device_no, sect + (from_part ? part->lba_start : 0), count, buffer);
+            break;
     }
 }
 
@@ -8,7 +8,7 @@
 
 //The device type
 typedef enum {DISK_FLOPPY,
-              DISK_PATA, DISK_PATAPI, DISK_SATA, DISK_SATAPI,
+              DISK_PATA, DISK_PATAPI, DISK_SATA, DISK_SATAPI, DISK_NVME,
               DISK_UHCI, DISK_OHCI, DISK_EHCI, DISK_XHCI} device_type_t;
 
 typedef enum {DISKIO_STATUS_OK = 0, DISKIO_STATUS_INVALID_PART = 1, 
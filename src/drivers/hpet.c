@@ -0,0 +1,146 @@
+//Neutron Project
+//HPET driver
+//The main counter serves as a clock source and a calibration reference,
+//  the comparators serve as a fallback event timer
+
+#include "./hpet.h"
+#include "./acpi.h"
+#include "./apic.h"
+#include "../stdlib.h"
+
+//HPET register base address
+uint64_t hpet_base = 0;
+//General capabilities
+uint64_t hpet_cap;
+//Counter frequency in Hz
+uint64_t hpet_hz;
+//Mask of the valid counter bits
+uint64_t hpet_mask;
+
+/*
+ * Reads HPET register
+ */
+uint64_t hpet_reg_rd(uint32_t reg){
+    return *(volatile uint64_t*)(hpet_base + reg);
+}
+
+/*
+ * Writes HPET register
+ */
+void hpet_reg_wr(uint32_t reg, uint64_t val){
+    *(volatile uint64_t*)(hpet_base + reg) = val;
+}
+
+/*
+ * Initializes the HPET (if there's one)
+ * Returns 0 if it's not present
+ */
+uint8_t hpet_init(void){
+    //The registers are accessed through the identity map, like the LAPIC
+    hpet_base = acpi_hpet();
+    if(hpet_base == 0)
+        return 0;
+    hpet_cap = hpet_reg_rd(HPET_REG_CAP);
+    //The period can't be longer than 100 ns
+    uint64_t period = HPET_CAP_PERIOD(hpet_cap);
+    if(period == 0 || period > 100000000){
+        hpet_base = 0;
+        return 0;
+    }
+    hpet_hz = 1000000000000000ULL / period;
+    hpet_mask = (hpet_cap & HPET_CAP_64BIT) ? 0xFFFFFFFFFFFFFFFF : 0xFFFFFFFF;
+    //Make sure the counter is running
+    //The comparators are left alone, as the firmware may still be using them
+    hpet_reg_wr(HPET_REG_CONF, hpet_reg_rd(HPET_REG_CONF) | HPET_CONF_ENABLE);
+    return 1;
+}
+
+/*
+ * Returns 1 if there's an HPET
+ */
+uint8_t hpet_present(void){
+    return hpet_base != 0;
+}
+
+/*
+ * Returns 1 if the main counter is 64 bits wide
+ */
+uint8_t hpet_is_64bit(void){
+    return hpet_mask == 0xFFFFFFFFFFFFFFFF;
+}
+
+/*
+ * Reads the main counter
+ */
+uint64_t hpet_read(void){
+    return hpet_reg_rd(HPET_REG_CNT) & hpet_mask;
+}
+
+/*
+ * Returns the counter frequency in Hz
+ */
+uint64_t hpet_freq(void){
+    return hpet_hz;
+}
+
+/*
+ * Returns the counter period in femtoseconds
+ */
+uint64_t hpet_period_fs(void){
+    return HPET_CAP_PERIOD(hpet_cap);
+}
+
+/*
+ * Sets up a comparator that can deliver its interrupt straight to this CPU's LAPIC
+ * Returns its number or -1 if there's none
+ */
+int hpet_timer_fsb(uint8_t vector){
+    if(hpet_base == 0)
+        return -1;
+    for(uint8_t i = 0; i < HPET_CAP_TIM_CNT(hpet_cap); i++){
+        uint64_t conf = hpet_reg_rd(HPET_REG_TIM_CONF(i));
+        if(!(conf & HPET_TIM_FSB_CAP))
+            continue;
+        //Legacy replacement routing takes over comparators 0 and 1
+        if(i < 2 && (hpet_reg_rd(HPET_REG_CONF) & HPET_CONF_LEGACY))
+            continue;
+        //The message is the same as an MSI
+        uint64_t addr = 0xFEE00000 | ((apic_get_id() >> 24) << 12);
+        hpet_reg_wr(HPET_REG_TIM_FSB(i), (addr << 32) | vector);
+        //Edge-triggered, one-shot, FSB delivery, interrupt off till it's armed
+        conf &= ~(HPET_TIM_LEVEL | HPET_TIM_INT_EN | HPET_TIM_PERIODIC | HPET_TIM_32BIT);
+        if(!hpet_is_64bit())
+            conf |= HPET_TIM_32BIT;
+        hpet_reg_wr(HPET_REG_TIM_CONF(i), conf | HPET_TIM_FSB_EN);
+        return i;
+    }
+    return -1;
+}
+
+/*
+ * Arms a comparator to fire once after a certain amount of counter ticks
+ */
+void hpet_timer_arm(uint8_t n, uint64_t ticks){
+    uint64_t delta = (ticks < HPET_MIN_DELTA) ? HPET_MIN_DELTA : ticks;
+    if(delta > (hpet_mask >> 1))
+        delta = hpet_mask >> 1;
+    hpet_reg_wr(HPET_REG_TIM_CONF(n), hpet_reg_rd(HPET_REG_TIM_CONF(n)) | HPET_TIM_INT_EN);
+    while(1){
+        uint64_t cmp = (hpet_read() + delta) & hpet_mask;
+        hpet_reg_wr(HPET_REG_TIM_CMP(n), cmp);
+        //The comparator only fires on an exact match,
+        //  so make sure the counter hasn't gone past it in the meantime
+        uint64_t left = (cmp - hpet_read()) & hpet_mask;
+        if(left != 0 && left <= (hpet_mask >> 1))
+            break;
+        if(delta <= (hpet_mask >> 2))
+            delta *= 2;
+    }
+}
+
+/*
+ * Disarms a comparator
+ */
+void hpet_timer_stop(uint8_t n){
+    hpet_reg_wr(HPET_REG_TIM_CONF(n), hpet_reg_rd(HPET_REG_TIM_CONF(n)) & ~HPET_TIM_INT_EN);
+}
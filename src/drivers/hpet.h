@@ -0,0 +1,50 @@
+#ifndef HPET_H
+#define HPET_H
+
+#include "../stdlib.h"
+
+//HPET registers
+
+#define HPET_REG_CAP                        0x000
+#define HPET_REG_CONF                       0x010
+#define HPET_REG_ISR                        0x020
+#define HPET_REG_CNT                        0x0F0
+#define HPET_REG_TIM_CONF(N)                (0x100 + 0x20 * (N))
+#define HPET_REG_TIM_CMP(N)                 (0x108 + 0x20 * (N))
+#define HPET_REG_TIM_FSB(N)                 (0x110 + 0x20 * (N))
+
+//General capabilities register bits
+#define HPET_CAP_TIM_CNT(CAP)               ((((CAP) >> 8) & 0x1F) + 1)
+#define HPET_CAP_64BIT                      (1 << 13)
+#define HPET_CAP_PERIOD(CAP)                ((CAP) >> 32)
+
+//General configuration register bits
+#define HPET_CONF_ENABLE                    (1 << 0)
+#define HPET_CONF_LEGACY                    (1 << 1)
+
+//Timer configuration register bits
+#define HPET_TIM_LEVEL                      (1 << 1)
+#define HPET_TIM_INT_EN                     (1 << 2)
+#define HPET_TIM_PERIODIC                   (1 << 3)
+#define HPET_TIM_PERIODIC_CAP               (1 << 4)
+#define HPET_TIM_64BIT_CAP                  (1 << 5)
+#define HPET_TIM_32BIT                      (1 << 8)
+#define HPET_TIM_FSB_EN                     (1 << 14)
+#define HPET_TIM_FSB_CAP                    (1 << 15)
+
+//Comparator deltas start at this many ticks and double
+//  every time the counter overtakes the comparator while it's being written
+#define HPET_MIN_DELTA                      16
+
+uint8_t hpet_init(void);
+uint8_t hpet_present(void);
+uint8_t hpet_is_64bit(void);
+uint64_t hpet_read(void);
+uint64_t hpet_freq(void);
+uint64_t hpet_period_fs(void);
+
+int hpet_timer_fsb(uint8_t vector);
+void hpet_timer_arm(uint8_t n, uint64_t ticks);
+void hpet_timer_stop(uint8_t n);
+
+#endif
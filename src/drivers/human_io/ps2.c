@@ -7,6 +7,7 @@
 #include "../../stdlib.h"
 #include "../../gui/gui.h"
 #include "../ata.h" //For delay only
+#include "../../irq.h"
 
 //Keyboard buffer
 uint8_t* kbd_buffer;
@@ -14,6 +15,14 @@ uint16_t kbd_buffer_head, kbd_buffer_tail;
 //Mouse buffer
 uint8_t* ms_buffer;
 uint16_t ms_buffer_head, ms_buffer_tail;
+//Bytes received by the interrupt handler that haven't been parsed yet
+//  (the indices wrap around on their own)
+volatile uint8_t ps2_kbd_ring[256];
+volatile uint8_t ps2_kbd_ring_head, ps2_kbd_ring_tail;
+volatile uint8_t ps2_ms_ring[256];
+volatile uint8_t ps2_ms_ring_head, ps2_ms_ring_tail;
+//Is the controller interrupt-driven?
+uint8_t ps2_irq_enabled = 0;
 
 /*
  * Read PS/2 controller's status register
@@ -107,10 +116,64 @@ void ps2_alloc_buf(void){
     ms_buffer_tail = 0;
 }
 
+/*
+ * Keyboard and mouse interrupt handler
+ */
+void ps2_irq(void* args){
+    uint8_t p64d;
+    //Take everything the controller has
+    while((p64d = inb(PS2_CONT_STATUS)) & 1){
+        uint8_t data = inb(PS2_CONT_DATA);
+        //If bit 5 is set, it's a mouse data byte
+        if(p64d & 0x20){
+            if((uint8_t)(ps2_ms_ring_head + 1) != ps2_ms_ring_tail)
+                ps2_ms_ring[ps2_ms_ring_head++] = data;
+        } else {
+            if((uint8_t)(ps2_kbd_ring_head + 1) != ps2_kbd_ring_tail)
+                ps2_kbd_ring[ps2_kbd_ring_head++] = data;
+        }
+    }
+}
+
+/*
+ * Switches the PS/2 controller to interrupts
+ */
+void ps2_irq_init(void){
+    ps2_kbd_ring_head = ps2_kbd_ring_tail = 0;
+    ps2_ms_ring_head = ps2_ms_ring_tail = 0;
+    if(!irq_register(irq_isa_gsi(IRQ_ISA_KBD), ps2_irq, NULL))
+        return;
+    if(!irq_register(irq_isa_gsi(IRQ_ISA_MOUSE), ps2_irq, NULL)){
+        irq_unregister(irq_isa_gsi(IRQ_ISA_KBD), ps2_irq);
+        return;
+    }
+    //Enable the port 1 and port 2 interrupts in the configuration byte
+    ps2_command(0x20);
+    uint8_t config_byte = ps2_read() | 0b11;
+    ps2_command(0x60);
+    ps2_send(config_byte);
+    ps2_irq_enabled = 1;
+}
+
 /*
  * Polls the PS/2 controller
  */
 void ps2_poll(void){
+    if(ps2_irq_enabled){
+        //Move the bytes received by the interrupt handler into the parser buffers
+        while(ps2_ms_ring_tail != ps2_ms_ring_head){
+            if(ms_buffer_head < MOUSE_BUFFER_SIZE)
+                fifo_pushb(ms_buffer, &ms_buffer_head, ps2_ms_ring[ps2_ms_ring_tail]);
+            ps2_ms_ring_tail++;
+        }
+        while(ps2_kbd_ring_tail != ps2_kbd_ring_head){
+            if(kbd_buffer_head < KEYBOARD_BUFFER_SIZE)
+                fifo_pushb(kbd_buffer, &kbd_buffer_head, ps2_kbd_ring[ps2_kbd_ring_tail]);
+            ps2_kbd_ring_tail++;
+        }
+        ps2_parse();
+        return;
+    }
     uint32_t timeout = 100;
     //While we still have time
     while(timeout--){
@@ -127,6 +190,13 @@ void ps2_poll(void){
         //Delay for 1ms
         ata_wait_100us(10);
     }
+    ps2_parse();
+}
+
+/*
+ * Parses the buffered keyboard and mouse data
+ */
+void ps2_parse(void){
     //While at least three bytes are available for reading in the mouse buffer
     while(fifo_av(&ms_buffer_head, &ms_buffer_tail) >= 3){
         ps2_mouse_parse(ms_buffer, &ms_buffer_head, &ms_buffer_tail);
@@ -23,6 +23,8 @@ uint8_t ps2_read(void);
 void ps2_send(uint8_t d);
 void ps2_init(void);
 void ps2_alloc_buf(void);
+void ps2_irq_init(void);
 void ps2_poll(void);
+void ps2_parse(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,131 @@
+//Neutron Project
+//I/O APIC driver
+
+#include "./ioapic.h"
+#include "./acpi.h"
+#include "./apic.h"
+#include "../stdlib.h"
+
+//I/O APICs found in the MADT
+typedef struct {
+    uint64_t base;
+    uint32_t gsi_base;
+    uint32_t gsi_cnt;
+} ioapic_t;
+ioapic_t ioapics[ACPI_MAX_IOAPICS];
+uint8_t ioapic_cnt = 0;
+
+/*
+ * Reads I/O APIC register
+ */
+uint32_t ioapic_reg_rd(ioapic_t* ioapic, uint8_t reg){
+    *(volatile uint32_t*)(ioapic->base + IOAPIC_IOREGSEL) = reg;
+    return *(volatile uint32_t*)(ioapic->base + IOAPIC_IOWIN);
+}
+
+/*
+ * Writes I/O APIC register
+ */
+void ioapic_reg_wr(ioapic_t* ioapic, uint8_t reg, uint32_t val){
+    *(volatile uint32_t*)(ioapic->base + IOAPIC_IOREGSEL) = reg;
+    *(volatile uint32_t*)(ioapic->base + IOAPIC_IOWIN) = val;
+}
+
+/*
+ * Finds the I/O APIC that handles a GSI
+ */
+ioapic_t* ioapic_for_gsi(uint32_t gsi){
+    for(uint8_t i = 0; i < ioapic_cnt; i++)
+        if(gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_cnt)
+            return &ioapics[i];
+    return NULL;
+}
+
+/*
+ * Moves the 8259 PICs out of the way and masks them
+ */
+void pic_disable(void){
+    //ICW1: initialize, ICW4 needed
+    outb(PIC1_CMD, 0x11);
+    outb(PIC2_CMD, 0x11);
+    //ICW2: vector offsets
+    outb(PIC1_DATA, PIC_VECTOR_BASE);
+    outb(PIC2_DATA, PIC_VECTOR_BASE + 8);
+    //ICW3: the slave is on IRQ 2
+    outb(PIC1_DATA, 4);
+    outb(PIC2_DATA, 2);
+    //ICW4: 8086 mode
+    outb(PIC1_DATA, 1);
+    outb(PIC2_DATA, 1);
+    //Mask everything
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
+/*
+ * Finds the I/O APICs and masks all their inputs
+ * Returns 0 if there are none
+ */
+uint8_t ioapic_init(void){
+    acpi_madt_info_t* madt = acpi_get_madt();
+    if(madt == NULL)
+        return 0;
+    pic_disable();
+    ioapic_cnt = 0;
+    for(uint8_t i = 0; i < madt->ioapic_cnt; i++){
+        //The registers are accessed through the identity map, like the LAPIC
+        ioapic_t* ioapic = &ioapics[ioapic_cnt++];
+        ioapic->base = madt->ioapics[i].addr;
+        ioapic->gsi_base = madt->ioapics[i].gsi_base;
+        ioapic->gsi_cnt = ((ioapic_reg_rd(ioapic, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+        for(uint32_t j = 0; j < ioapic->gsi_cnt; j++){
+            ioapic_reg_wr(ioapic, IOAPIC_REG_REDIR(j), IOAPIC_REDIR_MASKED);
+            ioapic_reg_wr(ioapic, IOAPIC_REG_REDIR(j) + 1, 0);
+        }
+    }
+    return ioapic_cnt != 0;
+}
+
+/*
+ * Returns 1 if there's at least one I/O APIC
+ */
+uint8_t ioapic_present(void){
+    return ioapic_cnt != 0;
+}
+
+/*
+ * Routes a GSI to a vector on this CPU and unmasks it
+ * Returns 0 if no I/O APIC handles the GSI
+ */
+uint8_t ioapic_route(uint32_t gsi, uint8_t vector, uint8_t level, uint8_t active_low){
+    ioapic_t* ioapic = ioapic_for_gsi(gsi);
+    if(ioapic == NULL)
+        return 0;
+    uint32_t pin = gsi - ioapic->gsi_base;
+    uint64_t entry = vector | IOAPIC_REDIR_DEST(apic_get_id() >> 24);
+    if(level)
+        entry |= IOAPIC_REDIR_TRIGGER_LEVEL;
+    if(active_low)
+        entry |= IOAPIC_REDIR_POLARITY_LOW;
+    //Write the high half first, so that the entry is never unmasked half-written
+    ioapic_reg_wr(ioapic, IOAPIC_REG_REDIR(pin), IOAPIC_REDIR_MASKED);
+    ioapic_reg_wr(ioapic, IOAPIC_REG_REDIR(pin) + 1, entry >> 32);
+    ioapic_reg_wr(ioapic, IOAPIC_REG_REDIR(pin), entry & 0xFFFFFFFF);
+    return 1;
+}
+
+/*
+ * Masks or unmasks a GSI
+ */
+void ioapic_mask(uint32_t gsi, uint8_t masked){
+    ioapic_t* ioapic = ioapic_for_gsi(gsi);
+    if(ioapic == NULL)
+        return;
+    uint32_t pin = gsi - ioapic->gsi_base;
+    uint32_t low = ioapic_reg_rd(ioapic, IOAPIC_REG_REDIR(pin));
+    if(masked)
+        low |= IOAPIC_REDIR_MASKED;
+    else
+        low &= ~IOAPIC_REDIR_MASKED;
+    ioapic_reg_wr(ioapic, IOAPIC_REG_REDIR(pin), low);
+}
@@ -0,0 +1,35 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include "../stdlib.h"
+
+//I/O APIC registers (accessed through IOREGSEL/IOWIN)
+
+#define IOAPIC_IOREGSEL                     0x00
+#define IOAPIC_IOWIN                        0x10
+#define IOAPIC_REG_ID                       0x00
+#define IOAPIC_REG_VER                      0x01
+#define IOAPIC_REG_REDIR(N)                 (0x10 + 2 * (N))
+
+//Redirection entry bits
+#define IOAPIC_REDIR_POLARITY_LOW           (1 << 13)
+#define IOAPIC_REDIR_TRIGGER_LEVEL          (1 << 15)
+#define IOAPIC_REDIR_MASKED                 (1 << 16)
+#define IOAPIC_REDIR_DEST(APIC_ID)          ((uint64_t)(APIC_ID) << 56)
+
+//8259 PIC ports
+#define PIC1_CMD                            0x20
+#define PIC1_DATA                           0x21
+#define PIC2_CMD                            0xA0
+#define PIC2_DATA                           0xA1
+//Vectors the PICs are moved to before being masked
+//  (so that their spurious interrupts don't look like exceptions)
+#define PIC_VECTOR_BASE                     0xF0
+
+uint8_t ioapic_init(void);
+uint8_t ioapic_present(void);
+uint8_t ioapic_route(uint32_t gsi, uint8_t vector, uint8_t level, uint8_t active_low);
+void ioapic_mask(uint32_t gsi, uint8_t masked);
+void pic_disable(void);
+
+#endif
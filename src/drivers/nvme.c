@@ -0,0 +1,562 @@
+//Neutron Project
+//NVMe driver
+//Every controller gets an admin queue pair and an I/O queue pair per CPU;
+//  completions are signalled through MSI-X (one vector per queue)
+//  or found by polling if there's no MSI-X
+
+#include "./nvme.h"
+#include "./pci.h"
+#include "./acpi.h"
+#include "./clock.h"
+#include "../stdlib.h"
+#include "../irq.h"
+#include "../percpu.h"
+#include "../mtask/mtask.h"
+
+nvme_ctrl_t* nvme_ctrls[NVME_MAX_CTRLS];
+uint32_t nvme_ctrl_cnt = 0;
+nvme_ns_t nvme_disks[NVME_MAX_DISKS];
+uint32_t nvme_disks_cnt = 0;
+
+/*
+ * Waits until (CSTS & mask) == val
+ * Returns 0 on timeout or if the controller has failed
+ */
+uint8_t nvme_wait_csts(nvme_ctrl_t* ctrl, uint32_t mask, uint32_t val){
+    volatile uint32_t* csts = (volatile uint32_t*)(ctrl->regs + NVME_REG_CSTS);
+    //CAP.TO is in 500 ms units
+    uint64_t timeout = ((ctrl->cap >> NVME_CAP_TO_SHIFT) & NVME_CAP_TO_MASK) + 1;
+    uint64_t till = clock_monotonic_ns() + (timeout * 500000000);
+    while((*csts & mask) != val){
+        if((*csts & NVME_CSTS_CFS) || clock_monotonic_ns() >= till)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Allocates the memory of a queue pair
+ */
+void nvme_queue_init(nvme_ctrl_t* ctrl, nvme_queue_t* q, uint16_t id, uint16_t depth){
+    memset(q, 0, sizeof(nvme_queue_t));
+    q->ctrl = ctrl;
+    q->id = id;
+    q->depth = depth;
+    q->sq = (nvme_sqe_t*)calloc_aligned(depth * sizeof(nvme_sqe_t), NVME_PAGE_SIZE);
+    q->cq = (nvme_cqe_t*)calloc_aligned(depth * sizeof(nvme_cqe_t), NVME_PAGE_SIZE);
+    //Doorbells are spaced by the stride the controller reports
+    uint32_t stride = 4 << ((ctrl->cap >> NVME_CAP_DSTRD_SHIFT) & NVME_CAP_DSTRD_MASK);
+    q->sq_db = (volatile uint32_t*)(ctrl->regs + NVME_REG_DOORBELL + ((2 * id) * stride));
+    q->cq_db = (volatile uint32_t*)(ctrl->regs + NVME_REG_DOORBELL + ((2 * id + 1) * stride));
+    q->phase = 1;
+}
+
+/*
+ * Takes a free command ID of a queue
+ * Returns NVME_CID_NONE if there are none
+ */
+uint16_t nvme_cid_take(nvme_queue_t* q){
+    uint64_t rflags = mtask_crit_enter();
+    //One entry has to stay empty, so there's one ID less than entries
+    uint64_t mask = (q->depth - 1 >= 64) ? ~0ULL : ((1ULL << (q->depth - 1)) - 1);
+    uint64_t free = ~q->busy & mask;
+    uint16_t cid = NVME_CID_NONE;
+    if(free != 0){
+        cid = __builtin_ctzll(free);
+        q->busy |= 1ULL << cid;
+        q->done[cid] = NULL;
+    }
+    mtask_crit_leave(rflags);
+    return cid;
+}
+
+/*
+ * Puts a command into the submission queue and rings the doorbell
+ */
+void nvme_push(nvme_queue_t* q, uint16_t cid, nvme_sqe_t* sqe, nvme_done_t done, void* arg){
+    uint64_t rflags = mtask_crit_enter();
+    q->done[cid] = done;
+    q->done_arg[cid] = arg;
+    sqe->cdw0 = (sqe->cdw0 & 0xFFFF) | ((uint32_t)cid << 16);
+    memcpy(&q->sq[q->sq_tail], sqe, sizeof(nvme_sqe_t));
+    q->sq_tail = (q->sq_tail + 1) % q->depth;
+    *q->sq_db = q->sq_tail;
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Finishes the commands the controller has completed
+ */
+void nvme_queue_complete(nvme_queue_t* q){
+    uint64_t rflags = mtask_crit_enter();
+    uint8_t any = 0;
+    while(1){
+        nvme_cqe_t* cqe = &q->cq[q->cq_head];
+        //Entries the controller has written have the current phase
+        if((cqe->status & 1) != q->phase)
+            break;
+        uint16_t cid = cqe->cid;
+        uint8_t ok = (cqe->status >> 1) == 0;
+        if(++q->cq_head == q->depth){
+            q->cq_head = 0;
+            q->phase ^= 1;
+        }
+        any = 1;
+        if(cid >= NVME_QUEUE_DEPTH)
+            continue;
+        nvme_done_t done = q->done[cid];
+        void* arg = q->done_arg[cid];
+        //Free the ID before the callback so that it can issue another command
+        q->busy &= ~(1ULL << cid);
+        q->cur_result = cqe->result;
+        if(done != NULL)
+            done(arg, ok);
+    }
+    if(any)
+        *q->cq_db = q->cq_head;
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Queue interrupt handler
+ */
+void nvme_irq(void* arg){
+    nvme_queue_complete((nvme_queue_t*)arg);
+}
+
+//Synchronous command state
+typedef struct {
+    nvme_queue_t* q;
+    volatile uint8_t done;
+    volatile uint8_t ok;
+    uint32_t result;
+    task_t* task;
+} nvme_waiter_t;
+
+void nvme_sync_done(void* arg, uint8_t ok){
+    nvme_waiter_t* waiter = (nvme_waiter_t*)arg;
+    waiter->ok = ok;
+    waiter->result = waiter->q->cur_result;
+    waiter->done = 1;
+    if(waiter->task != NULL)
+        mtask_wake(waiter->task);
+}
+
+/*
+ * Waits for a command pushed with nvme_sync_done() as its callback
+ * The task sleeps if the queue has an interrupt, otherwise the queue is polled
+ * Returns 0 if the command has failed or timed out
+ */
+uint8_t nvme_sync_wait(uint16_t cid, nvme_waiter_t* waiter){
+    nvme_queue_t* q = waiter->q;
+    uint64_t till = clock_monotonic_ns() + ((uint64_t)NVME_TIMEOUT_CMD * 1000000);
+    while(!waiter->done){
+        if(clock_monotonic_ns() >= till){
+            //The command can't be taken back; make its completion only free the ID
+            uint64_t rflags = mtask_crit_enter();
+            if(!waiter->done)
+                q->done[cid] = NULL;
+            mtask_crit_leave(rflags);
+            break;
+        }
+        if(waiter->task != NULL)
+            mtask_wait_till(clock_monotonic_to_tsc(till));
+        else
+            nvme_queue_complete(q);
+    }
+    return waiter->done && waiter->ok;
+}
+
+/*
+ * Prepares the state of a synchronous command
+ */
+void nvme_waiter_init(nvme_waiter_t* waiter, nvme_queue_t* q){
+    waiter->q = q;
+    waiter->done = 0;
+    waiter->ok = 0;
+    waiter->result = 0;
+    waiter->task = ((q->vector != 0) && mtask_is_enabled()) ? mtask_get_task(mtask_get_uid()) : NULL;
+}
+
+/*
+ * Runs an admin command and waits for it to complete
+ * Stores the result dword of the completion if result isn't NULL
+ * Returns 0 if it has failed
+ */
+uint8_t nvme_admin(nvme_ctrl_t* ctrl, nvme_sqe_t* sqe, uint32_t* result){
+    nvme_queue_t* q = &ctrl->admin;
+    nvme_waiter_t waiter;
+    nvme_waiter_init(&waiter, q);
+    uint16_t cid;
+    while((cid = nvme_cid_take(q)) == NVME_CID_NONE)
+        nvme_queue_complete(q);
+    nvme_push(q, cid, sqe, nvme_sync_done, &waiter);
+    uint8_t ok = nvme_sync_wait(cid, &waiter);
+    if(ok && result != NULL)
+        *result = waiter.result;
+    return ok;
+}
+
+/*
+ * Runs an Identify command into a page-sized buffer
+ */
+uint8_t nvme_identify(nvme_ctrl_t* ctrl, uint8_t cns, uint32_t nsid, void* buf){
+    nvme_sqe_t sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.cdw0 = NVME_ADMIN_IDENTIFY;
+    sqe.nsid = nsid;
+    sqe.dptr[0] = (uint64_t)buf;
+    sqe.cdw10 = cns;
+    return nvme_admin(ctrl, &sqe, NULL);
+}
+
+/*
+ * Creates the I/O queue pairs
+ */
+void nvme_create_io_queues(nvme_ctrl_t* ctrl, uint16_t depth, uint8_t wanted){
+    //Ask for the queues
+    nvme_sqe_t sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.cdw0 = NVME_ADMIN_SET_FEATURES;
+    sqe.cdw10 = NVME_FEAT_NUM_QUEUES;
+    sqe.cdw11 = ((uint32_t)(wanted - 1) << 16) | (wanted - 1);
+    uint32_t result;
+    if(!nvme_admin(ctrl, &sqe, &result))
+        return;
+    //The controller might allocate less than asked
+    uint32_t granted_sq = (result & 0xFFFF) + 1;
+    uint32_t granted_cq = (result >> 16) + 1;
+    uint8_t cnt = wanted;
+    if(granted_sq < cnt)
+        cnt = granted_sq;
+    if(granted_cq < cnt)
+        cnt = granted_cq;
+    for(uint8_t i = 0; i < cnt; i++){
+        nvme_queue_t* q = &ctrl->io[i];
+        uint16_t qid = i + 1;
+        nvme_queue_init(ctrl, q, qid, depth);
+        //MSI-X entry 0 belongs to the admin queue
+        uint16_t entry = qid;
+        if(ctrl->msix.size > entry){
+            q->vector = irq_alloc(nvme_irq, q);
+            if(q->vector != 0)
+                pci_msix_set(&ctrl->msix, entry, q->vector);
+        }
+        //Completion queue
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.cdw0 = NVME_ADMIN_CREATE_CQ;
+        sqe.dptr[0] = (uint64_t)q->cq;
+        sqe.cdw10 = ((uint32_t)(depth - 1) << 16) | qid;
+        sqe.cdw11 = NVME_QUEUE_CONTIG | (q->vector ? (NVME_QUEUE_IEN | ((uint32_t)entry << 16)) : 0);
+        if(!nvme_admin(ctrl, &sqe, NULL))
+            break;
+        //Submission queue
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.cdw0 = NVME_ADMIN_CREATE_SQ;
+        sqe.dptr[0] = (uint64_t)q->sq;
+        sqe.cdw10 = ((uint32_t)(depth - 1) << 16) | qid;
+        sqe.cdw11 = ((uint32_t)qid << 16) | NVME_QUEUE_CONTIG;
+        if(!nvme_admin(ctrl, &sqe, NULL))
+            break;
+        ctrl->io_cnt++;
+    }
+}
+
+/*
+ * Initializes a controller (called through the PCI driver table)
+ */
+void nvme_probe(pci_dev_t* dev){
+    if(nvme_ctrl_cnt >= NVME_MAX_CTRLS)
+        return;
+    volatile uint8_t* regs = (volatile uint8_t*)pci_map_bar(dev, 0);
+    if(regs == NULL)
+        return;
+    pci_bus_master(dev, 1);
+    nvme_ctrl_t* ctrl = (nvme_ctrl_t*)calloc(1, sizeof(nvme_ctrl_t));
+    ctrl->dev = dev;
+    ctrl->regs = regs;
+    ctrl->cap = *(volatile uint64_t*)(regs + NVME_REG_CAP);
+    volatile uint32_t* cc = (volatile uint32_t*)(regs + NVME_REG_CC);
+    //Disable the controller to set the admin queues up
+    if(*cc & NVME_CC_EN){
+        *cc &= ~NVME_CC_EN;
+        if(!nvme_wait_csts(ctrl, NVME_CSTS_RDY, 0))
+            return;
+    }
+    uint16_t depth = NVME_QUEUE_DEPTH;
+    if((ctrl->cap & NVME_CAP_MQES_MASK) + 1 < depth)
+        depth = (ctrl->cap & NVME_CAP_MQES_MASK) + 1;
+    nvme_queue_init(ctrl, &ctrl->admin, 0, depth);
+    *(volatile uint32_t*)(regs + NVME_REG_AQA) = ((uint32_t)(depth - 1) << 16) | (depth - 1);
+    *(volatile uint64_t*)(regs + NVME_REG_ASQ) = (uint64_t)ctrl->admin.sq;
+    *(volatile uint64_t*)(regs + NVME_REG_ACQ) = (uint64_t)ctrl->admin.cq;
+    //4 kB pages, NVM command set, 64 B submission and 16 B completion entries
+    *cc = NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES;
+    if(!nvme_wait_csts(ctrl, NVME_CSTS_RDY, NVME_CSTS_RDY))
+        return;
+    //The admin queue completes through MSI-X entry 0
+    #ifndef NVME_POLLED
+    if(pci_msix_init(&ctrl->msix, dev) > 0){
+        ctrl->admin.vector = irq_alloc(nvme_irq, &ctrl->admin);
+        if(ctrl->admin.vector != 0)
+            pci_msix_set(&ctrl->msix, 0, ctrl->admin.vector);
+        pci_msix_enable(&ctrl->msix);
+    }
+    #endif
+    if(ctrl->admin.vector == 0)
+        *(volatile uint32_t*)(regs + NVME_REG_INTMS) = 0xFFFFFFFF;
+    //Read the controller parameters
+    uint8_t* id = (uint8_t*)calloc_aligned(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    if(!nvme_identify(ctrl, NVME_CNS_CONTROLLER, 0, id))
+        return;
+    //Transfers are limited by the PRP list a command can have
+    //  and by MDTS (in minimum pages, 0 = no limit)
+    ctrl->max_bytes = NVME_PRP_LIST_ENTRIES * NVME_PAGE_SIZE;
+    uint8_t mdts = id[NVME_ID_CTRL_MDTS];
+    if(mdts != 0 && mdts < 20 && ((uint32_t)NVME_PAGE_SIZE << mdts) < ctrl->max_bytes)
+        ctrl->max_bytes = (uint32_t)NVME_PAGE_SIZE << mdts;
+    ctrl->sgl = (*(uint32_t*)(id + NVME_ID_CTRL_SGLS) & 3) != 0;
+    uint32_t ns_cnt = *(uint32_t*)(id + NVME_ID_CTRL_NN);
+    //One I/O queue pair per CPU
+    uint8_t cpus = 1;
+    acpi_madt_info_t* madt = acpi_get_madt();
+    if(madt != NULL && madt->cpu_cnt > 1)
+        cpus = madt->cpu_cnt;
+    if(cpus > NVME_MAX_IO_QUEUES)
+        cpus = NVME_MAX_IO_QUEUES;
+    nvme_create_io_queues(ctrl, depth, cpus);
+    if(ctrl->io_cnt == 0)
+        return;
+    nvme_ctrls[nvme_ctrl_cnt++] = ctrl;
+    //Find the namespaces
+    if(ns_cnt > NVME_MAX_NS)
+        ns_cnt = NVME_MAX_NS;
+    for(uint32_t nsid = 1; nsid <= ns_cnt && nvme_disks_cnt < NVME_MAX_DISKS; nsid++){
+        memset(id, 0, NVME_PAGE_SIZE);
+        if(!nvme_identify(ctrl, NVME_CNS_NAMESPACE, nsid, id))
+            continue;
+        uint64_t size = *(uint64_t*)id;
+        if(size == 0)
+            continue;
+        //The LBA format in use gives the sector size
+        uint8_t fmt = id[26] & 0x0F;
+        uint8_t lbads = id[128 + (fmt * 4) + 2];
+        if(lbads < 9 || lbads > 12)
+            continue;
+        nvme_ns_t* ns = &nvme_disks[nvme_disks_cnt++];
+        ns->ctrl = ctrl;
+        ns->nsid = nsid;
+        ns->sectors = size;
+        ns->sect_size = 1 << lbads;
+    }
+}
+
+/*
+ * Returns the number of namespaces found
+ */
+uint32_t nvme_disk_cnt(void){
+    return nvme_disks_cnt;
+}
+
+/*
+ * Returns the capacity of a namespace in sectors
+ */
+uint64_t nvme_disk_sectors(uint32_t disk){
+    return (disk < nvme_disks_cnt) ? nvme_disks[disk].sectors : 0;
+}
+
+/*
+ * Returns the sector size of a namespace
+ */
+uint32_t nvme_disk_sect_size(uint32_t disk){
+    return (disk < nvme_disks_cnt) ? nvme_disks[disk].sect_size : 0;
+}
+
+/*
+ * Picks the I/O queue of the CPU we're running on
+ */
+nvme_queue_t* nvme_cpu_queue(nvme_ctrl_t* ctrl){
+    uint32_t idx = 0;
+    acpi_madt_info_t* madt = acpi_get_madt();
+    if(madt != NULL){
+        uint32_t apic_id = percpu_get()->cpu_id;
+        for(uint32_t i = 0; i < madt->cpu_cnt; i++)
+            if(madt->cpu_apic_ids[i] == apic_id)
+                idx = i;
+    }
+    return &ctrl->io[idx % ctrl->io_cnt];
+}
+
+/*
+ * Returns the PRP list / SGL segment page of a command ID
+ */
+void* nvme_cid_list(nvme_queue_t* q, uint16_t cid){
+    if(q->lists[cid] == NULL)
+        q->lists[cid] = calloc_aligned(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
+    return q->lists[cid];
+}
+
+/*
+ * Describes the data buffer of a command with an SGL
+ */
+uint8_t nvme_build_sgl(nvme_queue_t* q, uint16_t cid, nvme_sqe_t* sqe, nvme_sg_t* sg, uint32_t sg_cnt){
+    if(sg_cnt > NVME_SGL_LIST_ENTRIES)
+        return 0;
+    nvme_sgl_t* desc = (nvme_sgl_t*)sqe->dptr;
+    if(sg_cnt == 1){
+        //A single data block fits into the command
+        desc->addr = (uint64_t)sg[0].addr;
+        desc->len = sg[0].len;
+        desc->type = NVME_SGL_DATA_BLOCK;
+    } else {
+        //Otherwise the command points to a segment with all of them
+        nvme_sgl_t* list = (nvme_sgl_t*)nvme_cid_list(q, cid);
+        for(uint32_t i = 0; i < sg_cnt; i++){
+            list[i].addr = (uint64_t)sg[i].addr;
+            list[i].len = sg[i].len;
+            memset(list[i].reserved, 0, sizeof(list[i].reserved));
+            list[i].type = NVME_SGL_DATA_BLOCK;
+        }
+        desc->addr = (uint64_t)list;
+        desc->len = sg_cnt * sizeof(nvme_sgl_t);
+        desc->type = NVME_SGL_LAST_SEGMENT;
+    }
+    memset(desc->reserved, 0, sizeof(desc->reserved));
+    sqe->cdw0 |= NVME_PSDT_SGL;
+    return 1;
+}
+
+/*
+ * Describes the data buffer of a command with PRPs
+ * Only the first element may start and only the last one may end inside a page
+ */
+uint8_t nvme_build_prp(nvme_queue_t* q, uint16_t cid, nvme_sqe_t* sqe, nvme_sg_t* sg, uint32_t sg_cnt){
+    uint64_t* list = NULL;
+    uint32_t pages = 0;
+    for(uint32_t i = 0; i < sg_cnt; i++){
+        uint64_t st = (uint64_t)sg[i].addr;
+        uint64_t end = st + sg[i].len;
+        if((i > 0 && (st % NVME_PAGE_SIZE) != 0) || (i < sg_cnt - 1 && (end % NVME_PAGE_SIZE) != 0))
+            return 0;
+        for(uint64_t page = st & ~(uint64_t)(NVME_PAGE_SIZE - 1); page < end; page += NVME_PAGE_SIZE){
+            //The first page goes into PRP1 along with the offset
+            if(pages == 0){
+                sqe->dptr[0] = st;
+            } else if(pages == 1){
+                sqe->dptr[1] = page;
+            } else {
+                //More than two pages need a list PRP2 points to
+                if(list == NULL){
+                    list = (uint64_t*)nvme_cid_list(q, cid);
+                    list[0] = sqe->dptr[1];
+                    sqe->dptr[1] = (uint64_t)list;
+                }
+                if(pages - 1 >= NVME_PRP_LIST_ENTRIES)
+                    return 0;
+                list[pages - 1] = page;
+            }
+            pages++;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Checks that a transfer is within the namespace and the controller limits
+ */
+uint8_t nvme_check(uint32_t disk, uint64_t lba, uint32_t count, nvme_sg_t* sg, uint32_t sg_cnt){
+    if(disk >= nvme_disks_cnt || count == 0 || count > 65536 || sg_cnt == 0)
+        return 0;
+    nvme_ns_t* ns = &nvme_disks[disk];
+    if(lba + count > ns->sectors || (uint64_t)count * ns->sect_size > ns->ctrl->max_bytes)
+        return 0;
+    uint64_t bytes = 0;
+    for(uint32_t i = 0; i < sg_cnt; i++)
+        bytes += sg[i].len;
+    return bytes == (uint64_t)count * ns->sect_size;
+}
+
+/*
+ * Builds a read/write command and puts it into a queue
+ * Returns the command ID, NVME_CID_NONE if the queue is full
+ *   or NVME_CID_INVALID if the list can't be described with PRPs
+ */
+uint16_t nvme_issue(nvme_ns_t* ns, nvme_queue_t* q, uint64_t lba, uint32_t count, nvme_sg_t* sg, uint32_t sg_cnt,
+                    uint8_t write, nvme_done_t done, void* arg){
+    uint16_t cid = nvme_cid_take(q);
+    if(cid == NVME_CID_NONE)
+        return NVME_CID_NONE;
+    nvme_sqe_t sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.cdw0 = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+    sqe.nsid = ns->nsid;
+    sqe.cdw10 = lba & 0xFFFFFFFF;
+    sqe.cdw11 = lba >> 32;
+    sqe.cdw12 = count - 1;
+    //SGLs describe any list, PRPs need page-aligned elements
+    uint8_t ok = ns->ctrl->sgl ? nvme_build_sgl(q, cid, &sqe, sg, sg_cnt)
+                               : nvme_build_prp(q, cid, &sqe, sg, sg_cnt);
+    if(!ok){
+        uint64_t rflags = mtask_crit_enter();
+        q->busy &= ~(1ULL << cid);
+        mtask_crit_leave(rflags);
+        return NVME_CID_INVALID;
+    }
+    nvme_push(q, cid, &sqe, done, arg);
+    return cid;
+}
+
+/*
+ * Queues a transfer on the queue of the current CPU; done() is called once it completes
+ * The elements of the list have to be physically contiguous (kernel memory is)
+ * Returns 0 if the request is invalid or the queue is full
+ */
+uint8_t nvme_submit(uint32_t disk, uint64_t lba, uint32_t count, nvme_sg_t* sg, uint32_t sg_cnt,
+                    uint8_t write, nvme_done_t done, void* arg){
+    if(!nvme_check(disk, lba, count, sg, sg_cnt))
+        return 0;
+    nvme_ns_t* ns = &nvme_disks[disk];
+    return nvme_issue(ns, nvme_cpu_queue(ns->ctrl), lba, count, sg, sg_cnt, write, done, arg) < NVME_CID_INVALID;
+}
+
+/*
+ * Transfers sectors and waits for the transfer to complete
+ * Returns 0 if the transfer has failed
+ */
+uint8_t nvme_transfer(uint32_t disk, uint64_t lba, uint32_t count, void* buf, uint8_t write){
+    if(disk >= nvme_disks_cnt)
+        return 0;
+    nvme_ns_t* ns = &nvme_disks[disk];
+    nvme_sg_t sg = {.addr = buf, .len = count * ns->sect_size};
+    if(!nvme_check(disk, lba, count, &sg, 1))
+        return 0;
+    nvme_queue_t* q = nvme_cpu_queue(ns->ctrl);
+    nvme_waiter_t waiter;
+    nvme_waiter_init(&waiter, q);
+    //Retry while the queue is full; a buffer of max_bytes that doesn't start at a page boundary
+    //  needs one PRP more than the list has, so that one can never be issued
+    uint16_t cid;
+    while((cid = nvme_issue(ns, q, lba, count, &sg, 1, write, nvme_sync_done, &waiter)) == NVME_CID_NONE){
+        if(waiter.task != NULL)
+            mtask_yield();
+        else
+            nvme_queue_complete(q);
+    }
+    if(cid == NVME_CID_INVALID)
+        return 0;
+    return nvme_sync_wait(cid, &waiter);
+}
+
+/*
+ * Reads sectors from a namespace
+ */
+uint8_t nvme_read(uint32_t disk, uint64_t lba, uint32_t count, void* buf){
+    return nvme_transfer(disk, lba, count, buf, 0);
+}
+
+/*
+ * Writes sectors to a namespace
+ */
+uint8_t nvme_write(uint32_t disk, uint64_t lba, uint32_t count, void* buf){
+    return nvme_transfer(disk, lba, count, buf, 1);
+}
@@ -0,0 +1,184 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include "../stdlib.h"
+#include "./pci.h"
+
+//Complete through polling even if the controller has MSI-X?
+//#define NVME_POLLED
+
+//Limits
+
+#define NVME_MAX_CTRLS                      4
+#define NVME_MAX_DISKS                      8
+//Namespaces looked at per controller
+#define NVME_MAX_NS                         4
+//I/O queue pairs per controller (one per CPU)
+#define NVME_MAX_IO_QUEUES                  8
+//Entries per queue (one of them always stays empty)
+#define NVME_QUEUE_DEPTH                    64
+#define NVME_CID_NONE                       0xFFFF
+//Returned instead of a command ID if the buffers can't be described
+#define NVME_CID_INVALID                    0xFFFE
+#define NVME_PAGE_SIZE                      4096
+//PRP list / SGL descriptor page entries
+#define NVME_PRP_LIST_ENTRIES               (NVME_PAGE_SIZE / 8)
+#define NVME_SGL_LIST_ENTRIES               (NVME_PAGE_SIZE / 16)
+
+//Timeouts (ms)
+#define NVME_TIMEOUT_CMD                    5000
+
+//Controller registers
+#define NVME_REG_CAP                        0x00
+#define NVME_REG_VS                         0x08
+#define NVME_REG_INTMS                      0x0C
+#define NVME_REG_INTMC                      0x10
+#define NVME_REG_CC                         0x14
+#define NVME_REG_CSTS                       0x1C
+#define NVME_REG_AQA                        0x24
+#define NVME_REG_ASQ                        0x28
+#define NVME_REG_ACQ                        0x30
+#define NVME_REG_DOORBELL                   0x1000
+
+#define NVME_CAP_MQES_MASK                  0xFFFF
+#define NVME_CAP_TO_SHIFT                   24
+#define NVME_CAP_TO_MASK                    0xFF
+#define NVME_CAP_DSTRD_SHIFT                32
+#define NVME_CAP_DSTRD_MASK                 0x0F
+
+#define NVME_CC_EN                          (1 << 0)
+#define NVME_CC_IOSQES                      (6 << 16)
+#define NVME_CC_IOCQES                      (4 << 20)
+#define NVME_CSTS_RDY                       (1 << 0)
+#define NVME_CSTS_CFS                       (1 << 1)
+
+//Admin commands
+#define NVME_ADMIN_CREATE_SQ                0x01
+#define NVME_ADMIN_CREATE_CQ                0x05
+#define NVME_ADMIN_IDENTIFY                 0x06
+#define NVME_ADMIN_SET_FEATURES             0x09
+
+#define NVME_CNS_NAMESPACE                  0x00
+#define NVME_CNS_CONTROLLER                 0x01
+#define NVME_FEAT_NUM_QUEUES                0x07
+
+#define NVME_QUEUE_CONTIG                   (1 << 0)
+#define NVME_QUEUE_IEN                      (1 << 1)
+
+//I/O commands
+#define NVME_CMD_WRITE                      0x01
+#define NVME_CMD_READ                       0x02
+
+//Data pointer types (PSDT field of the command dword 0)
+#define NVME_PSDT_PRP                       (0 << 14)
+#define NVME_PSDT_SGL                       (1 << 14)
+
+//SGL descriptor types (upper nibble of the last byte)
+#define NVME_SGL_DATA_BLOCK                 0x00
+#define NVME_SGL_LAST_SEGMENT               0x30
+
+//Identify controller: SGL support
+#define NVME_ID_CTRL_MDTS                   77
+#define NVME_ID_CTRL_NN                     516
+#define NVME_ID_CTRL_SGLS                   536
+
+//Submission queue entry
+typedef struct {
+    //Opcode, data pointer type, command ID
+    uint32_t cdw0;
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    //PRP entries or an SGL descriptor
+    uint64_t dptr[2];
+    uint32_t cdw10, cdw11, cdw12, cdw13, cdw14, cdw15;
+} __attribute__((packed)) nvme_sqe_t;
+
+//Completion queue entry
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    //Phase tag (bit 0) and status
+    volatile uint16_t status;
+} __attribute__((packed)) nvme_cqe_t;
+
+//SGL descriptor
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint8_t reserved[3];
+    uint8_t type;
+} __attribute__((packed)) nvme_sgl_t;
+
+//Scatter-gather list element of a transfer
+typedef struct {
+    void* addr;
+    uint32_t len;
+} nvme_sg_t;
+
+//Called when a command completes (ok = 0 if it has failed)
+//Runs with interrupts disabled
+typedef void(*nvme_done_t)(void* arg, uint8_t ok);
+
+struct _nvme_ctrl_s;
+
+//Submission/completion queue pair
+typedef struct {
+    struct _nvme_ctrl_s* ctrl;
+    uint16_t id;
+    uint16_t depth;
+    nvme_sqe_t* sq;
+    nvme_cqe_t* cq;
+    volatile uint32_t* sq_db;
+    volatile uint32_t* cq_db;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint8_t phase;
+    //Interrupt vector (0 if the queue is polled)
+    uint8_t vector;
+    //Command IDs in use
+    uint64_t busy;
+    //Result dword of the completion whose callback is running
+    uint32_t cur_result;
+    nvme_done_t done[NVME_QUEUE_DEPTH];
+    void* done_arg[NVME_QUEUE_DEPTH];
+    //PRP list / SGL segment page of every command ID
+    void* lists[NVME_QUEUE_DEPTH];
+} nvme_queue_t;
+
+//Controller
+typedef struct _nvme_ctrl_s {
+    pci_dev_t* dev;
+    volatile uint8_t* regs;
+    uint64_t cap;
+    //Largest transfer (bytes)
+    uint32_t max_bytes;
+    uint8_t sgl;
+    pci_msix_t msix;
+    nvme_queue_t admin;
+    uint8_t io_cnt;
+    nvme_queue_t io[NVME_MAX_IO_QUEUES];
+} nvme_ctrl_t;
+
+//Namespace
+typedef struct {
+    nvme_ctrl_t* ctrl;
+    uint32_t nsid;
+    uint64_t sectors;
+    uint32_t sect_size;
+} nvme_ns_t;
+
+void nvme_probe(pci_dev_t* dev);
+
+uint32_t nvme_disk_cnt(void);
+uint64_t nvme_disk_sectors(uint32_t disk);
+uint32_t nvme_disk_sect_size(uint32_t disk);
+uint8_t nvme_submit(uint32_t disk, uint64_t lba, uint32_t count, nvme_sg_t* sg, uint32_t sg_cnt,
+                    uint8_t write, nvme_done_t done, void* arg);
+uint8_t nvme_read(uint32_t disk, uint64_t lba, uint32_t count, void* buf);
+uint8_t nvme_write(uint32_t disk, uint64_t lba, uint32_t count, void* buf);
+
+#endif
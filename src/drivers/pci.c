@@ -3,67 +3,583 @@
 
 #include "./pci.h"
 #include "./usb.h"
+#include "./ata.h"
+#include "./ahci.h"
+#include "./nvme.h"
 #include "../stdlib.h"
 #include "./gfx.h"
+#include "./apic.h"
+#include "./acpi.h"
+#include "../vmem/vmem.h"
+#include "../mtask/mtask.h"
+
+//ECAM regions of PCI segment 0
+typedef struct {
+    uint64_t base;
+    uint8_t bus_start, bus_end;
+} pci_ecam_t;
+pci_ecam_t pci_ecam[ACPI_MAX_MCFG];
+uint8_t pci_ecam_cnt = 0;
 
 /*
- * Read config word from a PCI device
+ * Locates the memory-mapped configuration space through the ACPI MCFG table
+ *   and maps it uncached
+ * Buses not covered by it are accessed through the legacy ports
+ */
+void pci_ecam_init(void){
+    acpi_mcfg_info_t* mcfg = acpi_get_mcfg();
+    if(mcfg == NULL)
+        return;
+    for(uint8_t i = 0; i < mcfg->cnt; i++){
+        acpi_mcfg_entry_t* entry = &mcfg->entries[i];
+        //Only segment 0 is reachable through the legacy ports too,
+        //  the rest of the code doesn't know about segments
+        if(entry->segment != 0 || entry->bus_end < entry->bus_start)
+            continue;
+        //The base address corresponds to bus 0 even if the region starts later
+        uint64_t st = entry->base + ((uint64_t)entry->bus_start << 20);
+        uint64_t end = entry->base + (((uint64_t)entry->bus_end + 1) << 20);
+        if(!vmem_set_type((phys_addr_t)st, (phys_addr_t)end, VMEM_TYPE_UC))
+            continue;
+        pci_ecam_t* ecam = &pci_ecam[pci_ecam_cnt++];
+        ecam->base = entry->base;
+        ecam->bus_start = entry->bus_start;
+        ecam->bus_end = entry->bus_end;
+    }
+}
+
+/*
+ * Returns a pointer to a register in the memory-mapped configuration space of a function
+ *   or NULL if it isn't reachable that way
+ */
+volatile void* pci_config_ptr(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs){
+    for(uint8_t i = 0; i < pci_ecam_cnt; i++){
+        pci_ecam_t* ecam = &pci_ecam[i];
+        if(bus < ecam->bus_start || bus > ecam->bus_end)
+            continue;
+        return (volatile void*)(ecam->base + ((uint64_t)bus << 20) + ((uint64_t)(slot & 0x1F) << 15)
+                                + ((uint64_t)(func & 7) << 12) + (offs & 0xFFF));
+    }
+    return NULL;
+}
+
+/*
+ * Selects a register through the legacy configuration address port
+ * (the caller has to be in a critical section until it accesses the data port)
  */
-uint16_t pci_read_config_16(unsigned char bus, unsigned char slot, unsigned char func, unsigned char offs){
+void pci_config_addr(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs){
     //Construct the total address
     uint32_t addr = (uint32_t)((uint32_t)0x80000000 | (offs & 0xFC) | ((uint32_t)func << 8)
         | ((uint32_t)slot << 11) | ((uint32_t)bus << 16));
     //Write address to I/O port
     outl(0xCF8, addr);
+}
+
+/*
+ * Read config word from a PCI device
+ */
+uint16_t pci_read_config_16(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs){
+    volatile void* ptr = pci_config_ptr(bus, slot, func, offs & ~1);
+    if(ptr != NULL)
+        return *(volatile uint16_t*)ptr;
+    //The legacy ports only reach the first 256 bytes
+    if(offs >= 256)
+        return 0xFFFF;
+    uint64_t rflags = mtask_crit_enter();
+    pci_config_addr(bus, slot, func, offs);
     //Read the response
     uint32_t data = inl(0xCFC);
+    mtask_crit_leave(rflags);
     //Format it
-    uint16_t val = (short)((data >> ((offs & 2) * 8)) & 0xffff);
-    return val;
+    return (data >> ((offs & 2) * 8)) & 0xFFFF;
 }
 
 /*
  * Read config doubleword from a PCI device
  */
-uint16_t pci_read_config_32(unsigned char bus, unsigned char slot, unsigned char func, unsigned char offs){
-    //Construct the total address
-    uint32_t addr = (uint32_t)((uint32_t)0x80000000 | (offs & 0xFC) | ((uint32_t)func << 8)
-        | ((uint32_t)slot << 11) | ((uint32_t)bus << 16));
-    //Write address to I/O port
-    outl(0xCF8, addr);
+uint32_t pci_read_config_32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs){
+    volatile void* ptr = pci_config_ptr(bus, slot, func, offs & ~3);
+    if(ptr != NULL)
+        return *(volatile uint32_t*)ptr;
+    if(offs >= 256)
+        return 0xFFFFFFFF;
+    uint64_t rflags = mtask_crit_enter();
+    pci_config_addr(bus, slot, func, offs);
     //Read the response
-    return inl(0xCFC);
+    uint32_t data = inl(0xCFC);
+    mtask_crit_leave(rflags);
+    return data;
 }
 
 /*
- * Enumerates and initializes all known PCI devices
+ * Write config word to a PCI device
  */
-void pci_enumerate(void){
-    gfx_verbose_println("Enumerating PCI devices");
-    for(int b = 0; b < 256; b++){
-        for(int d = 0; d < 256; d++){
-            //Read device VID
-            short vendor = pci_read_config_16(b, d, 0, 0);
-            if(vendor != 0xFFFFFFFF){ //VID=FFFF means there is no device
-                uint16_t product = pci_read_config_16(b, d, 0, 2); //Read PID
-                uint16_t class_sub = pci_read_config_16(b, d, 0, 10); //Read class and subclass
-                uint16_t if_rev = pci_read_config_16(b, d, 0, 8); //Read interface and revision
-                char temp[100] = "Found PCI device VID=";
-                char temp2[15];
-                strcat(temp, sprintub16(temp2, (uint16_t)vendor, 4));
-                strcat(temp, " PID=");
-                strcat(temp, sprintub16(temp2, (uint16_t)product, 4));
-                gfx_verbose_println(temp);
-                //Try to detect a known device
-                //Firstly, USB controllers (C=0C, S=03)
-                if(class_sub == 0x00000C03){
-                    //EHCI, IF=0x20
-                    if((if_rev & 0xFF00) == 0x2000){
-                        gfx_verbose_println("  (EHCI controller)");
-                        ehci_add_cont(b, d);
-                    }
-                }
-            }
+void pci_write_config_16(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs, uint16_t val){
+    volatile void* ptr = pci_config_ptr(bus, slot, func, offs & ~1);
+    if(ptr != NULL){
+        *(volatile uint16_t*)ptr = val;
+        return;
+    }
+    if(offs >= 256)
+        return;
+    uint64_t rflags = mtask_crit_enter();
+    pci_config_addr(bus, slot, func, offs);
+    //The data port decodes the lower address bits itself
+    outw(0xCFC + (offs & 2), val);
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Write config doubleword to a PCI device
+ */
+void pci_write_config_32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs, uint32_t val){
+    volatile void* ptr = pci_config_ptr(bus, slot, func, offs & ~3);
+    if(ptr != NULL){
+        *(volatile uint32_t*)ptr = val;
+        return;
+    }
+    if(offs >= 256)
+        return;
+    uint64_t rflags = mtask_crit_enter();
+    pci_config_addr(bus, slot, func, offs);
+    outl(0xCFC, val);
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Finds a capability in the capability list of a PCI function
+ * Returns its config space offset or 0 if it's not there
+ */
+uint8_t pci_find_cap(uint8_t bus, uint8_t slot, uint8_t func, uint8_t id){
+    if(!(pci_read_config_16(bus, slot, func, PCI_REG_STATUS) & PCI_STATUS_CAP_LIST))
+        return 0;
+    uint8_t ptr = pci_read_config_16(bus, slot, func, PCI_REG_CAP_PTR) & 0xFC;
+    //The list can't have more entries than fit in the config space,
+    //  so a looped one is cut off
+    for(uint32_t i = 0; i < 48 && ptr >= 0x40; i++){
+        uint16_t hdr = pci_read_config_16(bus, slot, func, ptr);
+        if((hdr & 0xFF) == id)
+            return ptr;
+        ptr = (hdr >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+/*
+ * Finds a PCI Express extended capability of a function
+ * Returns its config space offset or 0 if it's not there
+ *   (or the extended space isn't reachable)
+ */
+uint16_t pci_find_ext_cap(uint8_t bus, uint8_t slot, uint8_t func, uint16_t id){
+    if(pci_config_ptr(bus, slot, func, 0) == NULL)
+        return 0;
+    uint16_t ptr = PCI_EXT_CAP_START;
+    for(uint32_t i = 0; i < 960 && ptr >= PCI_EXT_CAP_START; i++){
+        uint32_t hdr = pci_read_config_32(bus, slot, func, ptr);
+        if(hdr == 0 || hdr == 0xFFFFFFFF)
+            return 0;
+        if((hdr & 0xFFFF) == id)
+            return ptr;
+        ptr = (hdr >> 20) & 0xFFC;
+    }
+    return 0;
+}
+
+/*
+ * Returns the address a memory BAR points to
+ */
+uint64_t pci_bar_addr(uint8_t bus, uint8_t slot, uint8_t func, uint8_t bar){
+    uint32_t lo = pci_read_config_32(bus, slot, func, PCI_REG_BAR0 + (bar * 4));
+    if(lo & PCI_BAR_IO)
+        return 0;
+    uint64_t addr = lo & 0xFFFFFFF0;
+    if((lo & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64)
+        addr |= (uint64_t)pci_read_config_32(bus, slot, func, PCI_REG_BAR0 + (bar * 4) + 4) << 32;
+    return addr;
+}
+
+/*
+ * Sets INTx delivery of a function on or off
+ */
+void pci_intx(uint8_t bus, uint8_t slot, uint8_t func, uint8_t enable){
+    uint16_t cmd = pci_read_config_16(bus, slot, func, PCI_REG_COMMAND);
+    if(enable)
+        cmd &= ~PCI_CMD_INTX_DISABLE;
+    else
+        cmd |= PCI_CMD_INTX_DISABLE;
+    pci_write_config_16(bus, slot, func, PCI_REG_COMMAND, cmd);
+}
+
+/*
+ * Makes a function deliver a single MSI to the current CPU at the vector
+ *   (allocated with irq_alloc())
+ * Returns 0 if the function doesn't support MSI
+ */
+uint8_t pci_msi_enable(uint8_t bus, uint8_t slot, uint8_t func, uint8_t vector){
+    uint8_t cap = pci_find_cap(bus, slot, func, PCI_CAP_MSI);
+    if(cap == 0)
+        return 0;
+    uint16_t ctrl = pci_read_config_16(bus, slot, func, cap + PCI_MSI_CTRL);
+    //Program the message
+    pci_write_config_32(bus, slot, func, cap + PCI_MSI_ADDR_LO, PCI_MSI_ADDR(apic_get_id() >> 24));
+    if(ctrl & PCI_MSI_CTRL_64BIT){
+        pci_write_config_32(bus, slot, func, cap + PCI_MSI_ADDR_HI, 0);
+        pci_write_config_16(bus, slot, func, cap + PCI_MSI_DATA_64, vector);
+    } else {
+        pci_write_config_16(bus, slot, func, cap + PCI_MSI_DATA_32, vector);
+    }
+    //Unmask the only vector used
+    if(ctrl & PCI_MSI_CTRL_MASKABLE)
+        pci_write_config_32(bus, slot, func,
+            cap + ((ctrl & PCI_MSI_CTRL_64BIT) ? PCI_MSI_MASK_64 : PCI_MSI_MASK_32), 0);
+    //Enable it with one message
+    ctrl &= ~PCI_MSI_CTRL_MME_MASK;
+    pci_write_config_16(bus, slot, func, cap + PCI_MSI_CTRL, ctrl | PCI_MSI_CTRL_ENABLE);
+    pci_intx(bus, slot, func, 0);
+    return 1;
+}
+
+/*
+ * Switches a function back from MSI to INTx
+ */
+void pci_msi_disable(uint8_t bus, uint8_t slot, uint8_t func){
+    uint8_t cap = pci_find_cap(bus, slot, func, PCI_CAP_MSI);
+    if(cap == 0)
+        return;
+    uint16_t ctrl = pci_read_config_16(bus, slot, func, cap + PCI_MSI_CTRL);
+    pci_write_config_16(bus, slot, func, cap + PCI_MSI_CTRL, ctrl & ~PCI_MSI_CTRL_ENABLE);
+    pci_intx(bus, slot, func, 1);
+}
+
+/*
+ * Locates the MSI-X table of an enumerated function, maps it and masks all its entries
+ * Returns the number of entries (0 if the function doesn't support MSI-X)
+ */
+uint16_t pci_msix_init(pci_msix_t* msix, pci_dev_t* dev){
+    uint8_t cap = pci_dev_cap(dev, PCI_CAP_MSIX);
+    if(cap == 0)
+        return 0;
+    uint16_t ctrl = pci_read_config_16(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL);
+    uint32_t table = pci_read_config_32(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_TABLE);
+    //Mapping the BAR also turns memory decoding on, without which the table isn't accessible
+    volatile uint8_t* bar = (volatile uint8_t*)pci_map_bar(dev, table & PCI_MSIX_BIR_MASK);
+    if(bar == NULL)
+        return 0;
+    msix->bus = dev->bus;
+    msix->slot = dev->slot;
+    msix->func = dev->func;
+    msix->cap = cap;
+    msix->size = (ctrl & PCI_MSIX_CTRL_SIZE_MASK) + 1;
+    msix->table = (volatile uint32_t*)(bar + (table & ~PCI_MSIX_BIR_MASK));
+    //Start with everything masked
+    pci_write_config_16(dev->bus, dev->slot, dev->func, cap + PCI_MSIX_CTRL, ctrl | PCI_MSIX_CTRL_FUNC_MASK);
+    for(uint16_t i = 0; i < msix->size; i++)
+        pci_msix_mask(msix, i, 1);
+    return msix->size;
+}
+
+/*
+ * Points an MSI-X table entry at a vector (allocated with irq_alloc())
+ *   on the current CPU and unmasks it
+ */
+void pci_msix_set(pci_msix_t* msix, uint16_t entry, uint8_t vector){
+    if(entry >= msix->size)
+        return;
+    volatile uint32_t* ent = msix->table + (entry * PCI_MSIX_ENTRY_SIZE / 4);
+    //The entry must be masked while it's being changed
+    ent[PCI_MSIX_ENTRY_CTRL / 4] |= PCI_MSIX_ENTRY_CTRL_MASKED;
+    ent[PCI_MSIX_ENTRY_ADDR_LO / 4] = PCI_MSI_ADDR(apic_get_id() >> 24);
+    ent[PCI_MSIX_ENTRY_ADDR_HI / 4] = 0;
+    ent[PCI_MSIX_ENTRY_DATA / 4] = vector;
+    ent[PCI_MSIX_ENTRY_CTRL / 4] &= ~PCI_MSIX_ENTRY_CTRL_MASKED;
+}
+
+/*
+ * Masks or unmasks an MSI-X table entry
+ */
+void pci_msix_mask(pci_msix_t* msix, uint16_t entry, uint8_t masked){
+    if(entry >= msix->size)
+        return;
+    volatile uint32_t* ctrl = msix->table + ((entry * PCI_MSIX_ENTRY_SIZE + PCI_MSIX_ENTRY_CTRL) / 4);
+    if(masked)
+        *ctrl |= PCI_MSIX_ENTRY_CTRL_MASKED;
+    else
+        *ctrl &= ~PCI_MSIX_ENTRY_CTRL_MASKED;
+}
+
+/*
+ * Enables MSI-X delivery for the entries that are set up
+ */
+void pci_msix_enable(pci_msix_t* msix){
+    uint16_t ctrl = pci_read_config_16(msix->bus, msix->slot, msix->func, msix->cap + PCI_MSIX_CTRL);
+    ctrl = (ctrl | PCI_MSIX_CTRL_ENABLE) & ~PCI_MSIX_CTRL_FUNC_MASK;
+    pci_write_config_16(msix->bus, msix->slot, msix->func, msix->cap + PCI_MSIX_CTRL, ctrl);
+    pci_intx(msix->bus, msix->slot, msix->func, 0);
+}
+
+/*
+ * Switches a function back from MSI-X to INTx
+ */
+void pci_msix_disable(pci_msix_t* msix){
+    uint16_t ctrl = pci_read_config_16(msix->bus, msix->slot, msix->func, msix->cap + PCI_MSIX_CTRL);
+    pci_write_config_16(msix->bus, msix->slot, msix->func, msix->cap + PCI_MSIX_CTRL, ctrl & ~PCI_MSIX_CTRL_ENABLE);
+    pci_intx(msix->bus, msix->slot, msix->func, 1);
+}
+
+/*
+ * Driver match table
+ * The first matching entry claims a function, the probe functions are run
+ *   by pci_start_drivers() once interrupts and timers are available
+ */
+void _pci_probe_ehci(pci_dev_t* dev){
+    ehci_add_cont(dev);
+}
+
+const pci_driver_t pci_drivers[] = {
+    //USB controllers (C=0C, S=03), EHCI (IF=20)
+    {PCI_ANY, PCI_ANY, 0x0C, 0x03, 0x20, "EHCI controller", _pci_probe_ehci},
+    //Mass storage controllers (C=01), IDE (S=01)
+    {PCI_ANY, PCI_ANY, 0x01, 0x01, PCI_ANY, "IDE controller", ata_probe},
+    //Mass storage controllers (C=01), SATA (S=06), AHCI (IF=01)
+    {PCI_ANY, PCI_ANY, 0x01, 0x06, 0x01, "AHCI controller", ahci_probe},
+    //Mass storage controllers (C=01), NVM (S=08), NVMe (IF=02)
+    {PCI_ANY, PCI_ANY, 0x01, 0x08, 0x02, "NVMe controller", nvme_probe},
+};
+
+//Device table
+pci_dev_t pci_devs[PCI_MAX_DEVS];
+uint32_t pci_devs_cnt = 0;
+//Buses that have been scanned
+uint64_t pci_bus_scanned[256 / 64];
+
+void pci_scan_bus(uint8_t bus);
+
+/*
+ * Reads the BARs of a function into its table entry and sizes them
+ */
+void pci_read_bars(pci_dev_t* dev){
+    //Bridges only have two
+    uint8_t cnt = ((dev->header_type & PCI_HEADER_TYPE_MASK) == PCI_HEADER_TYPE_BRIDGE) ? 2 : PCI_MAX_BARS;
+    if((dev->header_type & PCI_HEADER_TYPE_MASK) > PCI_HEADER_TYPE_BRIDGE)
+        cnt = 0;
+    //Stop the function from decoding while the BARs hold the sizing pattern
+    uint16_t cmd = pci_read_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    pci_write_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd & ~(PCI_CMD_IO | PCI_CMD_MEM));
+    for(uint8_t i = 0; i < cnt; i++){
+        uint16_t reg = PCI_REG_BAR0 + (i * 4);
+        uint32_t lo = pci_read_config_32(dev->bus, dev->slot, dev->func, reg);
+        //Writing all ones makes the BAR read back the size mask
+        pci_write_config_32(dev->bus, dev->slot, dev->func, reg, 0xFFFFFFFF);
+        uint32_t lo_mask = pci_read_config_32(dev->bus, dev->slot, dev->func, reg);
+        pci_write_config_32(dev->bus, dev->slot, dev->func, reg, lo);
+        if(lo & PCI_BAR_IO){
+            dev->bar[i] = lo & 0xFFFFFFFC;
+            dev->bar_flags[i] = PCI_BAR_IO;
+            uint32_t mask = (lo_mask & 0xFFFFFFFC) | 0xFFFF0000;
+            dev->bar_size[i] = (lo_mask == 0) ? 0 : (uint32_t)(~mask + 1);
+            continue;
+        }
+        dev->bar[i] = lo & 0xFFFFFFF0;
+        dev->bar_flags[i] = lo & (PCI_BAR_TYPE_MASK | PCI_BAR_PREFETCH);
+        uint64_t mask = 0xFFFFFFFF00000000ULL | (lo_mask & 0xFFFFFFF0);
+        //The next BAR holds the upper half of a 64-bit one
+        if((lo & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64 && i + 1 < cnt){
+            uint32_t hi = pci_read_config_32(dev->bus, dev->slot, dev->func, reg + 4);
+            pci_write_config_32(dev->bus, dev->slot, dev->func, reg + 4, 0xFFFFFFFF);
+            uint32_t hi_mask = pci_read_config_32(dev->bus, dev->slot, dev->func, reg + 4);
+            pci_write_config_32(dev->bus, dev->slot, dev->func, reg + 4, hi);
+            dev->bar[i] |= (uint64_t)hi << 32;
+            mask = ((uint64_t)hi_mask << 32) | (lo_mask & 0xFFFFFFF0);
         }
+        //A BAR that reads back zeroes isn't implemented
+        dev->bar_size[i] = ((lo_mask & 0xFFFFFFF0) == 0 && (mask >> 32) == 0xFFFFFFFF) ? 0 : (~mask + 1);
+        if((lo & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64)
+            i++;
     }
-}
\ No newline at end of file
+    pci_write_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd);
+}
+
+/*
+ * Reads the capability list of a function into its table entry
+ */
+void pci_read_caps(pci_dev_t* dev){
+    if(!(pci_read_config_16(dev->bus, dev->slot, dev->func, PCI_REG_STATUS) & PCI_STATUS_CAP_LIST))
+        return;
+    uint8_t ptr = pci_read_config_16(dev->bus, dev->slot, dev->func, PCI_REG_CAP_PTR) & 0xFC;
+    for(uint32_t i = 0; i < 48 && ptr >= 0x40 && dev->cap_cnt < PCI_MAX_CAPS; i++){
+        uint16_t hdr = pci_read_config_16(dev->bus, dev->slot, dev->func, ptr);
+        dev->cap_id[dev->cap_cnt] = hdr & 0xFF;
+        dev->cap_offs[dev->cap_cnt] = ptr;
+        dev->cap_cnt++;
+        ptr = (hdr >> 8) & 0xFC;
+    }
+}
+
+/*
+ * Adds a function to the device table, following it if it's a bridge
+ */
+void pci_scan_func(uint8_t bus, uint8_t slot, uint8_t func){
+    if(pci_devs_cnt >= PCI_MAX_DEVS)
+        return;
+    pci_dev_t* dev = &pci_devs[pci_devs_cnt++];
+    memset(dev, 0, sizeof(pci_dev_t));
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    uint32_t id = pci_read_config_32(bus, slot, func, PCI_REG_VENDOR);
+    dev->vendor = id & 0xFFFF;
+    dev->product = id >> 16;
+    uint32_t class = pci_read_config_32(bus, slot, func, PCI_REG_REVISION);
+    dev->revision = class & 0xFF;
+    dev->prog_if = (class >> 8) & 0xFF;
+    dev->subclass = (class >> 16) & 0xFF;
+    dev->class = class >> 24;
+    dev->header_type = pci_read_config_16(bus, slot, func, PCI_REG_HEADER_TYPE) & 0xFF;
+    uint16_t intr = pci_read_config_16(bus, slot, func, PCI_REG_INT_LINE);
+    dev->int_line = intr & 0xFF;
+    dev->int_pin = intr >> 8;
+    pci_read_bars(dev);
+    pci_read_caps(dev);
+    //Follow PCI-to-PCI bridges
+    if(dev->class == PCI_CLASS_BRIDGE && dev->subclass == PCI_SUBCLASS_BRIDGE_PCI){
+        uint8_t secondary = pci_read_config_16(bus, slot, func, PCI_REG_PRIMARY_BUS) >> 8;
+        if(secondary != 0)
+            pci_scan_bus(secondary);
+    }
+}
+
+/*
+ * Scans all slots of a bus
+ */
+void pci_scan_bus(uint8_t bus){
+    //A misconfigured bridge could make us loop
+    if(pci_bus_scanned[bus / 64] & (1ULL << (bus % 64)))
+        return;
+    pci_bus_scanned[bus / 64] |= 1ULL << (bus % 64);
+    for(uint8_t slot = 0; slot < PCI_SLOTS; slot++){
+        if(pci_read_config_16(bus, slot, 0, PCI_REG_VENDOR) == PCI_VENDOR_NONE)
+            continue;
+        pci_scan_func(bus, slot, 0);
+        //Only multi-function devices decode the other functions
+        if(!(pci_read_config_16(bus, slot, 0, PCI_REG_HEADER_TYPE) & PCI_HEADER_MULTIFUNC))
+            continue;
+        for(uint8_t func = 1; func < PCI_FUNCS; func++)
+            if(pci_read_config_16(bus, slot, func, PCI_REG_VENDOR) != PCI_VENDOR_NONE)
+                pci_scan_func(bus, slot, func);
+    }
+}
+
+/*
+ * Finds the driver for a function in the match table
+ */
+void pci_match(pci_dev_t* dev){
+    for(uint32_t i = 0; i < sizeof(pci_drivers) / sizeof(*pci_drivers); i++){
+        const pci_driver_t* drv = &pci_drivers[i];
+        if((drv->vendor != PCI_ANY && drv->vendor != dev->vendor) ||
+           (drv->product != PCI_ANY && drv->product != dev->product) ||
+           (drv->class != PCI_ANY && drv->class != dev->class) ||
+           (drv->subclass != PCI_ANY && drv->subclass != dev->subclass) ||
+           (drv->prog_if != PCI_ANY && drv->prog_if != dev->prog_if))
+            continue;
+        dev->driver = drv;
+        return;
+    }
+}
+
+/*
+ * Enumerates all PCI functions into the device table and finds their drivers
+ */
+void pci_enumerate(void){
+    pci_ecam_init();
+    pci_devs_cnt = 0;
+    memset(pci_bus_scanned, 0, sizeof(pci_bus_scanned));
+    //With multiple host bridges, function N of 00:00 is the one for bus N
+    if(pci_read_config_16(0, 0, 0, PCI_REG_HEADER_TYPE) & PCI_HEADER_MULTIFUNC){
+        for(uint8_t func = 0; func < PCI_FUNCS; func++)
+            if(pci_read_config_16(0, 0, func, PCI_REG_VENDOR) != PCI_VENDOR_NONE)
+                pci_scan_bus(func);
+    } else {
+        pci_scan_bus(0);
+    }
+    //Match the drivers
+    for(uint32_t i = 0; i < pci_devs_cnt; i++)
+        pci_match(&pci_devs[i]);
+    char temp[64] = "PCI devices found: ";
+    char temp2[16];
+    strcat(temp, sprintu(temp2, pci_devs_cnt, 1));
+    gfx_verbose_println(temp);
+}
+
+/*
+ * Maps a memory BAR of an enumerated function and enables memory decoding
+ * Prefetchable BARs are mapped write-combining, the rest uncached
+ * Returns NULL if the BAR isn't a memory one or can't be mapped
+ */
+volatile void* pci_map_bar(pci_dev_t* dev, uint8_t bar){
+    if(bar >= PCI_MAX_BARS || (dev->bar_flags[bar] & PCI_BAR_IO) || dev->bar[bar] == 0 || dev->bar_size[bar] == 0)
+        return NULL;
+    if(!(dev->bar_mapped & (1 << bar))){
+        uint8_t type = (dev->bar_flags[bar] & PCI_BAR_PREFETCH) ? VMEM_TYPE_WC : VMEM_TYPE_UC;
+        if(!vmem_set_type((phys_addr_t)dev->bar[bar], (phys_addr_t)(dev->bar[bar] + dev->bar_size[bar]), type))
+            return NULL;
+        dev->bar_mapped |= 1 << bar;
+    }
+    uint16_t cmd = pci_read_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    if(!(cmd & PCI_CMD_MEM))
+        pci_write_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd | PCI_CMD_MEM);
+    return (volatile void*)dev->bar[bar];
+}
+
+/*
+ * Allows or forbids an enumerated function to initiate DMA
+ */
+void pci_bus_master(pci_dev_t* dev, uint8_t enable){
+    uint16_t cmd = pci_read_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND);
+    if(enable)
+        cmd |= PCI_CMD_BUS_MASTER;
+    else
+        cmd &= ~PCI_CMD_BUS_MASTER;
+    pci_write_config_16(dev->bus, dev->slot, dev->func, PCI_REG_COMMAND, cmd);
+}
+
+/*
+ * Initializes the functions that have been claimed by a driver
+ */
+void pci_start_drivers(void){
+    for(uint32_t i = 0; i < pci_devs_cnt; i++){
+        pci_dev_t* dev = &pci_devs[i];
+        if(dev->driver == NULL)
+            continue;
+        char temp[64] = "Starting ";
+        strcat(temp, dev->driver->name);
+        gfx_verbose_println(temp);
+        dev->driver->probe(dev);
+    }
+}
+
+/*
+ * Returns the number of functions in the device table
+ */
+uint32_t pci_dev_cnt(void){
+    return pci_devs_cnt;
+}
+
+/*
+ * Returns a function from the device table
+ */
+pci_dev_t* pci_get_dev(uint32_t idx){
+    if(idx >= pci_devs_cnt)
+        return NULL;
+    return &pci_devs[idx];
+}
+
+/*
+ * Returns the config space offset of a capability of an enumerated function
+ *   or 0 if it doesn't have it
+ */
+uint8_t pci_dev_cap(pci_dev_t* dev, uint8_t id){
+    for(uint8_t i = 0; i < dev->cap_cnt; i++)
+        if(dev->cap_id[i] == id)
+            return dev->cap_offs[i];
+    return 0;
+}
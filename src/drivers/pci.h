@@ -3,9 +3,166 @@
 
 #include "../stdlib.h"
 
-uint16_t pci_read_config_16(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offs);
-uint16_t pci_read_config_32(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offs);
+//Configuration space registers
+#define PCI_REG_VENDOR                      0x00
+#define PCI_REG_PRODUCT                     0x02
+#define PCI_REG_COMMAND                     0x04
+#define PCI_REG_STATUS                      0x06
+#define PCI_REG_REVISION                    0x08
+#define PCI_REG_PROG_IF                     0x09
+#define PCI_REG_SUBCLASS                    0x0A
+#define PCI_REG_CLASS                       0x0B
+#define PCI_REG_HEADER_TYPE                 0x0E
+#define PCI_REG_BAR0                        0x10
+#define PCI_REG_CAP_PTR                     0x34
+#define PCI_REG_INT_LINE                    0x3C
+#define PCI_REG_INT_PIN                     0x3D
+//PCI-to-PCI bridges
+#define PCI_REG_PRIMARY_BUS                 0x18
+#define PCI_REG_SECONDARY_BUS               0x19
+
+#define PCI_HEADER_TYPE_MASK                0x7F
+#define PCI_HEADER_TYPE_DEVICE              0x00
+#define PCI_HEADER_TYPE_BRIDGE              0x01
+#define PCI_HEADER_MULTIFUNC                0x80
+
+#define PCI_SLOTS                           32
+#define PCI_FUNCS                           8
+#define PCI_VENDOR_NONE                     0xFFFF
+
+//PCI Express extended configuration space
+#define PCI_CONFIG_SIZE                     4096
+#define PCI_EXT_CAP_START                   0x100
+
+//Bridge classes
+#define PCI_CLASS_BRIDGE                    0x06
+#define PCI_SUBCLASS_BRIDGE_PCI             0x04
+
+#define PCI_CMD_IO                          (1 << 0)
+#define PCI_CMD_MEM                         (1 << 1)
+#define PCI_CMD_BUS_MASTER                  (1 << 2)
+#define PCI_CMD_INTX_DISABLE                (1 << 10)
+#define PCI_STATUS_CAP_LIST                 (1 << 4)
+
+//BAR bits
+#define PCI_BAR_IO                          (1 << 0)
+#define PCI_BAR_TYPE_MASK                   (3 << 1)
+#define PCI_BAR_TYPE_64                     (2 << 1)
+#define PCI_BAR_PREFETCH                    (1 << 3)
+
+//Capability IDs
+#define PCI_CAP_PM                          0x01
+#define PCI_CAP_MSI                         0x05
+#define PCI_CAP_PCIE                        0x10
+#define PCI_CAP_MSIX                        0x11
+
+//MSI capability (offsets from the capability)
+#define PCI_MSI_CTRL                        0x02
+#define PCI_MSI_ADDR_LO                     0x04
+#define PCI_MSI_ADDR_HI                     0x08
+#define PCI_MSI_DATA_32                     0x08
+#define PCI_MSI_DATA_64                     0x0C
+#define PCI_MSI_MASK_32                     0x0C
+#define PCI_MSI_MASK_64                     0x10
+
+#define PCI_MSI_CTRL_ENABLE                 (1 << 0)
+#define PCI_MSI_CTRL_MME_MASK               (7 << 4)
+#define PCI_MSI_CTRL_64BIT                  (1 << 7)
+#define PCI_MSI_CTRL_MASKABLE               (1 << 8)
+
+//MSI-X capability (offsets from the capability)
+#define PCI_MSIX_CTRL                       0x02
+#define PCI_MSIX_TABLE                      0x04
+#define PCI_MSIX_PBA                        0x08
+
+#define PCI_MSIX_CTRL_SIZE_MASK             0x07FF
+#define PCI_MSIX_CTRL_FUNC_MASK             (1 << 14)
+#define PCI_MSIX_CTRL_ENABLE                (1 << 15)
+#define PCI_MSIX_BIR_MASK                   7
+
+//MSI-X table entries
+#define PCI_MSIX_ENTRY_SIZE                 16
+#define PCI_MSIX_ENTRY_ADDR_LO              0x00
+#define PCI_MSIX_ENTRY_ADDR_HI              0x04
+#define PCI_MSIX_ENTRY_DATA                 0x08
+#define PCI_MSIX_ENTRY_CTRL                 0x0C
+#define PCI_MSIX_ENTRY_CTRL_MASKED          (1 << 0)
+
+//Message address of the local APIC with the given ID
+#define PCI_MSI_ADDR(APIC_ID)               (0xFEE00000 | ((uint32_t)(APIC_ID) << 12))
+
+//Device table
+#define PCI_MAX_DEVS                        128
+#define PCI_MAX_BARS                        6
+#define PCI_MAX_CAPS                        16
+
+struct _pci_driver_s;
+
+//Enumerated PCI function
+typedef struct {
+    uint8_t bus, slot, func;
+    uint8_t header_type;
+    uint16_t vendor, product;
+    uint8_t class, subclass, prog_if, revision;
+    uint8_t int_line, int_pin;
+    //Base addresses (the BAR flag bits are kept in bar_flags),
+    //  the upper half of a 64-bit BAR is merged into the lower one
+    uint64_t bar[PCI_MAX_BARS];
+    uint64_t bar_size[PCI_MAX_BARS];
+    uint8_t bar_flags[PCI_MAX_BARS];
+    //BARs that have been mapped with pci_map_bar() (one bit per BAR)
+    uint8_t bar_mapped;
+    //Capability IDs and their config space offsets
+    uint8_t cap_cnt;
+    uint8_t cap_id[PCI_MAX_CAPS];
+    uint8_t cap_offs[PCI_MAX_CAPS];
+    //Driver that has claimed the function
+    const struct _pci_driver_s* driver;
+} pci_dev_t;
+
+//Driver match table entry
+//PCI_ANY in any field matches everything
+#define PCI_ANY                             0xFFFF
+typedef struct _pci_driver_s {
+    uint16_t vendor, product;
+    uint16_t class, subclass, prog_if;
+    char* name;
+    void(*probe)(pci_dev_t* dev);
+} pci_driver_t;
+
+//MSI-X state of a function
+typedef struct {
+    uint8_t bus, slot, func;
+    uint8_t cap;
+    uint16_t size;
+    volatile uint32_t* table;
+} pci_msix_t;
+
+void pci_ecam_init(void);
+volatile void* pci_config_ptr(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs);
+uint16_t pci_read_config_16(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs);
+uint32_t pci_read_config_32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs);
+void pci_write_config_16(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs, uint16_t val);
+void pci_write_config_32(uint8_t bus, uint8_t slot, uint8_t func, uint16_t offs, uint32_t val);
+
+uint8_t pci_find_cap(uint8_t bus, uint8_t slot, uint8_t func, uint8_t id);
+uint16_t pci_find_ext_cap(uint8_t bus, uint8_t slot, uint8_t func, uint16_t id);
+uint64_t pci_bar_addr(uint8_t bus, uint8_t slot, uint8_t func, uint8_t bar);
+volatile void* pci_map_bar(pci_dev_t* dev, uint8_t bar);
+void pci_bus_master(pci_dev_t* dev, uint8_t enable);
+
+uint8_t pci_msi_enable(uint8_t bus, uint8_t slot, uint8_t func, uint8_t vector);
+void pci_msi_disable(uint8_t bus, uint8_t slot, uint8_t func);
+uint16_t pci_msix_init(pci_msix_t* msix, pci_dev_t* dev);
+void pci_msix_set(pci_msix_t* msix, uint16_t entry, uint8_t vector);
+void pci_msix_mask(pci_msix_t* msix, uint16_t entry, uint8_t masked);
+void pci_msix_enable(pci_msix_t* msix);
+void pci_msix_disable(pci_msix_t* msix);
 
 void pci_enumerate(void);
+void pci_start_drivers(void);
+uint32_t pci_dev_cnt(void);
+pci_dev_t* pci_get_dev(uint32_t idx);
+uint8_t pci_dev_cap(pci_dev_t* dev, uint8_t id);
 
 #endif
\ No newline at end of file
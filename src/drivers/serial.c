@@ -0,0 +1,41 @@
+//Neutron Project
+//Serial port (16550 UART) driver
+
+#include "./serial.h"
+#include "../stdlib.h"
+
+/*
+ * Initializes a serial port: 8 data bits, no parity, 1 stop bit
+ */
+void serial_init(uint16_t port, uint32_t baud){
+    //Disable interrupts
+    outb(port + SERIAL_REG_INT_EN, 0);
+    //Set the divisor (the base frequency is 115200 Hz)
+    uint16_t div = 115200 / baud;
+    outb(port + SERIAL_REG_LINE_CTL, 0x80);
+    outb(port + SERIAL_REG_DIV_LO, div & 0xFF);
+    outb(port + SERIAL_REG_DIV_HI, div >> 8);
+    //8N1, clear DLAB
+    outb(port + SERIAL_REG_LINE_CTL, 0x03);
+    //Enable and clear the FIFOs
+    outb(port + SERIAL_REG_FIFO_CTL, 0xC7);
+    //Set DTR and RTS
+    outb(port + SERIAL_REG_MODEM_CTL, 0x03);
+}
+
+/*
+ * Sends a character through the serial port
+ */
+void serial_putc(uint16_t port, char c){
+    //Wait for the transmitter holding register to be empty
+    while(!(inb(port + SERIAL_REG_LINE_STATUS) & (1 << 5)));
+    outb(port + SERIAL_REG_DATA, c);
+}
+
+/*
+ * Sends a string through the serial port
+ */
+void serial_puts(uint16_t port, char* str){
+    while(*str)
+        serial_putc(port, *(str++));
+}
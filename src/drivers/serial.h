@@ -0,0 +1,26 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "../stdlib.h"
+
+//Serial port I/O bases
+
+#define SERIAL_COM1                         0x3F8
+#define SERIAL_COM2                         0x2F8
+
+//Serial port registers
+
+#define SERIAL_REG_DATA                     0
+#define SERIAL_REG_INT_EN                   1
+#define SERIAL_REG_DIV_LO                   0
+#define SERIAL_REG_DIV_HI                   1
+#define SERIAL_REG_FIFO_CTL                 2
+#define SERIAL_REG_LINE_CTL                 3
+#define SERIAL_REG_MODEM_CTL                4
+#define SERIAL_REG_LINE_STATUS              5
+
+void serial_init(uint16_t port, uint32_t baud);
+void serial_putc(uint16_t port, char c);
+void serial_puts(uint16_t port, char* str);
+
+#endif
@@ -1,54 +1,156 @@
 //Neutron Project
-//Local APIC timer driver
+//Scheduler timer driver
+//Runs off the LAPIC timer, or off an HPET comparator if the LAPIC timer
+//  can't be relied upon
 
 #include "./timr.h"
 #include "./apic.h"
+#include "./clock.h"
+#include "./hpet.h"
+#include "../cpuid.h"
 #include "../stdlib.h"
 
-//The variable for keeping track of milliseconds since timer initialization
-uint64_t timr_millis = 0;
+//LAPIC timer frequency in Hz (with the divider set to 16)
+uint64_t timr_hz = 0;
+//TSC cycles -> timer ticks multiplier (CLOCK_TSC_SHIFT fractional bits)
+uint64_t timr_tick_mult = 0;
+//Scheduler tick period in TSC cycles
+uint64_t timr_tick_tsc = 0;
+//The hardware the timer runs off
+uint8_t timr_mode = TIMR_MODE_ONESHOT;
+//HPET comparator number and TSC cycles -> HPET ticks multiplier (HPET mode)
+uint8_t timr_hpet_tim;
+uint64_t timr_hpet_mult;
+//TSC value the timer is armed for (0 if it's not armed)
+uint64_t timr_armed = 0;
 
 /*
  * Initializes the timer
  */
 void timr_init(void){
+    //Calibrate the TSC first
+    clock_init();
+    timr_tick_tsc = clock_tsc_hz() / TIMR_HZ;
     apic_reg_wr(LAPIC_REG_TPR, 0);
     //Set the 16x divider
     apic_reg_wr(LAPIC_REG_TIMR_DIVCONF, 0x3);
-    //In order to use the APIC timer, we need to get
-    //  an initial clock source
-    //And we will count 100M CPU cycles for that
+    //Count the timer ticks during a known amount of TSC cycles
+    uint64_t cycles = clock_ns_to_tsc(TIMR_CAL_US * 1000);
+    apic_reg_wr(LAPIC_REG_LVT_TIM, TIMR_LVT_MASKED | 32);
     uint64_t tsc_start = rdtsc();
-    apic_reg_wr(LAPIC_REG_TIMR_INITCNT, 0xFFFFFFFF); //Set an initial count of uint32_t_max-1
-    //Wait for 10M cycles to pass
-    while(rdtsc() - tsc_start < 100000);
-    //Stop the APIC timer
-    apic_reg_wr(LAPIC_REG_LVT_TIM, 0x10000);
-    //Get the counter value
-    uint32_t cnt_val = apic_reg_rd(LAPIC_REG_TIMR_CURCNT);
-    uint32_t ticks_in_cycles = 0xFFFFFFFF - cnt_val;
-    apic_reg_wr(LAPIC_REG_LVT_TIM, 0x20000 | 32); //Enable the timer with interrupt vector #32
-    apic_reg_wr(LAPIC_REG_TIMR_DIVCONF, 0); //Set the divider to 2
-    apic_reg_wr(LAPIC_REG_TIMR_INITCNT, ticks_in_cycles); //Set the initial counter value
+    apic_reg_wr(LAPIC_REG_TIMR_INITCNT, 0xFFFFFFFF);
+    while(rdtsc() - tsc_start < cycles);
+    uint32_t ticks = 0xFFFFFFFF - apic_reg_rd(LAPIC_REG_TIMR_CURCNT);
+    uint64_t tsc_end = rdtsc();
+    apic_reg_wr(LAPIC_REG_TIMR_INITCNT, 0);
+    timr_hz = (uint64_t)ticks * clock_tsc_hz() / (tsc_end - tsc_start);
+    timr_tick_mult = ((uint64_t)ticks << CLOCK_TSC_SHIFT) / (tsc_end - tsc_start);
+
+    //Use the TSC-deadline mode if it's there, the one-shot mode otherwise
+    uint32_t edx, ecx, max, eax;
+    cpuid_get_feat(&edx, &ecx);
+    timr_mode = (ecx & CPUID_FEAT_ECX_TSC_DEADLINE) ? TIMR_MODE_DEADLINE : TIMR_MODE_ONESHOT;
+    //The LAPIC timer stops in deep C-states unless it's always running (ARAT),
+    //  switch to an HPET comparator in that case
+    cpuid_get_leaf(0, 0, &max, NULL, NULL, NULL);
+    eax = 0;
+    if(max >= 6)
+        cpuid_get_leaf(6, 0, &eax, NULL, NULL, NULL);
+    uint8_t want_hpet = !(eax & CPUID_FEAT_6_EAX_ARAT);
+    #ifdef TIMR_PREFER_HPET
+    want_hpet = 1;
+    #endif
+    int hpet_tim = want_hpet ? hpet_timer_fsb(32) : -1;
+    if(hpet_tim >= 0){
+        timr_mode = TIMR_MODE_HPET;
+        timr_hpet_tim = hpet_tim;
+        timr_hpet_mult = (hpet_freq() << CLOCK_TSC_SHIFT) / clock_tsc_hz();
+        apic_reg_wr(LAPIC_REG_LVT_TIM, TIMR_LVT_MASKED | 32);
+    } else {
+        apic_reg_wr(LAPIC_REG_LVT_TIM, ((timr_mode == TIMR_MODE_DEADLINE) ? TIMR_LVT_TSC_DEADLINE : TIMR_LVT_ONESHOT) | 32);
+    }
+    //Fire the first scheduler tick
+    timr_armed = 0;
+    timr_arm(rdtsc() + timr_tick_tsc);
+}
+
+/*
+ * Arms the timer to fire once at a certain TSC value (or disarms it if it's 0)
+ * Must be called with interrupts disabled
+ */
+void timr_arm(uint64_t tsc){
+    timr_armed = tsc;
+    if(timr_mode == TIMR_MODE_HPET){
+        if(tsc == 0){
+            hpet_timer_stop(timr_hpet_tim);
+            return;
+        }
+        uint64_t now = rdtsc();
+        uint64_t ticks = (tsc > now) ? (uint64_t)(((unsigned __int128)(tsc - now) * timr_hpet_mult) >> CLOCK_TSC_SHIFT) : 0;
+        hpet_timer_arm(timr_hpet_tim, ticks);
+        return;
+    }
+    if(timr_mode == TIMR_MODE_DEADLINE){
+        //Make sure the LVT write is done before the MSR write
+        __asm__ volatile("mfence" : : : "memory");
+        wrmsr(MSR_IA32_TSC_DEADLINE, tsc);
+        return;
+    }
+    uint64_t ticks = 0;
+    if(tsc != 0){
+        uint64_t now = rdtsc();
+        ticks = (tsc > now) ? (uint64_t)(((unsigned __int128)(tsc - now) * timr_tick_mult) >> CLOCK_TSC_SHIFT) : 1;
+        if(ticks == 0)
+            ticks = 1;
+        //Fire early if it's too far away, the scheduler will re-arm the timer
+        if(ticks > 0xFFFFFFFF)
+            ticks = 0xFFFFFFFF;
+    }
+    apic_reg_wr(LAPIC_REG_TIMR_INITCNT, (uint32_t)ticks);
+}
+
+/*
+ * Arms the timer to fire at a certain TSC value
+ *   unless it's armed to fire earlier already
+ * Must be called with interrupts disabled
+ */
+void timr_arm_before(uint64_t tsc){
+    if(timr_armed == 0 || tsc < timr_armed)
+        timr_arm(tsc);
+}
+
+/*
+ * Returns the scheduler tick period in TSC cycles
+ */
+uint64_t timr_tick_cycles(void){
+    return timr_tick_tsc;
 }
 
 /*
  * Stops the timer
  */
 void timr_stop(void){
-    apic_reg_wr(LAPIC_REG_LVT_TIM, apic_reg_rd(LAPIC_REG_LVT_TIM) & ~0x20000);
+    timr_arm(0);
+    apic_reg_wr(LAPIC_REG_LVT_TIM, apic_reg_rd(LAPIC_REG_LVT_TIM) | TIMR_LVT_MASKED);
 }
 
 /*
- * Increment the millisecond counter
+ * Returns the amount of milliseconds that have passed since clock initialization
  */
-void timr_tick(void){
-    timr_millis++;
+uint64_t timr_ms(void){
+    return clock_monotonic_ns() / 1000000;
 }
 
 /*
- * Returns the amount of milliseconds that have passed since timer initialization
+ * Returns the TSC frequency in Hz
  */
-uint64_t timr_ms(void){
-    return timr_millis / 2;
-}
\ No newline at end of file
+uint64_t timr_tsc_freq(void){
+    return clock_tsc_hz();
+}
+
+/*
+ * Converts microseconds to TSC cycles
+ */
+uint64_t timr_us_to_tsc(uint64_t us){
+    return clock_ns_to_tsc(us * 1000);
+}
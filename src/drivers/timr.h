@@ -3,10 +3,46 @@
 
 #include "../stdlib.h"
 
+//Scheduler tick frequency
+#define TIMR_HZ                             2000
+//LAPIC timer calibration interval
+#define TIMR_CAL_US                         10000
+
+//Drive the scheduler off an HPET comparator even if the LAPIC timer is fine
+//#define TIMR_PREFER_HPET
+
+//Hardware the timer runs off
+#define TIMR_MODE_ONESHOT                   0
+#define TIMR_MODE_DEADLINE                  1
+#define TIMR_MODE_HPET                      2
+
+//LVT timer register bits
+#define TIMR_LVT_ONESHOT                    (0 << 17)
+#define TIMR_LVT_PERIODIC                   (1 << 17)
+#define TIMR_LVT_TSC_DEADLINE               (2 << 17)
+#define TIMR_LVT_MASKED                     (1 << 16)
+
+//TSC-deadline MSR
+#define MSR_IA32_TSC_DEADLINE               0x6E0
+
+//PIT ports and settings used for TSC calibration
+
+#define PIT_FREQ                            1193182
+#define PIT_PORT_CH2                        0x42
+#define PIT_PORT_CMD                        0x43
+#define PIT_PORT_CTL                        0x61
+#define PIT_CTL_GATE2                       (1 << 0)
+#define PIT_CTL_SPKR                        (1 << 1)
+#define PIT_CTL_OUT2                        (1 << 5)
+
 void timr_init(void);
 void timr_stop(void);
-void timr_tick(void);
+void timr_arm(uint64_t tsc);
+void timr_arm_before(uint64_t tsc);
+uint64_t timr_tick_cycles(void);
 
 uint64_t timr_ms(void);
+uint64_t timr_tsc_freq(void);
+uint64_t timr_us_to_tsc(uint64_t us);
 
 #endif
\ No newline at end of file
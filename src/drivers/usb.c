@@ -21,11 +21,12 @@ void ehci_init(){
 /*
  * Add an EHCI controller to the list
  */
-unsigned char ehci_add_cont(unsigned char b, unsigned char d){
+unsigned char ehci_add_cont(pci_dev_t* dev){
+    if(ehci_cont_count >= sizeof(ehci_conts) / sizeof(*ehci_conts))
+        return 0xFF;
     //Add the controller to the list
-    ehci_conts[ehci_cont_count].pci_addr = (b << 8) | d;
-    uint32_t bar0 = (((uint32_t)pci_read_config_16(b, d, 0, 0x12) << 16) | (uint32_t)pci_read_config_16(b, d, 0, 0x10)) & 0xFFFFFF00;
-    ehci_conts[ehci_cont_count].capreg_addr = (void*)(uint64_t)bar0;
+    ehci_conts[ehci_cont_count].pci_addr = (dev->bus << 8) | (dev->slot << 3) | dev->func;
+    ehci_conts[ehci_cont_count].capreg_addr = (void*)(dev->bar[0] & ~0xFFULL);
     //Reset the controller
       //ehci_write_opreg_dw(ehci_cont_count, EHCI_OPREG_USBCMD, 2);
     //Wait for it to actually reset
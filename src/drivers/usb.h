@@ -1,6 +1,8 @@
 #ifndef USB_H
 #define USB_H
 
+#include "./pci.h"
+
 //EHCI controller structure
 
 typedef struct {
@@ -8,8 +10,8 @@ typedef struct {
     char hci_ver[6];
     //Capability Register address in RAM
     void* capreg_addr;
-    //PCI bus address
-    short pci_addr;
+    //PCI bus address (bus, slot and function)
+    uint16_t pci_addr;
     //Port count
     unsigned char port_cnt;
     //Debug port number
@@ -38,7 +40,7 @@ typedef struct {
 
 //Basic operations
 
-unsigned char ehci_add_cont(unsigned char b, unsigned char d);
+unsigned char ehci_add_cont(pci_dev_t* dev);
 int ehci_read_capreg(unsigned char ehci_no, unsigned char reg);
 int ehci_read_opreg(unsigned char ehci_no, unsigned char reg);
 void ehci_write_opreg_dw(unsigned char ehci_no, unsigned char reg, int val);
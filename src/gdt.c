@@ -0,0 +1,66 @@
+//Neutron Project
+//GDT and TSS setup
+//Replaces the GDT left over by the firmware with one that has user segments and a TSS
+
+#include "./gdt.h"
+#include "./stdlib.h"
+
+//The GDT: null, kernel code, kernel data, user data, user code, TSS (two entries)
+uint64_t gdt[7] __attribute__((aligned(16)));
+//The TSS
+tss_t gdt_tss __attribute__((aligned(16)));
+
+/*
+ * Loads the GDT, reloads the segment registers and loads the TSS
+ */
+void gdt_init(void){
+    gdt[0] = 0;
+    gdt[1] = 0x00AF9A000000FFFFULL; //kernel code: present, DPL 0, long mode
+    gdt[2] = 0x00CF92000000FFFFULL; //kernel data: present, DPL 0, writable
+    gdt[3] = 0x00CFF2000000FFFFULL; //user data: present, DPL 3, writable
+    gdt[4] = 0x00AFFA000000FFFFULL; //user code: present, DPL 3, long mode
+
+    //Set up the TSS
+    memset(&gdt_tss, 0, sizeof(tss_t));
+    gdt_tss.iopb_offs = sizeof(tss_t); //no I/O permission bitmap
+    //Exceptions that can happen at any moment get stacks of their own
+    gdt_tss.ist[GDT_IST_DF - 1] = (uint64_t)calloc(GDT_IST_STACK_SIZE, 1) + GDT_IST_STACK_SIZE;
+    gdt_tss.ist[GDT_IST_NMI - 1] = (uint64_t)calloc(GDT_IST_STACK_SIZE, 1) + GDT_IST_STACK_SIZE;
+    gdt_tss.ist[GDT_IST_MC - 1] = (uint64_t)calloc(GDT_IST_STACK_SIZE, 1) + GDT_IST_STACK_SIZE;
+    for(int i = 0; i < 3; i++)
+        gdt_tss.ist[i] &= ~0xFULL;
+    //TSS descriptor: present, available 64-bit TSS
+    uint64_t base = (uint64_t)&gdt_tss;
+    uint64_t limit = sizeof(tss_t) - 1;
+    gdt[5] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | (0x89ULL << 40) |
+             (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    gdt[6] = base >> 32;
+
+    //Load the GDT
+    gdt_desc_t gdtr = {.limit = sizeof(gdt) - 1, .base = gdt};
+    __asm__ volatile("lgdt %0;"
+                     //Reload CS with a far return
+                     "push %1;"
+                     "lea 1f(%%rip), %%rax;"
+                     "push %%rax;"
+                     "lretq;"
+                     "1:"
+                     //Reload the data segment registers
+                     "mov %2, %%ax;"
+                     "mov %%ax, %%ds;"
+                     "mov %%ax, %%es;"
+                     "mov %%ax, %%ss;"
+                     "xor %%eax, %%eax;"
+                     "mov %%ax, %%fs;"
+                     "mov %%ax, %%gs;"
+                     : : "m" (gdtr), "i" (GDT_SEL_KCODE), "i" (GDT_SEL_KDATA) : "rax", "memory");
+    //Load the TSS
+    __asm__ volatile("ltr %w0" : : "r" ((uint16_t)GDT_SEL_TSS));
+}
+
+/*
+ * Sets the stack the CPU switches to when an interrupt arrives in user mode
+ */
+void gdt_set_kstack(uint64_t rsp0){
+    gdt_tss.rsp[0] = rsp0;
+}
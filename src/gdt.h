@@ -0,0 +1,44 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "./stdlib.h"
+
+//Segment selectors
+//The order of the user ones is dictated by SYSRET
+
+#define GDT_SEL_KCODE                       0x08
+#define GDT_SEL_KDATA                       0x10
+#define GDT_SEL_UDATA                       0x18
+#define GDT_SEL_UCODE                       0x20
+#define GDT_SEL_TSS                         0x28
+
+//Interrupt Stack Table slots
+
+#define GDT_IST_DF                          1
+#define GDT_IST_NMI                         2
+#define GDT_IST_MC                          3
+#define GDT_IST_STACK_SIZE                  8192
+
+//Task State Segment
+typedef struct {
+    uint32_t reserved0;
+    //Stacks loaded on privilege level changes
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    //Interrupt Stack Table
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iopb_offs;
+} __attribute__((packed)) tss_t;
+
+//GDT descriptor
+typedef struct {
+    uint16_t limit;
+    void* base;
+} __attribute__((packed)) gdt_desc_t;
+
+void gdt_init(void);
+void gdt_set_kstack(uint64_t rsp0);
+
+#endif
@@ -11,6 +11,7 @@
 #include "../drivers/gfx.h"
 #include "../drivers/initrd.h"
 #include "../drivers/timr.h"
+#include "../drivers/clock.h"
 #include "../drivers/human_io/mouse.h"
 #include "../drivers/human_io/kbd.h"
 
@@ -31,9 +32,9 @@ uint16_t topb_win_pos;
 char time[64] = "??:??:??\0";
 //The current date as a string
 char date[64] = "?/?/?\0";
-//The amount of time it took to render the last frame
+//The amount of time it took to render the last frame (us)
 uint64_t gui_render = 0;
-//The amount of time it took to transfer the last frame to the screen
+//The amount of time it took to transfer the last frame to the screen (us)
 uint64_t gui_trans = 0;
 //Wallpaper size
 uint16_t wallpap_width;
@@ -124,7 +125,7 @@ p2d_t gui_mouse_btns(void){
  * Redraw the GUI
  */
 void gui_update(void){
-    uint64_t render_start = timr_ms();
+    uint64_t render_start = clock_monotonic_ns();
 
     //Get the mouse data
     gui_get_mouse();
@@ -217,12 +218,12 @@ void gui_update(void){
     #endif
 
     //Flip the buffers
-    uint64_t flip_start = timr_ms();
+    uint64_t flip_start = clock_monotonic_ns();
     gfx_flip();
-    uint64_t all_end = timr_ms();
+    uint64_t all_end = clock_monotonic_ns();
 
-    gui_render = flip_start - render_start;
-    gui_trans = all_end - flip_start;
+    gui_render = (flip_start - render_start) / 1000;
+    gui_trans = (all_end - flip_start) / 1000;
 
     //Record the mouse state
     last_frame_ml = ml;
@@ -236,6 +237,8 @@ void gui_render_windows(void){
     window_t* current_window;
     uint32_t i = 0;
     uint32_t win_cnt = 0;
+    //Get rid of the windows of the tasks that have exited
+    gui_destroy_closed_windows();
     //Reset the top bar position
     topb_win_pos = 2;
 
@@ -9,6 +9,7 @@
 #include "./windows.h"
 #include "./controls.h"
 #include "../mtask/mtask.h"
+#include "../irq.h"
 
 #include "../images/neutron_logo.h"
 #include "../images/task_mgr.h"
@@ -99,6 +100,11 @@ void _stdgui_cpuid_btn_click(ui_event_args_t* args){
     stdgui_create_cpuid();
 }
 
+void _stdgui_irq_stats_btn_click(ui_event_args_t* args){
+    if(args->type == GUI_EVENT_CLICK)
+        stdgui_create_irq_stats();
+}
+
 /*
  * Creates a system control window
  */
@@ -144,6 +150,9 @@ void stdgui_create_system_win(void){
     //Add the task CPUID button to it
     gui_create_button(window, (p2d_t){.x = 2, .y = 13 + neutron_logo_height + 79}, (p2d_t){.x = system_win_size.x - 2 - 4, .y = 15}, "CPUID",
                       COLOR32(255, 255, 255, 255), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), _stdgui_cpuid_btn_click);
+    //Add the interrupt statistics button to it
+    gui_create_button(window, (p2d_t){.x = 2, .y = 13 + neutron_logo_height + 96}, (p2d_t){.x = system_win_size.x - 2 - 4, .y = 15}, "Interrupts",
+                      COLOR32(255, 255, 255, 255), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), _stdgui_irq_stats_btn_click);
 }
 
 /*
@@ -155,6 +164,15 @@ void _stdgui_task_mgr_evt(ui_event_args_t* args){
         mtask_stop_task(((window_t*)args->win)->task_uid);
 }
 
+//Task table entry copied by the task manager
+typedef struct {
+    uint8_t valid;
+    uint64_t uid;
+    uint8_t priority;
+    uint8_t state_code;
+    char name[64];
+} _stdgui_task_snap_t;
+
 /*
  * The task that updates the task manager
  */
@@ -162,29 +180,97 @@ void _stdgui_task_mgr_updater(void* task_mgr_label){
     //Temporary string
     char temp[4096];
     char temp2[128];
+    //Task UIDs and their CPU time at the previous update, indexed by task table slot
+    uint32_t prev_cnt = 0;
+    uint64_t* prev_uid = NULL;
+    uint64_t* prev_cpu = NULL;
+    _stdgui_task_snap_t* snap = NULL;
+    uint64_t prev_tsc = rdtsc();
     while(1){
+        //Copy the task table; it can be reallocated when it grows, so it's only
+        //  touched with interrupts disabled
+        uint32_t task_cnt;
+        while(1){
+            //Grow the arrays if the task table has grown
+            task_cnt = mtask_get_task_cnt();
+            if(task_cnt > prev_cnt){
+                uint64_t* new_uid = (uint64_t*)malloc(task_cnt * sizeof(uint64_t));
+                uint64_t* new_cpu = (uint64_t*)calloc(task_cnt, sizeof(uint64_t));
+                memset(new_uid, 0xFF, task_cnt * sizeof(uint64_t));
+                if(prev_cnt > 0){
+                    memcpy(new_uid, prev_uid, prev_cnt * sizeof(uint64_t));
+                    memcpy(new_cpu, prev_cpu, prev_cnt * sizeof(uint64_t));
+                    free(prev_uid);
+                    free(prev_cpu);
+                    free(snap);
+                }
+                prev_uid = new_uid;
+                prev_cpu = new_cpu;
+                snap = (_stdgui_task_snap_t*)malloc(task_cnt * sizeof(_stdgui_task_snap_t));
+                prev_cnt = task_cnt;
+            }
+            uint64_t rflags = mtask_crit_enter();
+            task_cnt = mtask_get_task_cnt();
+            uint8_t fits = task_cnt <= prev_cnt;
+            if(fits){
+                task_t** tasks = mtask_get_task_list();
+                for(uint32_t i = 0; i < task_cnt; i++){
+                    snap[i].valid = tasks[i]->valid;
+                    snap[i].uid = tasks[i]->uid;
+                    snap[i].priority = tasks[i]->priority;
+                    snap[i].state_code = tasks[i]->state_code;
+                    memcpy(snap[i].name, tasks[i]->name, sizeof(snap[i].name));
+                    snap[i].name[sizeof(snap[i].name) - 1] = 0;
+                }
+            }
+            mtask_crit_leave(rflags);
+            if(fits)
+                break;
+        }
         //Construct the temporary string
         temp[0] = 0;
-        //Scan through the task list
-        task_t* tasks = mtask_get_task_list();
-        for(uint32_t i = 0; i < MTASK_TASK_COUNT; i++){
+        uint64_t tsc = rdtsc();
+        uint64_t period = tsc - prev_tsc;
+        prev_tsc = tsc;
+        for(uint32_t i = 0; i < task_cnt; i++){
+            _stdgui_task_snap_t* task = &snap[i];
+            task_stats_t stats;
             //If the task is valid
-            if(tasks[i].valid){
+            if(task->valid && mtask_get_stats(task->uid, &stats)){
+                //Calculate the CPU usage since the last update
+                //  (the slot might have been reused by another task since then)
+                uint64_t used = stats.cpu_time - ((prev_uid[i] == task->uid) ? prev_cpu[i] : 0);
+                prev_uid[i] = task->uid;
+                prev_cpu[i] = stats.cpu_time;
+                //Don't overflow the label
+                if(strlen(temp) > sizeof(temp) - 256)
+                    continue;
                 //Append its name to the string
-                strcat(temp, tasks[i].name);
-                //Append its kilocycle count to the string
-                strcat(temp, " (prio: ");
-                strcat(temp, sprintu(temp2, tasks[i].priority, 1));
+                strcat(temp, task->name);
+                //Append its CPU usage to the string
+                strcat(temp, ": ");
+                strcat(temp, sprintu(temp2, (period == 0) ? 0 : (used * 100 / period), 1));
+                strcat(temp, "% CPU (prio: ");
+                strcat(temp, sprintu(temp2, task->priority, 1));
                 strcat(temp, ")");
-                if(tasks[i].state_code == TASK_STATE_RUNNING)
+                if(task->state_code == TASK_STATE_RUNNING)
                     strcat(temp, " [running]");
                 else
                     strcat(temp, " [blocked]");
-                strcat(temp, "\n");
+                //Append its context switch statistics to the string
+                strcat(temp, "\n  switches: ");
+                strcat(temp, sprintu(temp2, stats.sw_voluntary, 1));
+                strcat(temp, " vol. / ");
+                strcat(temp, sprintu(temp2, stats.sw_involuntary, 1));
+                strcat(temp, " invol., wait: ");
+                strcat(temp, sprintu(temp2, stats.wait_time / 1000000, 1));
+                strcat(temp, " Mcyc\n");
             }
         }
         //Copy the temporary string
-        memcpy(((control_ext_label_t*)task_mgr_label)->text, temp, 1024);
+        memcpy(((control_ext_label_t*)task_mgr_label)->text, temp, strlen(temp) + 1);
+        //Wait some time before updating again
+        mtask_dly_cycles(500000000);
     }
 }
 
@@ -204,6 +290,99 @@ void stdgui_create_task_manager(void){
     window->task_uid = mtask_create_task(16384, "Task manager", 2, _stdgui_task_mgr_updater, (void*)task_mgr_label);
 }
 
+/*
+ * Interrupt statistics window event handler
+ */
+void _stdgui_irq_stats_evt(ui_event_args_t* args){
+    //If the window is being closed, stop the updater process
+    if(args->type == GUI_EVENT_WIN_CLOSE)
+        mtask_stop_task(((window_t*)args->win)->task_uid);
+}
+
+void _stdgui_irq_dump_btn_click(ui_event_args_t* args){
+    if(args->type == GUI_EVENT_CLICK)
+        irq_stat_dump();
+}
+
+void _stdgui_irq_reset_btn_click(ui_event_args_t* args){
+    if(args->type == GUI_EVENT_CLICK)
+        irq_stat_reset();
+}
+
+/*
+ * The task that updates the interrupt statistics window
+ */
+void _stdgui_irq_stats_updater(void* irq_stats_label){
+    //Temporary string
+    char temp[4096];
+    char temp2[32];
+    irq_stat_t stat;
+    while(1){
+        temp[0] = 0;
+        for(uint32_t v = 0; v < 256; v++){
+            if(!irq_stat_get(v, &stat))
+                continue;
+            //Don't overflow the label
+            if(strlen(temp) > sizeof(temp) - 512)
+                break;
+            //Append the vector, its count and latency
+            strcat(temp, "Vector ");
+            strcat(temp, sprintu(temp2, v, 1));
+            strcat(temp, ": ");
+            strcat(temp, sprintu(temp2, stat.count, 1));
+            strcat(temp, " irqs, avg ");
+            strcat(temp, sprintu(temp2, stat.total / stat.count, 1));
+            strcat(temp, " / max ");
+            strcat(temp, sprintu(temp2, stat.max, 1));
+            strcat(temp, " cyc\n");
+            //Append the latency histogram, a few buckets per line
+            uint32_t on_line = 0;
+            for(uint32_t b = 0; b < IRQ_STAT_BUCKETS; b++){
+                if(stat.hist[b] == 0)
+                    continue;
+                strcat(temp, (on_line == 0) ? "  " : " ");
+                strcat(temp, "2^");
+                strcat(temp, sprintu(temp2, b, 1));
+                strcat(temp, ":");
+                strcat(temp, sprintu(temp2, stat.hist[b], 1));
+                if(++on_line == 5){
+                    strcat(temp, "\n");
+                    on_line = 0;
+                }
+            }
+            if(on_line != 0)
+                strcat(temp, "\n");
+        }
+        //Copy the temporary string
+        memcpy(((control_ext_label_t*)irq_stats_label)->text, temp, strlen(temp) + 1);
+        //Wait some time before updating again
+        mtask_dly_cycles(500000000);
+    }
+}
+
+/*
+ * Creates a window with per-vector interrupt counts and latency histograms
+ */
+void stdgui_create_irq_stats(void){
+    p2d_t window_size = (p2d_t){.x = 300, .y = 300};
+    //Create the window
+    window_t* window = gui_create_window("Interrupts", NULL, GUI_WIN_FLAGS_STANDARD, (p2d_t){.x = (gfx_res_x() - window_size.x) / 2,
+                                                                                             .y = (gfx_res_y() - window_size.y) / 2},
+        window_size, _stdgui_irq_stats_evt);
+    //Create the buttons
+    gui_create_button(window, (p2d_t){.x = 2, .y = 2}, (p2d_t){.x = (window_size.x / 2) - 4, .y = 15}, "Dump to debug port",
+                      COLOR32(255, 255, 255, 255), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), _stdgui_irq_dump_btn_click);
+    gui_create_button(window, (p2d_t){.x = (window_size.x / 2) + 1, .y = 2}, (p2d_t){.x = (window_size.x / 2) - 7, .y = 15}, "Reset",
+                      COLOR32(255, 255, 255, 255), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), COLOR32(0, 0, 0, 0), _stdgui_irq_reset_btn_click);
+    //Create the label
+    control_ext_label_t* irq_stats_label = gui_create_label(window, (p2d_t){.x = 0, .y = 20}, (p2d_t){.x = window_size.x, .y = window_size.y - 20},
+                                                            "", COLOR32(255, 255, 255, 255), COLOR32(0, 0, 0, 0), NULL)->extended;
+    irq_stats_label->text = (char*)malloc(4096);
+    irq_stats_label->text[0] = 0;
+    //Create the update process
+    window->task_uid = mtask_create_task(16384, "Interrupt stats", 2, _stdgui_irq_stats_updater, (void*)irq_stats_label);
+}
+
 /*
  * Creates a color picker
  */
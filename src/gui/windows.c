@@ -2,6 +2,7 @@
 //Window processing and rendering
 
 #include "./windows.h"
+#include "../mtask/mtask.h"
 #include "../images/win_close.xbm"
 #include "../images/win_state.xbm"
 #include "../images/win_minimize.xbm"
@@ -16,6 +17,9 @@ p2d_t window_dragging_cpos;
 window_t* window_focused = NULL;
 //If this flag is set, focus can't be changed
 uint8_t focus_monopoly = 0;
+//UIDs of exited tasks whose windows haven't been closed yet
+uint64_t windows_exited_uids[GUI_EXITED_TASKS];
+uint32_t windows_exited_cnt = 0;
 
 /*
  * Initializes window-related variables
@@ -132,6 +136,54 @@ void gui_destroy_window(window_t* win){
     windows[i - 1].title = NULL;
 }
 
+/*
+ * Queues the windows controlled by a task that has exited to be closed
+ * (the window list belongs to the GUI task, it destroys them on the next frame)
+ */
+void gui_close_task_windows(uint64_t uid){
+    //No windows before the GUI is up
+    if(windows == NULL)
+        return;
+    while(1){
+        uint64_t rflags = mtask_crit_enter();
+        if(windows_exited_cnt < GUI_EXITED_TASKS){
+            windows_exited_uids[windows_exited_cnt++] = uid;
+            mtask_crit_leave(rflags);
+            return;
+        }
+        mtask_crit_leave(rflags);
+        //The queue is full, let the GUI task catch up
+        mtask_yield();
+    }
+}
+
+/*
+ * Destroys all windows marked as closed and those of tasks that have exited
+ */
+void gui_destroy_closed_windows(void){
+    window_t* win;
+    uint32_t i = 0;
+    //Take the queued UIDs
+    uint64_t uids[GUI_EXITED_TASKS];
+    uint64_t rflags = mtask_crit_enter();
+    uint32_t uid_cnt = windows_exited_cnt;
+    memcpy(uids, windows_exited_uids, uid_cnt * sizeof(uint64_t));
+    windows_exited_cnt = 0;
+    mtask_crit_leave(rflags);
+    while((win = &windows[i++])->title)
+        for(uint32_t j = 0; j < uid_cnt; j++)
+            if(win->task_uid == uids[j])
+                win->flags |= GUI_WIN_FLAG_CLOSED;
+    i = 0;
+    while((win = &windows[i])->title){
+        //Destroying a window shifts the rest of the list
+        if(win->flags & GUI_WIN_FLAG_CLOSED)
+            gui_destroy_window(win);
+        else
+            i++;
+    }
+}
+
 /*
  * Renders a window
  */
@@ -58,6 +58,9 @@ typedef struct {
 #define GUI_WIN_FLAG_MINIMIZED                      (1 << 9)
 #define GUI_WIN_FLAGS_STANDARD (GUI_WIN_FLAG_CLOSABLE | GUI_WIN_FLAG_MINIMIZABLE | GUI_WIN_FLAG_VISIBLE | GUI_WIN_FLAG_DRAGGABLE)
 
+//Maximum amount of exited tasks whose windows are waiting to be closed
+#define GUI_EXITED_TASKS                            64
+
 void gui_init_windows(void);
 
 window_t* gui_get_focused_window(void);
@@ -67,6 +70,8 @@ window_t* gui_get_window_list(void);
 window_t* gui_create_window(char* title, void* icon_8, uint32_t flags, p2d_t pos, p2d_t size,
                             void(*event_handler)(ui_event_args_t*));
 void gui_destroy_window(window_t* win);
+void gui_close_task_windows(uint64_t uid);
+void gui_destroy_closed_windows(void);
 
 uint8_t gui_process_window(window_t* ptr);
 void gui_render_window(window_t* ptr);
@@ -0,0 +1,303 @@
+//Neutron Project
+//Device interrupts
+//Vectors are allocated on demand: GSIs get one when they're routed through
+//  the I/O APIC, MSI/MSI-X devices get one per message. The stubs in
+//  isr_wrapper.s call irq_dispatch() which runs the registered handlers
+//  and accounts for the time they took
+
+#include "./irq.h"
+#include "./stdlib.h"
+#include "./drivers/ioapic.h"
+#include "./drivers/acpi.h"
+#include "./drivers/apic.h"
+#include "./mtask/mtask.h"
+
+//Registered handlers
+typedef struct {
+    irq_handler_t handler;
+    void* arg;
+} irq_slot_t;
+irq_slot_t irq_handlers[IRQ_VECTOR_CNT][IRQ_MAX_SHARED];
+//Allocated vectors, one bit per vector starting at IRQ_VECTOR_BASE
+uint64_t irq_vec_used[(IRQ_VECTOR_CNT + 63) / 64];
+//Vector each GSI is routed to (0 if it isn't)
+uint8_t irq_gsi_vec[IRQ_GSI_CNT];
+//Set once the I/O APIC has been set up
+uint8_t irq_ready = 0;
+//Per-vector statistics
+irq_stat_t irq_stats[256];
+
+/*
+ * Sets up the I/O APIC and masks the legacy PICs
+ * Returns 0 if there's no I/O APIC to route the interrupts through
+ */
+uint8_t irq_init(void){
+    memset(irq_handlers, 0, sizeof(irq_handlers));
+    memset(irq_vec_used, 0, sizeof(irq_vec_used));
+    memset(irq_gsi_vec, 0, sizeof(irq_gsi_vec));
+    irq_ready = ioapic_init();
+    return irq_ready;
+}
+
+/*
+ * Takes a free vector out of the pool
+ * Returns 0 if there are none left
+ * (must be called in a critical section)
+ */
+uint8_t irq_vec_take(void){
+    for(uint32_t i = 0; i < (IRQ_VECTOR_CNT + 63) / 64; i++){
+        uint64_t free = ~irq_vec_used[i];
+        if(free == 0)
+            continue;
+        uint32_t bit = __builtin_ctzll(free);
+        uint32_t idx = (i * 64) + bit;
+        if(idx >= IRQ_VECTOR_CNT)
+            break;
+        irq_vec_used[i] |= 1ULL << bit;
+        return IRQ_VECTOR_BASE + idx;
+    }
+    return 0;
+}
+
+/*
+ * Returns a vector to the pool and drops its handlers
+ * (must be called in a critical section)
+ */
+void irq_vec_put(uint8_t vector){
+    uint32_t idx = vector - IRQ_VECTOR_BASE;
+    memset(irq_handlers[idx], 0, sizeof(irq_handlers[idx]));
+    irq_vec_used[idx / 64] &= ~(1ULL << (idx % 64));
+}
+
+/*
+ * Returns 1 if interrupts can be registered
+ */
+uint8_t irq_available(void){
+    return irq_ready;
+}
+
+/*
+ * Translates an ISA IRQ into a GSI using the MADT interrupt source overrides
+ */
+uint32_t irq_isa_gsi(uint8_t irq){
+    acpi_madt_info_t* madt = acpi_get_madt();
+    if(madt != NULL)
+        for(uint8_t i = 0; i < madt->iso_cnt; i++)
+            if(madt->isos[i].irq == irq)
+                return madt->isos[i].gsi;
+    return irq;
+}
+
+/*
+ * Finds out the trigger mode and polarity of a GSI
+ */
+void irq_gsi_mode(uint32_t gsi, uint8_t* level, uint8_t* active_low){
+    //ISA interrupts are edge-triggered and active high, PCI ones are level-triggered and active low
+    *level = (gsi >= 16);
+    *active_low = (gsi >= 16);
+    //Unless an override says otherwise
+    acpi_madt_info_t* madt = acpi_get_madt();
+    if(madt == NULL)
+        return;
+    for(uint8_t i = 0; i < madt->iso_cnt; i++){
+        if(madt->isos[i].gsi != gsi)
+            continue;
+        uint16_t flags = madt->isos[i].flags;
+        *level = 0;
+        *active_low = 0;
+        if((flags & ACPI_INTI_TRIGGER_MASK) == ACPI_INTI_TRIGGER_LEVEL)
+            *level = 1;
+        if((flags & ACPI_INTI_POLARITY_MASK) == ACPI_INTI_POLARITY_LOW)
+            *active_low = 1;
+    }
+}
+
+/*
+ * Registers a handler for a GSI and unmasks it
+ * Returns 0 if the interrupt can't be delivered or has too many handlers already
+ */
+uint8_t irq_register(uint32_t gsi, irq_handler_t handler, void* arg){
+    if(!irq_ready || gsi >= IRQ_GSI_CNT)
+        return 0;
+    uint64_t rflags = mtask_crit_enter();
+    //Give the GSI a vector when its first handler is registered
+    uint8_t vector = irq_gsi_vec[gsi];
+    uint8_t first = (vector == 0);
+    if(first){
+        vector = irq_vec_take();
+        if(vector == 0){
+            mtask_crit_leave(rflags);
+            return 0;
+        }
+    }
+    irq_slot_t* slots = irq_handlers[vector - IRQ_VECTOR_BASE];
+    uint8_t ok = 0;
+    for(uint8_t i = 0; i < IRQ_MAX_SHARED; i++){
+        if(slots[i].handler != NULL)
+            continue;
+        slots[i].arg = arg;
+        slots[i].handler = handler;
+        ok = 1;
+        break;
+    }
+    //And route it
+    if(first){
+        uint8_t level, active_low;
+        irq_gsi_mode(gsi, &level, &active_low);
+        ok = ioapic_route(gsi, vector, level, active_low);
+        if(ok)
+            irq_gsi_vec[gsi] = vector;
+        else
+            irq_vec_put(vector);
+    }
+    mtask_crit_leave(rflags);
+    return ok;
+}
+
+/*
+ * Removes a handler of a GSI, masking it if it was the last one
+ */
+void irq_unregister(uint32_t gsi, irq_handler_t handler){
+    if(!irq_ready || gsi >= IRQ_GSI_CNT)
+        return;
+    uint64_t rflags = mtask_crit_enter();
+    uint8_t vector = irq_gsi_vec[gsi];
+    if(vector == 0){
+        mtask_crit_leave(rflags);
+        return;
+    }
+    irq_slot_t* slots = irq_handlers[vector - IRQ_VECTOR_BASE];
+    uint8_t left = 0;
+    for(uint8_t i = 0; i < IRQ_MAX_SHARED; i++){
+        if(slots[i].handler == handler)
+            slots[i].handler = NULL;
+        else if(slots[i].handler != NULL)
+            left = 1;
+    }
+    //Release the vector along with the last handler
+    if(!left){
+        ioapic_mask(gsi, 1);
+        irq_gsi_vec[gsi] = 0;
+        irq_vec_put(vector);
+    }
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Allocates a vector for a message-signalled interrupt and installs its handler
+ * Returns the vector (to be programmed into the device) or 0 if there are none left
+ */
+uint8_t irq_alloc(irq_handler_t handler, void* arg){
+    uint64_t rflags = mtask_crit_enter();
+    uint8_t vector = irq_vec_take();
+    if(vector != 0){
+        irq_slot_t* slot = &irq_handlers[vector - IRQ_VECTOR_BASE][0];
+        slot->arg = arg;
+        slot->handler = handler;
+    }
+    mtask_crit_leave(rflags);
+    return vector;
+}
+
+/*
+ * Frees a vector returned by irq_alloc()
+ * The device must not send the message anymore
+ */
+void irq_free(uint8_t vector){
+    if(vector < IRQ_VECTOR_BASE || vector >= IRQ_VECTOR_END)
+        return;
+    uint64_t rflags = mtask_crit_enter();
+    irq_vec_put(vector);
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Runs the handlers of an interrupt vector
+ * (called by the stubs in isr_wrapper.s with the TSC value they were entered at)
+ */
+void irq_dispatch(uint64_t vector, uint64_t entry_tsc){
+    //Spurious interrupts from the masked PICs and the local APIC don't need anything
+    //  apart from being counted
+    if(vector >= IRQ_VECTOR_BASE && vector < IRQ_VECTOR_END){
+        irq_slot_t* slots = irq_handlers[vector - IRQ_VECTOR_BASE];
+        for(uint8_t i = 0; i < IRQ_MAX_SHARED; i++)
+            if(slots[i].handler != NULL)
+                slots[i].handler(slots[i].arg);
+        apic_eoi();
+    }
+    irq_stat_rec(vector, entry_tsc);
+}
+
+/*
+ * Accounts for an interrupt that has been handled
+ * (called with interrupts disabled)
+ */
+void irq_stat_rec(uint64_t vector, uint64_t entry_tsc){
+    uint64_t lat = rdtsc() - entry_tsc;
+    irq_stat_t* stat = &irq_stats[vector & 0xFF];
+    stat->count++;
+    stat->total += lat;
+    if(lat > stat->max)
+        stat->max = lat;
+    uint32_t bucket = 63 - __builtin_clzll(lat | 1);
+    if(bucket >= IRQ_STAT_BUCKETS)
+        bucket = IRQ_STAT_BUCKETS - 1;
+    stat->hist[bucket]++;
+}
+
+/*
+ * Copies the statistics of a vector
+ * Returns 0 if it hasn't fired yet
+ */
+uint8_t irq_stat_get(uint8_t vector, irq_stat_t* stat){
+    uint64_t rflags = mtask_crit_enter();
+    memcpy(stat, &irq_stats[vector], sizeof(irq_stat_t));
+    mtask_crit_leave(rflags);
+    return stat->count != 0;
+}
+
+/*
+ * Clears the statistics of all vectors
+ */
+void irq_stat_reset(void){
+    uint64_t rflags = mtask_crit_enter();
+    memset(irq_stats, 0, sizeof(irq_stats));
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Sends the statistics of all vectors that have fired through the debug port
+ * Line format: "I <vector> <count> <total> <max>" followed by
+ *   "  2^<n> <count>" for every non-empty histogram bucket, numbers are decimal
+ */
+void irq_stat_dump(void){
+    char temp[80];
+    char temp2[24];
+    irq_stat_t stat;
+    for(uint32_t v = 0; v < 256; v++){
+        if(!irq_stat_get(v, &stat))
+            continue;
+        temp[0] = 0;
+        strcat(temp, "I ");
+        strcat(temp, sprintu(temp2, v, 1));
+        strcat(temp, " ");
+        strcat(temp, sprintu(temp2, stat.count, 1));
+        strcat(temp, " ");
+        strcat(temp, sprintu(temp2, stat.total, 1));
+        strcat(temp, " ");
+        strcat(temp, sprintu(temp2, stat.max, 1));
+        strcat(temp, "\n");
+        puts_e9(temp);
+        for(uint32_t b = 0; b < IRQ_STAT_BUCKETS; b++){
+            if(stat.hist[b] == 0)
+                continue;
+            temp[0] = 0;
+            strcat(temp, "  2^");
+            strcat(temp, sprintu(temp2, b, 1));
+            strcat(temp, " ");
+            strcat(temp, sprintu(temp2, stat.hist[b], 1));
+            strcat(temp, "\n");
+            puts_e9(temp);
+        }
+    }
+}
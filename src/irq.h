@@ -0,0 +1,62 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "./stdlib.h"
+
+//Interrupt vectors
+//isr_wrapper.s has stubs for vectors [IRQ_STUB_BASE; IRQ_STUB_END),
+//  device interrupts are allocated from [IRQ_VECTOR_BASE; IRQ_VECTOR_END),
+//  the rest is where the masked 8259 PICs and the local APIC (0xFF) send their
+//  spurious interrupts, which irq_dispatch() counts without an EOI
+
+#define IRQ_STUB_BASE                       48
+#define IRQ_STUB_END                        256
+#define IRQ_VECTOR_BASE                     48
+#define IRQ_VECTOR_END                      240
+#define IRQ_VECTOR_CNT                      (IRQ_VECTOR_END - IRQ_VECTOR_BASE)
+
+//GSIs that can be routed
+#define IRQ_GSI_CNT                         256
+//Level-triggered PCI interrupts can be shared by this many handlers
+#define IRQ_MAX_SHARED                      4
+
+//Well-known ISA IRQs
+#define IRQ_ISA_KBD                         1
+#define IRQ_ISA_MOUSE                       12
+#define IRQ_ISA_ATA_PRI                     14
+#define IRQ_ISA_ATA_SEC                     15
+
+//Interrupt statistics
+//Handler latency (from the stub entry to the EOI) is kept as a log2 histogram
+//  of TSC cycles: bucket n counts latencies in [2^n; 2^(n+1))
+#define IRQ_STAT_BUCKETS                    32
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint32_t hist[IRQ_STAT_BUCKETS];
+} irq_stat_t;
+
+//Device interrupt handler
+//Runs with interrupts disabled, the EOI is sent after it returns
+typedef void(*irq_handler_t)(void*);
+
+//Stub addresses, indexed by (vector - IRQ_STUB_BASE)
+extern uint64_t irq_stub_table[];
+
+uint8_t irq_init(void);
+uint8_t irq_available(void);
+uint32_t irq_isa_gsi(uint8_t irq);
+uint8_t irq_register(uint32_t gsi, irq_handler_t handler, void* arg);
+void irq_unregister(uint32_t gsi, irq_handler_t handler);
+uint8_t irq_alloc(irq_handler_t handler, void* arg);
+void irq_free(uint8_t vector);
+void irq_dispatch(uint64_t vector, uint64_t entry_tsc);
+
+void irq_stat_rec(uint64_t vector, uint64_t entry_tsc);
+uint8_t irq_stat_get(uint8_t vector, irq_stat_t* stat);
+void irq_stat_reset(void);
+void irq_stat_dump(void);
+
+#endif
@@ -1,5 +1,5 @@
 .intel_syntax noprefix
-.globl   exc_0, exc_1, exc_2, exc_3, exc_4, exc_5, exc_6, exc_7, exc_8, exc_9, exc_10, exc_11, exc_12, exc_13, exc_14, exc_16, exc_17, exc_18, exc_19, exc_20, exc_30, apic_timer_isr_wrap, apic_error_isr_wrap
+.globl   exc_0, exc_1, exc_2, exc_3, exc_4, exc_5, exc_6, exc_7, exc_8, exc_9, exc_10, exc_11, exc_12, exc_13, exc_14, exc_16, exc_17, exc_18, exc_19, exc_20, exc_30, apic_timer_isr_wrap, apic_error_isr_wrap, irq_stub_table
 .align   8
 
 ;//Specific handlers for each exception
@@ -46,6 +46,63 @@ exc_13:
     push 13
     jmp exc_wrapper_code
 exc_14:
+    ;//Page faults may be resolved by mapping the page on demand
+    ;//Switch to the kernel GS base if we've come from user mode
+    test qword ptr [rsp+16], 3
+    jz exc_14_kgs
+    swapgs
+    exc_14_kgs:
+    ;//Save the registers the handler may clobber
+    push rax
+    push rcx
+    push rdx
+    push r8
+    push r9
+    push r10
+    push r11
+    sub rsp, 104
+    movdqu [rsp+  8], xmm0
+    movdqu [rsp+ 24], xmm1
+    movdqu [rsp+ 40], xmm2
+    movdqu [rsp+ 56], xmm3
+    movdqu [rsp+ 72], xmm4
+    movdqu [rsp+ 88], xmm5
+    ;//Pass the faulting address and the error code
+    mov rcx, cr2
+    mov rdx, [rsp+160]
+    cld
+    sub rsp, 32
+    call elf_page_fault
+    add rsp, 32
+    movdqu xmm0, [rsp+  8]
+    movdqu xmm1, [rsp+ 24]
+    movdqu xmm2, [rsp+ 40]
+    movdqu xmm3, [rsp+ 56]
+    movdqu xmm4, [rsp+ 72]
+    movdqu xmm5, [rsp+ 88]
+    add rsp, 104
+    test al, al
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdx
+    pop rcx
+    pop rax
+    jz exc_14_fatal
+    ;//Resolved, drop the error code and retry the instruction
+    add rsp, 8
+    test qword ptr [rsp+8], 3
+    jz exc_14_ret
+    swapgs
+    exc_14_ret:
+    iretq
+exc_14_fatal:
+    ;//exc_wrapper_code will switch the GS base again
+    test qword ptr [rsp+16], 3
+    jz exc_14_fatal_kgs
+    swapgs
+    exc_14_fatal_kgs:
     push 14
     jmp exc_wrapper_code
 exc_16:
@@ -70,6 +127,11 @@ exc_30:
 exc_wrapper:
     ;//Disable interrupts
     cli
+    ;//Switch to the kernel GS base if we've come from user mode
+    test qword ptr [rsp+16], 3
+    jz exc_wrapper_kgs
+    swapgs
+    exc_wrapper_kgs:
     ;//Save the state of the currently running task
     ;//For ease of debugging
     add rsp, 8
@@ -87,6 +149,11 @@ exc_wrapper:
 exc_wrapper_code:
     ;//Disable interrupts
     cli
+    ;//Switch to the kernel GS base if we've come from user mode
+    test qword ptr [rsp+24], 3
+    jz exc_wrapper_code_kgs
+    swapgs
+    exc_wrapper_code_kgs:
     ;//Save the state of the currently running task
     ;//For ease of debugging
     add rsp, 16
@@ -107,13 +174,13 @@ exc_wrapper_code:
 apic_timer_isr_wrap:
     ;//Disable interrupts
     cli
-    ;//Save RAX
-    push rax
+    ;//Switch to the kernel GS base if we've come from user mode
+    test qword ptr [rsp+8], 3
+    jz apic_timer_isr_kgs
+    swapgs
+    apic_timer_isr_kgs:
     ;//Check if multitasking is enabled
-    call mtask_is_enabled
-    cmp rax, 1
-    ;//Restore RAX
-    pop rax
+    cmp qword ptr gs:[16], 1
     ;//Return if not
     je apic_timer_isr_wrap_cont
     ;//Re-enable interrupts; send EOI; return
@@ -121,9 +188,117 @@ apic_timer_isr_wrap:
     mov r15, 0xFEE000B0
     mov dword ptr [r15], 0
     pop r15
+    test qword ptr [rsp+8], 3
+    jz apic_timer_isr_ret
+    swapgs
+    apic_timer_isr_ret:
     sti
     iretq
     apic_timer_isr_wrap_cont:
+    ;//Remember when we've been entered
+    push rax
+    push rdx
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov gs:[64], rax
+    pop rdx
+    pop rax
     call mtask_save_state
+    mov rcx, 32
+    call trace_isr_enter
     call mtask_schedule
+    mov rcx, 32
+    call trace_isr_exit
+    ;//Account for the time the scheduler took
+    mov rcx, 32
+    mov rdx, gs:[64]
+    call irq_stat_rec
     jmp mtask_restore_state
+
+;//Device interrupt stubs for vectors 48-255, generated below
+;//Each one pushes its vector number and jumps to irq_common
+.altmacro
+.macro irq_stub vec
+irq_stub_\vec:
+    push \vec
+    jmp irq_common
+.endm
+.macro irq_stub_ptr vec
+    .quad irq_stub_\vec
+.endm
+
+.set irq_vec, 48
+.rept 208
+    irq_stub %irq_vec
+    .set irq_vec, irq_vec + 1
+.endr
+
+irq_common:
+    ;//Switch to the kernel GS base if we've come from user mode
+    test qword ptr [rsp+16], 3
+    jz irq_common_kgs
+    swapgs
+    irq_common_kgs:
+    ;//Save the registers the handlers may clobber
+    push rax
+    push rcx
+    push rdx
+    push r8
+    push r9
+    push r10
+    push r11
+    ;//Remember the TSC value at the entry
+    rdtsc
+    shl rdx, 32
+    or rdx, rax
+    sub rsp, 104
+    mov [rsp], rdx
+    movdqu [rsp+  8], xmm0
+    movdqu [rsp+ 24], xmm1
+    movdqu [rsp+ 40], xmm2
+    movdqu [rsp+ 56], xmm3
+    movdqu [rsp+ 72], xmm4
+    movdqu [rsp+ 88], xmm5
+    cld
+    sub rsp, 32
+    mov rcx, [rsp+192]
+    call trace_isr_enter
+    ;//Pass the vector number and the entry TSC value
+    mov rcx, [rsp+192]
+    mov rdx, [rsp+32]
+    call irq_dispatch
+    mov rcx, [rsp+192]
+    call trace_isr_exit
+    add rsp, 32
+    movdqu xmm0, [rsp+  8]
+    movdqu xmm1, [rsp+ 24]
+    movdqu xmm2, [rsp+ 40]
+    movdqu xmm3, [rsp+ 56]
+    movdqu xmm4, [rsp+ 72]
+    movdqu xmm5, [rsp+ 88]
+    add rsp, 104
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdx
+    pop rcx
+    pop rax
+    ;//Drop the vector number
+    add rsp, 8
+    test qword ptr [rsp+8], 3
+    jz irq_common_ret
+    swapgs
+    irq_common_ret:
+    iretq
+
+;//Stub addresses, indexed by (vector - 48)
+.align 8
+irq_stub_table:
+.set irq_vec, 48
+.rept 208
+    irq_stub_ptr %irq_vec
+    .set irq_vec, irq_vec + 1
+.endr
+.noaltmacro
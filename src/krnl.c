@@ -6,6 +6,10 @@
 
 #include "./stdlib.h"
 #include "./cpuid.h"
+#include "./gdt.h"
+#include "./percpu.h"
+#include "./syscall.h"
+#include "./irq.h"
 
 #include "./gui/gui.h"
 #include "./gui/windows.h"
@@ -19,6 +23,7 @@
 #include "./drivers/ata.h"
 #include "./drivers/apic.h"
 #include "./drivers/timr.h"
+#include "./drivers/hpet.h"
 #include "./drivers/human_io/ps2.h"
 #include "./drivers/human_io/mouse.h"
 #include "./drivers/acpi.h"
@@ -30,6 +35,9 @@
 #include "./images/boot_err.h"
 
 #include "./mtask/mtask.h"
+#include "./mtask/trace.h"
+#include "./mtask/workq.h"
+#include "./mtask/elf.h"
 
 #include "./vmem/vmem.h"
 
@@ -185,6 +193,12 @@ void krnl_dump_task_state(task_t* task){
     temp[0] = 0;
     strcat(temp, "  SW_CNT=");
     strcat(temp, sprintub16(temp2, task->state.switch_cnt, 16));
+    strcat(temp, " CPU=");
+    strcat(temp, sprintub16(temp2, task->cpu_time, 16));
+    strcat(temp, " VOL=");
+    strcat(temp, sprintub16(temp2, task->sw_voluntary, 16));
+    strcat(temp, " INVOL=");
+    strcat(temp, sprintub16(temp2, task->sw_involuntary, 16));
     gfx_verbose_println(temp);
 }
 
@@ -199,23 +213,24 @@ void krnl_dump(void){
 
     gfx_verbose_println("TASKS:");
     //Scan through the task list
-    task_t* tasks = mtask_get_task_list();
-    for(uint32_t i = 0; i < MTASK_TASK_COUNT; i++){
+    task_t** tasks = mtask_get_task_list();
+    for(uint32_t i = 0; i < mtask_get_task_cnt(); i++){
+        task_t* task = tasks[i];
         //If task at that index is valid
-        if(tasks[i].valid){
+        if(task->valid){
             //Print its details
             char temp[200];
             temp[0] = 0;
             char temp2[20];
             strcat(temp, " ");
-            strcat(temp, tasks[i].name);
+            strcat(temp, task->name);
             strcat(temp, ", UID ");
-            strcat(temp, sprintu(temp2, tasks[i].uid, 1));
-            if(tasks[i].uid == mtask_get_uid())
+            strcat(temp, sprintu(temp2, task->uid, 1));
+            if(task->uid == mtask_get_uid())
                 strcat(temp, " [DUMP CAUSE]");
-            if(tasks[i].state_code != TASK_STATE_RUNNING){
+            if(task->state_code != TASK_STATE_RUNNING){
                 strcat(temp, " [BLOCKED TILL ");
-                strcat(temp, sprintub16(temp2, tasks[i].blocked_till, 16));
+                strcat(temp, sprintub16(temp2, task->blocked_till, 16));
                 strcat(temp, " / CUR ");
                 strcat(temp, sprintub16(temp2, rdtsc(), 16));
                 strcat(temp, "]");
@@ -223,7 +238,7 @@ void krnl_dump(void){
                 strcat(temp, " [RUNNING]");
             }
             gfx_verbose_println(temp);
-            krnl_dump_task_state(&tasks[i]);
+            krnl_dump_task_state(task);
             gfx_verbose_println("");
         }
     }
@@ -242,6 +257,12 @@ void krnl_exc(void){
     //Get the extra exception data from RBX
     uint64_t data;
     __asm__ volatile("mov %%rbx, %0" : "=m" (data));
+    //An exception in user mode only terminates the task that caused it
+    if(mtask_is_enabled()){
+        task_t* task = mtask_get_task(mtask_get_uid());
+        if(task != NULL && (task->state.cs & 3))
+            mtask_exit();
+    }
     //Stop the schaeduler
     mtask_stop();
     //Print some info
@@ -303,10 +324,21 @@ void dummy(void* args){
  * Multitasking entry point
  */
 void mtask_entry(void* args){
-    mtask_create_task(131072, "System UI", 10, gui_task, NULL);
+    workq_init();
+    //The GUI gets a guaranteed slice of every frame
+    mtask_sched_t gui_sched = {.sched_class = MTASK_SCHED_DEADLINE, .runtime_us = 12000, .period_us = 16667};
+    mtask_create_task_sched(131072, "System UI", 10, &gui_sched, gui_task, NULL);
     mtask_create_task(8192, "Dummy task", 1, dummy, NULL);
-    
-    mtask_stop_task(mtask_get_uid());
+    #ifdef TRACE_ON_BOOT
+    trace_start(TRACE_OUT_E9);
+    #endif
+    //Start the init program if there is one
+    if(initrd_contents("init.elf") != NULL)
+        elf_run("init.elf", 1);
+    #ifdef SYSCALL_BENCH_ON_BOOT
+    mtask_create_task(8192, "Syscall benchmark", 1, syscall_bench_task, NULL);
+    #endif
+    //Returning from here terminates the task
 }
 
 /*
@@ -400,7 +432,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     }
 
     //Set video buffer memory type
-    vmem_pat_set_range(vmem_get_cr3(), gfx_buf_another(), gfx_buf_another() + (gfx_res_x() * gfx_res_y()), 1);
+    vmem_set_type(gfx_buf_another(), gfx_buf_another() + (gfx_res_x() * gfx_res_y()), VMEM_TYPE_WC);
 
     //Print the krnl version
     if(!krnl_verbose)
@@ -440,12 +472,13 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     //Initialize PS/2
     krnl_boot_status(">>> Initializing PS/2 <<<", 15);
     ps2_init();
-    //Enumerate PCI devices
-    krnl_boot_status(">>> Detecting PCI devices <<<", 30);
-    pci_enumerate();
     //Initialize ACPI
-    krnl_boot_status(">>> Initializing ACPI <<<", 45);
+    krnl_boot_status(">>> Initializing ACPI <<<", 30);
     acpi_init();
+    hpet_init();
+    //Enumerate PCI devices (the configuration space is located through ACPI)
+    krnl_boot_status(">>> Detecting PCI devices <<<", 45);
+    pci_enumerate();
     //Configure GUI
     krnl_boot_status(">>> Configuring GUI <<<", 60);
     gui_init();
@@ -455,6 +488,10 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     krnl_boot_status(">>> Setting up interrupts <<<", 75);
     //Exit UEFI boot services before we can use IDT
     SystemTable->BootServices->ExitBootServices(ImageHandle, efi_map_key);
+    //Load our own GDT and TSS
+    gdt_init();
+    //Set up the per-CPU block
+    percpu_init();
     //Get the current code selector
     uint16_t cur_cs = 0;
     __asm__ volatile("movw %%cs, %0" : "=r" (cur_cs));
@@ -463,13 +500,13 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     //Set up gates for exceptions
     idt[0] = IDT_ENTRY_ISR((uint64_t)&exc_0, cur_cs);
     idt[1] = IDT_ENTRY_ISR((uint64_t)&exc_1, cur_cs);
-    idt[2] = IDT_ENTRY_ISR((uint64_t)&exc_2, cur_cs);
+    idt[2] = IDT_ENTRY_ISR_IST((uint64_t)&exc_2, cur_cs, GDT_IST_NMI);
     idt[3] = IDT_ENTRY_ISR((uint64_t)&exc_3, cur_cs);
     idt[4] = IDT_ENTRY_ISR((uint64_t)&exc_4, cur_cs);
     idt[5] = IDT_ENTRY_ISR((uint64_t)&exc_5, cur_cs);
     idt[6] = IDT_ENTRY_ISR((uint64_t)&exc_6, cur_cs);
     idt[7] = IDT_ENTRY_ISR((uint64_t)&exc_7, cur_cs);
-    idt[8] = IDT_ENTRY_ISR((uint64_t)&exc_8, cur_cs);
+    idt[8] = IDT_ENTRY_ISR_IST((uint64_t)&exc_8, cur_cs, GDT_IST_DF);
     idt[9] = IDT_ENTRY_ISR((uint64_t)&exc_9, cur_cs);
     idt[10] = IDT_ENTRY_ISR((uint64_t)&exc_10, cur_cs);
     idt[11] = IDT_ENTRY_ISR((uint64_t)&exc_11, cur_cs);
@@ -478,12 +515,14 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     idt[14] = IDT_ENTRY_ISR((uint64_t)&exc_14, cur_cs);
     idt[16] = IDT_ENTRY_ISR((uint64_t)&exc_16, cur_cs);
     idt[17] = IDT_ENTRY_ISR((uint64_t)&exc_17, cur_cs);
-    idt[18] = IDT_ENTRY_ISR((uint64_t)&exc_18, cur_cs);
+    idt[18] = IDT_ENTRY_ISR_IST((uint64_t)&exc_18, cur_cs, GDT_IST_MC);
     idt[19] = IDT_ENTRY_ISR((uint64_t)&exc_19, cur_cs);
     idt[20] = IDT_ENTRY_ISR((uint64_t)&exc_20, cur_cs);
     idt[30] = IDT_ENTRY_ISR((uint64_t)&exc_30, cur_cs);
     //Set up gates for interrupts
     idt[32] = IDT_ENTRY_ISR((uint64_t)&apic_timer_isr_wrap, cur_cs);
+    for(uint32_t v = IRQ_STUB_BASE; v < IRQ_STUB_END; v++)
+        idt[v] = IDT_ENTRY_ISR(irq_stub_table[v - IRQ_STUB_BASE], cur_cs);
     //Load IDT
     idt_d.base = (void*)idt;
     idt_d.limit = 256 * sizeof(struct idt_entry);
@@ -491,9 +530,17 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
     //Initialize the APIC
     krnl_boot_status(">>> Initializing APIC <<<", 98);
     apic_init();
+    //Route device interrupts through the I/O APIC
+    if(irq_init())
+        ps2_irq_init();
+    //Enable system calls
+    syscall_init();
     //Initialize the multitasking system
     krnl_boot_status(">>> Initializing multitasking <<<", 99);
     mtask_init();
+    //Start the PCI device drivers (they need interrupts and timers)
+    krnl_boot_status(">>> Starting device drivers <<<", 99);
+    pci_start_drivers();
 
     //The loading process is done!
     krnl_boot_status(">>> Done <<<", 100);
@@ -0,0 +1,240 @@
+//Neutron Project
+//ELF64 executable loader
+//Nothing is loaded up front: segment pages are mapped when the program
+//  first touches them, read-only pages are shared by all instances
+
+#include "./elf.h"
+#include "./mtask.h"
+#include "../stdlib.h"
+#include "../vmem/vmem.h"
+#include "../drivers/initrd.h"
+
+//Images that have been loaded
+elf_image_t* elf_images = NULL;
+//Private pages of tasks that have exited
+elf_page_t* elf_free_pages = NULL;
+
+/*
+ * Checks that a program header describes a loadable segment that lies within the file
+ *   and the user part of the address space
+ */
+uint8_t elf_check_phdr(elf_phdr_t* phdr, uint64_t size){
+    uint64_t limit = ELF_STACK_TOP - ELF_STACK_SIZE;
+    if(phdr->vaddr < VMEM_USER_BASE || phdr->vaddr >= limit || phdr->memsz > limit - phdr->vaddr)
+        return 0;
+    if(phdr->filesz > phdr->memsz || phdr->offset > size || phdr->filesz > size - phdr->offset)
+        return 0;
+    return 1;
+}
+
+/*
+ * Finds an image that has already been loaded
+ * Must be called with interrupts disabled
+ */
+elf_image_t* elf_find_image(char* name){
+    for(elf_image_t* image = elf_images; image != NULL; image = image->next)
+        if(strcmp(image->name, name) == 0)
+            return image;
+    return NULL;
+}
+
+/*
+ * Finds an image that has already been loaded or parses a file from the initrd
+ * Only the list is accessed with interrupts disabled, not the file
+ * Returns NULL if the file doesn't exist or isn't a valid executable
+ */
+elf_image_t* elf_get_image(char* name){
+    uint64_t rflags = mtask_crit_enter();
+    elf_image_t* found = elf_find_image(name);
+    mtask_crit_leave(rflags);
+    if(found != NULL)
+        return found;
+
+    uint8_t* file = initrd_contents(name);
+    if(file == NULL || strlen(name) >= sizeof(((elf_image_t*)0)->name))
+        return NULL;
+    uint64_t size = initrd_read(name).size;
+    //Check the header
+    elf_hdr_t* hdr = (elf_hdr_t*)file;
+    if(size < sizeof(elf_hdr_t))
+        return NULL;
+    if(hdr->magic != ELF_MAGIC || hdr->class != ELF_CLASS_64 || hdr->data != ELF_DATA_LSB ||
+       hdr->type != ELF_TYPE_EXEC || hdr->machine != ELF_MACHINE_X86_64)
+        return NULL;
+    //The program headers have to be within the file
+    if(hdr->phentsize < sizeof(elf_phdr_t) || hdr->phoff > size ||
+       (uint64_t)hdr->phnum * hdr->phentsize > size - hdr->phoff)
+        return NULL;
+    //Check the loadable segments before allocating anything
+    uint32_t seg_cnt = 0;
+    for(uint16_t i = 0; i < hdr->phnum; i++){
+        elf_phdr_t* phdr = (elf_phdr_t*)(file + hdr->phoff + (i * hdr->phentsize));
+        if(phdr->type != ELF_PT_LOAD || phdr->memsz == 0)
+            continue;
+        if(seg_cnt++ == ELF_MAX_SEGMENTS || !elf_check_phdr(phdr, size))
+            return NULL;
+    }
+    //Collect them
+    elf_image_t* image = (elf_image_t*)calloc(1, sizeof(elf_image_t));
+    for(uint16_t i = 0; i < hdr->phnum; i++){
+        elf_phdr_t* phdr = (elf_phdr_t*)(file + hdr->phoff + (i * hdr->phentsize));
+        if(phdr->type != ELF_PT_LOAD || phdr->memsz == 0)
+            continue;
+        elf_seg_t* seg = &image->segs[image->seg_cnt++];
+        seg->vaddr = phdr->vaddr;
+        seg->memsz = phdr->memsz;
+        seg->filesz = phdr->filesz;
+        seg->offset = phdr->offset;
+        seg->flags = phdr->flags;
+        if(!(seg->flags & ELF_PF_W)){
+            uint64_t pages = (((seg->vaddr + seg->memsz + 4095) & ~0xFFFULL) - (seg->vaddr & ~0xFFFULL)) / 4096;
+            seg->shared = (uint8_t**)calloc(pages, sizeof(uint8_t*));
+        }
+    }
+    memcpy(image->name, name, strlen(name) + 1);
+    image->file = file;
+    image->entry = hdr->entry;
+    //Another task may have loaded it in the meantime
+    rflags = mtask_crit_enter();
+    found = elf_find_image(name);
+    if(found == NULL){
+        image->next = elf_images;
+        elf_images = image;
+    }
+    mtask_crit_leave(rflags);
+    if(found != NULL){
+        for(uint32_t i = 0; i < image->seg_cnt; i++)
+            free(image->segs[i].shared);
+        free(image);
+        return found;
+    }
+    return image;
+}
+
+/*
+ * Returns the 4 kB aligned page that follows a link
+ */
+uint8_t* elf_page_data(elf_page_t* link){
+    uint8_t* phys = (uint8_t*)link + sizeof(elf_page_t);
+    return phys + ((4096 - ((uint64_t)phys % 4096)) % 4096); //align by 4 kB
+}
+
+/*
+ * Allocates a zeroed page that belongs to a task and is recycled when it exits,
+ *   reusing a page of a task that has exited if possible
+ */
+uint8_t* elf_alloc_private(task_t* task){
+    uint64_t rflags = mtask_crit_enter();
+    elf_page_t* link = elf_free_pages;
+    if(link != NULL)
+        elf_free_pages = link->next;
+    mtask_crit_leave(rflags);
+    if(link != NULL){
+        memset(elf_page_data(link), 0, 4096);
+    } else {
+        //Room for the link and a 4 kB aligned page after it
+        link = (elf_page_t*)calloc(sizeof(elf_page_t) + 8191, 1);
+    }
+    link->next = (elf_page_t*)task->elf_pages;
+    task->elf_pages = link;
+    return elf_page_data(link);
+}
+
+/*
+ * Puts the private pages of a task that has exited into the free list
+ */
+void elf_task_cleanup(task_t* task){
+    elf_page_t* page = (elf_page_t*)task->elf_pages;
+    task->elf_pages = NULL;
+    while(page != NULL){
+        elf_page_t* next = page->next;
+        uint64_t rflags = mtask_crit_enter();
+        page->next = elf_free_pages;
+        elf_free_pages = page;
+        mtask_crit_leave(rflags);
+        page = next;
+    }
+}
+
+/*
+ * Fills a page with the part of a segment it covers
+ */
+uint8_t* elf_load_page(elf_image_t* image, elf_seg_t* seg, uint64_t page, uint8_t* phys){
+    //The part of the page that's backed by the file
+    uint64_t st = (page > seg->vaddr) ? page : seg->vaddr;
+    uint64_t end = page + 4096;
+    if(end > seg->vaddr + seg->filesz)
+        end = seg->vaddr + seg->filesz;
+    //The rest stays zeroed
+    if(end > st)
+        memcpy(phys + (st - page), image->file + seg->offset + (st - seg->vaddr), end - st);
+    return phys;
+}
+
+/*
+ * Maps the page of the current task's program at a faulting address
+ * (called by the page fault handler with interrupts disabled)
+ * Returns 0 if the fault can't be resolved
+ */
+uint8_t elf_page_fault(uint64_t addr, uint64_t err){
+    if(!mtask_is_enabled())
+        return 0;
+    task_t* task = mtask_get_task(mtask_get_uid());
+    elf_image_t* image = (elf_image_t*)task->elf;
+    //Only user mode faults on non-present pages can be resolved,
+    //  the kernel touching an unmapped user page is a bug
+    if(image == NULL || (err & 1) || !(err & 4))
+        return 0;
+    uint64_t page = addr & ~0xFFFULL;
+    uint64_t cr3 = task->state.cr3;
+    //Stack pages are zero-filled
+    if(addr >= ELF_STACK_TOP - ELF_STACK_SIZE && addr < ELF_STACK_TOP){
+        vmem_create_page(cr3, (virt_addr_t)page, elf_alloc_private(task), VMEM_PAGE_USER | VMEM_PAGE_WRITE);
+        return 1;
+    }
+    //Find the segment
+    for(uint32_t i = 0; i < image->seg_cnt; i++){
+        elf_seg_t* seg = &image->segs[i];
+        if(addr < seg->vaddr || addr >= seg->vaddr + seg->memsz)
+            continue;
+        //Writable segments get private copies
+        if(seg->flags & ELF_PF_W){
+            vmem_create_page(cr3, (virt_addr_t)page, elf_load_page(image, seg, page, elf_alloc_private(task)),
+                             VMEM_PAGE_USER | VMEM_PAGE_WRITE);
+            return 1;
+        }
+        //Writes to read-only segments are fatal
+        if(err & 2)
+            return 0;
+        uint64_t idx = (page - (seg->vaddr & ~0xFFFULL)) / 4096;
+        //Shared pages stay with the image
+        if(seg->shared[idx] == NULL){
+            uint8_t* phys = (uint8_t*)calloc(8192, 1);
+            phys += 4096 - ((uint64_t)phys % 4096); //align by 4 kB
+            seg->shared[idx] = elf_load_page(image, seg, page, phys);
+        }
+        vmem_create_page(cr3, (virt_addr_t)page, seg->shared[idx], VMEM_PAGE_USER);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Sets up the task and enters the program
+ */
+void elf_task_start(void* args){
+    elf_image_t* image = (elf_image_t*)args;
+    mtask_get_task(mtask_get_uid())->elf = image;
+    mtask_enter_user(image->entry, ELF_STACK_TOP - 8, 0);
+}
+
+/*
+ * Starts a program from the initrd as a new task
+ * Returns its UID or -1 on failure
+ */
+uint64_t elf_run(char* name, uint8_t priority){
+    elf_image_t* image = elf_get_image(name);
+    if(image == NULL)
+        return -1;
+    return mtask_create_task(8192, image->name, priority, elf_task_start, image);
+}
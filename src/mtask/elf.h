@@ -0,0 +1,96 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "../stdlib.h"
+#include "./mtask.h"
+
+//ELF identification
+
+#define ELF_MAGIC                           0x464C457F
+#define ELF_CLASS_64                        2
+#define ELF_DATA_LSB                        1
+#define ELF_TYPE_EXEC                       2
+#define ELF_MACHINE_X86_64                  62
+
+//Program header types and flags
+
+#define ELF_PT_LOAD                         1
+#define ELF_PF_X                            (1 << 0)
+#define ELF_PF_W                            (1 << 1)
+#define ELF_PF_R                            (1 << 2)
+
+//Maximum amount of loadable segments
+#define ELF_MAX_SEGMENTS                    8
+//User stack (pages are allocated on demand)
+#define ELF_STACK_TOP                       0x10000000000ULL
+#define ELF_STACK_SIZE                      (1024 * 1024)
+
+//ELF64 file header
+typedef struct {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t os_abi;
+    uint8_t abi_version;
+    uint8_t pad[7];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version2;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf_hdr_t;
+
+//ELF64 program header
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} __attribute__((packed)) elf_phdr_t;
+
+//Loadable segment
+typedef struct {
+    uint64_t vaddr;
+    uint64_t memsz;
+    uint64_t filesz;
+    uint64_t offset;
+    uint32_t flags;
+    //Read-only segments: pages shared by all instances (allocated on first access)
+    uint8_t** shared;
+} elf_seg_t;
+
+//Private page of a task, the link lives in front of the page in the same allocation
+//  (it chains the pages of a task, or the free pages once the task has exited)
+typedef struct _elf_page_s {
+    struct _elf_page_s* next;
+} elf_page_t;
+
+//Executable image
+typedef struct _elf_image_s {
+    struct _elf_image_s* next;
+    char name[56];
+    //File contents
+    uint8_t* file;
+    uint64_t entry;
+    elf_seg_t segs[ELF_MAX_SEGMENTS];
+    uint32_t seg_cnt;
+} elf_image_t;
+
+uint64_t elf_run(char* name, uint8_t priority);
+uint8_t elf_page_fault(uint64_t addr, uint64_t err);
+void elf_task_cleanup(task_t* task);
+
+#endif
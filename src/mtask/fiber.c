@@ -0,0 +1,187 @@
+//Neutron Project
+//Fibers - cooperative threads running inside of a task
+//Switching between them only saves the registers the calling
+//  convention requires to be preserved; CR3 and the XSAVE area stay as is
+
+#include "./fiber.h"
+#include "./mtask.h"
+#include "../stdlib.h"
+
+//Defined in fiber_sw.s
+void fiber_switch(uint64_t* save_rsp, uint64_t new_rsp);
+void fiber_start(void);
+
+//Fibers that have finished (their stacks are reused)
+fiber_t* fiber_pool = NULL;
+
+/*
+ * Puts a fiber at the end of the run queue
+ * Must be called with interrupts disabled
+ */
+void fiber_enqueue(fiber_sched_t* sched, fiber_t* fiber){
+    fiber->next = NULL;
+    if(sched->run_tail != NULL)
+        sched->run_tail->next = fiber;
+    else
+        sched->run_head = fiber;
+    sched->run_tail = fiber;
+}
+
+/*
+ * Initializes a fiber scheduler
+ */
+void fiber_sched_init(fiber_sched_t* sched){
+    sched->rsp = 0;
+    sched->cur = NULL;
+    sched->run_head = NULL;
+    sched->run_tail = NULL;
+    sched->fiber_cnt = 0;
+    sched->task_uid = 0;
+}
+
+/*
+ * Runs the fiber function and finishes the fiber
+ * (called by fiber_start)
+ */
+void fiber_main(fiber_t* fiber){
+    fiber->func(fiber->args);
+    fiber->state = FIBER_STATE_DONE;
+    //Never returns
+    fiber_switch(&fiber->rsp, fiber->sched->rsp);
+}
+
+/*
+ * Creates a fiber
+ * It starts running once fiber_run() is called on the scheduler
+ */
+fiber_t* fiber_create(fiber_sched_t* sched, void(*func)(void*), void* args){
+    //Take a fiber from the pool or allocate a new one
+    uint64_t rflags = mtask_crit_enter();
+    fiber_t* fiber = fiber_pool;
+    if(fiber != NULL)
+        fiber_pool = fiber->next;
+    mtask_crit_leave(rflags);
+    if(fiber == NULL){
+        fiber = (fiber_t*)malloc(sizeof(fiber_t));
+        fiber->stack = malloc(FIBER_STACK_SIZE);
+    }
+    fiber->func = func;
+    fiber->args = args;
+    fiber->sched = sched;
+    fiber->state = FIBER_STATE_READY;
+    fiber->wake_pending = 0;
+    //Build a frame fiber_switch() can return from:
+    //  the XMM area, 8 GPRs (R12 holds the fiber pointer) and the return address
+    uint64_t* frame = (uint64_t*)((((uint64_t)fiber->stack + FIBER_STACK_SIZE) & ~0xFULL) - 256);
+    memset(frame, 0, 256);
+    frame[(168 / 8) + 3] = (uint64_t)fiber;
+    frame[(168 / 8) + 8] = (uint64_t)fiber_start;
+    fiber->rsp = (uint64_t)frame;
+    //Queue it
+    rflags = mtask_crit_enter();
+    sched->fiber_cnt++;
+    fiber_enqueue(sched, fiber);
+    mtask_crit_leave(rflags);
+    return fiber;
+}
+
+/*
+ * Runs the fibers in the current task until all of them finish
+ */
+void fiber_run(fiber_sched_t* sched){
+    task_t* task = mtask_get_task(mtask_get_uid());
+    sched->task_uid = task->uid;
+    task->fibers = sched;
+    while(sched->fiber_cnt > 0){
+        //Take the next fiber
+        uint64_t rflags = mtask_crit_enter();
+        fiber_t* fiber = sched->run_head;
+        if(fiber != NULL){
+            sched->run_head = fiber->next;
+            if(sched->run_head == NULL)
+                sched->run_tail = NULL;
+        }
+        mtask_crit_leave(rflags);
+        //Block the task while all fibers are waiting
+        if(fiber == NULL){
+            mtask_wait();
+            continue;
+        }
+        //Run it till it yields, waits or finishes
+        sched->cur = fiber;
+        fiber_switch(&sched->rsp, fiber->rsp);
+        sched->cur = NULL;
+        //Put it back into the pool if it has finished
+        if(fiber->state == FIBER_STATE_DONE){
+            rflags = mtask_crit_enter();
+            sched->fiber_cnt--;
+            fiber->next = fiber_pool;
+            fiber_pool = fiber;
+            mtask_crit_leave(rflags);
+        }
+    }
+    task->fibers = NULL;
+}
+
+/*
+ * Returns the fiber that's running (or NULL if the task isn't running fibers)
+ */
+fiber_t* fiber_self(void){
+    fiber_sched_t* sched = (fiber_sched_t*)mtask_get_task(mtask_get_uid())->fibers;
+    return (sched == NULL) ? NULL : sched->cur;
+}
+
+/*
+ * Lets other fibers of the task run
+ * (outside of fiber_run() it lets other tasks run)
+ */
+void fiber_yield(void){
+    fiber_t* fiber = fiber_self();
+    if(fiber == NULL){
+        mtask_yield();
+        return;
+    }
+    uint64_t rflags = mtask_crit_enter();
+    fiber_enqueue(fiber->sched, fiber);
+    mtask_crit_leave(rflags);
+    fiber_switch(&fiber->rsp, fiber->sched->rsp);
+}
+
+/*
+ * Blocks the current fiber until fiber_wake() is called on it
+ * Returns immediately if it has been called since the last fiber_wait()
+ *   or if there's no fiber running (nothing could wake it up)
+ */
+void fiber_wait(void){
+    fiber_t* fiber = fiber_self();
+    if(fiber == NULL)
+        return;
+    uint64_t rflags = mtask_crit_enter();
+    if(fiber->wake_pending){
+        fiber->wake_pending = 0;
+        mtask_crit_leave(rflags);
+        return;
+    }
+    fiber->state = FIBER_STATE_WAITING;
+    mtask_crit_leave(rflags);
+    fiber_switch(&fiber->rsp, fiber->sched->rsp);
+}
+
+/*
+ * Unblocks a fiber that called fiber_wait()
+ * Can be called from other tasks and from interrupt handlers
+ */
+void fiber_wake(fiber_t* fiber){
+    uint64_t rflags = mtask_crit_enter();
+    if(fiber->state == FIBER_STATE_WAITING){
+        fiber->state = FIBER_STATE_READY;
+        fiber_enqueue(fiber->sched, fiber);
+        //The task may be waiting for its fibers
+        task_t* task = mtask_get_task(fiber->sched->task_uid);
+        if(task != NULL)
+            mtask_wake(task);
+    } else if(fiber->state == FIBER_STATE_READY) {
+        fiber->wake_pending = 1;
+    }
+    mtask_crit_leave(rflags);
+}
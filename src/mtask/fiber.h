@@ -0,0 +1,59 @@
+#ifndef FIBER_H
+#define FIBER_H
+
+#include "../stdlib.h"
+
+//Fiber stack size
+#define FIBER_STACK_SIZE                    4096
+
+//Fiber states
+
+#define FIBER_STATE_READY                   0
+#define FIBER_STATE_WAITING                 1
+#define FIBER_STATE_DONE                    2
+
+struct _fiber_sched_s;
+
+//Fiber
+typedef struct _fiber_s {
+    //Saved stack pointer
+    uint64_t rsp;
+    //Next fiber in the run queue or in the pool
+    struct _fiber_s* next;
+    //Stack memory
+    void* stack;
+    //Fiber function and its argument
+    void(*func)(void*);
+    void* args;
+    //The scheduler the fiber belongs to
+    struct _fiber_sched_s* sched;
+    volatile uint8_t state;
+    //Set by fiber_wake() if the fiber wasn't waiting at that moment
+    volatile uint8_t wake_pending;
+} fiber_t;
+
+//Fiber scheduler, runs fibers inside of one task
+typedef struct _fiber_sched_s {
+    //Saved stack pointer of the task
+    uint64_t rsp;
+    //The fiber that's running
+    fiber_t* cur;
+    //Run queue
+    fiber_t* run_head;
+    fiber_t* run_tail;
+    //Amount of fibers that haven't finished yet
+    uint32_t fiber_cnt;
+    //UID of the task running the scheduler
+    uint64_t task_uid;
+} fiber_sched_t;
+
+void fiber_sched_init(fiber_sched_t* sched);
+fiber_t* fiber_create(fiber_sched_t* sched, void(*func)(void*), void* args);
+void fiber_run(fiber_sched_t* sched);
+
+fiber_t* fiber_self(void);
+void fiber_yield(void);
+void fiber_wait(void);
+void fiber_wake(fiber_t* fiber);
+
+#endif
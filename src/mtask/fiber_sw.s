@@ -0,0 +1,60 @@
+.intel_syntax noprefix
+.globl   fiber_switch, fiber_start
+.align   8
+
+;//void fiber_switch(uint64_t* save_rsp, uint64_t new_rsp)
+;//Only saves the registers the calling convention requires to be preserved
+fiber_switch:
+    ;//Save the callee-saved GPRs
+    push rbx
+    push rbp
+    push rdi
+    push rsi
+    push r12
+    push r13
+    push r14
+    push r15
+    ;//Save the callee-saved XMM registers
+    sub rsp, 168
+    movdqu [rsp+  0], xmm6
+    movdqu [rsp+ 16], xmm7
+    movdqu [rsp+ 32], xmm8
+    movdqu [rsp+ 48], xmm9
+    movdqu [rsp+ 64], xmm10
+    movdqu [rsp+ 80], xmm11
+    movdqu [rsp+ 96], xmm12
+    movdqu [rsp+112], xmm13
+    movdqu [rsp+128], xmm14
+    movdqu [rsp+144], xmm15
+    ;//Switch stacks
+    mov [rcx], rsp
+    mov rsp, rdx
+    ;//Restore the XMM registers
+    movdqu xmm6,  [rsp+  0]
+    movdqu xmm7,  [rsp+ 16]
+    movdqu xmm8,  [rsp+ 32]
+    movdqu xmm9,  [rsp+ 48]
+    movdqu xmm10, [rsp+ 64]
+    movdqu xmm11, [rsp+ 80]
+    movdqu xmm12, [rsp+ 96]
+    movdqu xmm13, [rsp+112]
+    movdqu xmm14, [rsp+128]
+    movdqu xmm15, [rsp+144]
+    add rsp, 168
+    ;//Restore the GPRs
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rsi
+    pop rdi
+    pop rbp
+    pop rbx
+    ret
+
+fiber_start:
+    ;//New fibers start here, R12 holds the fiber pointer
+    mov rcx, r12
+    and rsp, -16
+    sub rsp, 32
+    call fiber_main
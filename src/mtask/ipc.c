@@ -0,0 +1,429 @@
+//Neutron Project
+//IPC - message channels between tasks
+//Small messages are copied through a bounded ring, large payloads are
+//  passed by moving physical pages from one address space to another
+
+#include "./ipc.h"
+#include "./mtask.h"
+#include "../stdlib.h"
+#include "../vmem/vmem.h"
+#include "../drivers/timr.h"
+
+//Physically contiguous page blocks that are free
+typedef struct _ipc_block_s {
+    struct _ipc_block_s* next;
+    uint32_t cnt;
+} ipc_block_t;
+ipc_block_t* ipc_free_blocks = NULL;
+//All channels
+ipc_chan_t* ipc_chans = NULL;
+
+//Free range of a task's IPC window (the list is sorted by address)
+typedef struct _ipc_range_s {
+    struct _ipc_range_s* next;
+    uint64_t start;
+    uint32_t cnt;
+} ipc_range_t;
+
+/*
+ * Creates a channel that can hold a certain amount of messages
+ * (rounded up to a power of two)
+ * The current task owns it; the channel is closed once the task exits
+ */
+ipc_chan_t* ipc_chan_create(uint32_t size){
+    uint32_t real_size = 1;
+    while(real_size < size)
+        real_size <<= 1;
+    ipc_chan_t* chan = (ipc_chan_t*)calloc(1, sizeof(ipc_chan_t));
+    chan->ring = (ipc_msg_t*)calloc(real_size, sizeof(ipc_msg_t));
+    chan->size = real_size;
+    chan->owner = mtask_get_uid();
+    uint64_t rflags = mtask_crit_enter();
+    chan->next = ipc_chans;
+    ipc_chans = chan;
+    mtask_crit_leave(rflags);
+    return chan;
+}
+
+/*
+ * Blocks the current task until it's woken up through a wait queue
+ * Must be called with interrupts disabled, enables them
+ */
+void ipc_wait(ipc_waitq_t* q, uint64_t rflags){
+    if(q->cnt < IPC_WAITQ_SIZE){
+        q->uids[q->cnt++] = mtask_get_uid();
+        mtask_crit_leave(rflags);
+        mtask_wait();
+    } else {
+        //No space in the queue, check again a bit later
+        mtask_crit_leave(rflags);
+        mtask_wait_till(rdtsc() + timr_us_to_tsc(IPC_POLL_US));
+    }
+}
+
+/*
+ * Wakes up all tasks in a wait queue
+ * Must be called with interrupts disabled
+ */
+void ipc_wake_all(ipc_waitq_t* q){
+    for(uint8_t i = 0; i < q->cnt; i++){
+        //The task may have exited in the meantime
+        task_t* task = mtask_get_task(q->uids[i]);
+        if(task != NULL)
+            mtask_wake(task);
+    }
+    q->cnt = 0;
+}
+
+/*
+ * Puts a physically contiguous block of pages into the free list
+ * Must be called with interrupts disabled
+ */
+void ipc_block_free(phys_addr_t phys, uint32_t cnt){
+    ipc_block_t* block = (ipc_block_t*)phys;
+    block->cnt = cnt;
+    block->next = ipc_free_blocks;
+    ipc_free_blocks = block;
+}
+
+/*
+ * Reserves cnt pages of the IPC window of a task
+ * Only the task itself (or the kernel with interrupts disabled on its behalf) may call this
+ * Returns 0 if there's no range large enough
+ */
+uint64_t ipc_range_alloc(task_t* task, uint32_t cnt){
+    uint64_t size = (uint64_t)cnt * 4096;
+    //Reuse a freed range (first fit)
+    //The list head is worked on locally, task_t is packed
+    ipc_range_t* head = (ipc_range_t*)task->ipc_ranges;
+    ipc_range_t** link = &head;
+    while(*link != NULL){
+        ipc_range_t* range = *link;
+        if(range->cnt >= cnt){
+            uint64_t addr = range->start;
+            range->start += size;
+            range->cnt -= cnt;
+            if(range->cnt == 0){
+                *link = range->next;
+                free(range);
+            }
+            task->ipc_ranges = head;
+            return addr;
+        }
+        link = &range->next;
+    }
+    //Take it from the untouched part of the window
+    if(task->ipc_window_next + size > IPC_WINDOW_BASE + IPC_WINDOW_SIZE)
+        return 0;
+    uint64_t addr = task->ipc_window_next;
+    task->ipc_window_next += size;
+    return addr;
+}
+
+/*
+ * Gives a range of the IPC window of a task back
+ */
+void ipc_range_free(task_t* task, uint64_t addr, uint32_t cnt){
+    uint64_t size = (uint64_t)cnt * 4096;
+    ipc_range_t* head = (ipc_range_t*)task->ipc_ranges;
+    ipc_range_t** link = &head;
+    ipc_range_t* prev = NULL;
+    while(*link != NULL && (*link)->start < addr){
+        prev = *link;
+        link = &prev->next;
+    }
+    ipc_range_t* next = *link;
+    //Merge with the neighbours
+    if(prev != NULL && prev->start + ((uint64_t)prev->cnt * 4096) == addr){
+        prev->cnt += cnt;
+        if(next != NULL && addr + size == next->start){
+            prev->cnt += next->cnt;
+            prev->next = next->next;
+            free(next);
+        }
+    } else if(next != NULL && addr + size == next->start){
+        next->start = addr;
+        next->cnt += cnt;
+    } else {
+        ipc_range_t* range = (ipc_range_t*)malloc(sizeof(ipc_range_t));
+        range->start = addr;
+        range->cnt = cnt;
+        range->next = next;
+        *link = range;
+    }
+    //A free range at the end goes back to the untouched part
+    ipc_range_t** last = &head;
+    while(*last != NULL && (*last)->next != NULL)
+        last = &(*last)->next;
+    if(*last != NULL && (*last)->start + ((uint64_t)(*last)->cnt * 4096) == task->ipc_window_next){
+        task->ipc_window_next = (*last)->start;
+        free(*last);
+        *last = NULL;
+    }
+    task->ipc_ranges = head;
+}
+
+/*
+ * Allocates physically contiguous pages and maps them into
+ *   the IPC window of the current task
+ */
+void* ipc_alloc_pages(uint32_t cnt){
+    task_t* task = mtask_get_task(mtask_get_uid());
+    if(cnt == 0)
+        return NULL;
+    uint64_t rflags = mtask_crit_enter();
+    uint64_t addr = ipc_range_alloc(task, cnt);
+    if(addr == 0){
+        mtask_crit_leave(rflags);
+        return NULL;
+    }
+    //Reuse a free block if possible
+    ipc_block_t** link = &ipc_free_blocks;
+    ipc_block_t* block = NULL;
+    while(*link != NULL){
+        if((*link)->cnt == cnt){
+            block = *link;
+            *link = block->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    mtask_crit_leave(rflags);
+    uint8_t* phys;
+    if(block != NULL){
+        phys = (uint8_t*)block;
+        memset(phys, 0, cnt * 4096);
+    } else {
+        phys = (uint8_t*)calloc(cnt + 1, 4096);
+        phys += 4096 - ((uint64_t)phys % 4096); //align by 4 kB
+    }
+    //Map them
+    vmem_map(task->state.cr3, phys, phys + (cnt * 4096), (virt_addr_t)addr, VMEM_PAGE_WRITE | VMEM_PAGE_USER);
+    return (void*)addr;
+}
+
+/*
+ * Unmaps pages allocated with ipc_alloc_pages() (or received)
+ *   from the current task and frees them
+ */
+void ipc_free_pages(void* addr, uint32_t cnt){
+    if((uint64_t)addr < IPC_WINDOW_BASE || (uint64_t)addr + ((uint64_t)cnt * 4096) > IPC_WINDOW_BASE + IPC_WINDOW_SIZE
+       || ((uint64_t)addr & 0xFFF) || cnt == 0)
+        return;
+    task_t* task = mtask_get_task(mtask_get_uid());
+    uint64_t cr3 = task->state.cr3;
+    ipc_block_t* block = (ipc_block_t*)vmem_translate(cr3, addr);
+    if(block == NULL)
+        return;
+    for(uint32_t i = 0; i < cnt; i++)
+        vmem_unmap_page(cr3, (uint8_t*)addr + (i * 4096));
+    uint64_t rflags = mtask_crit_enter();
+    ipc_range_free(task, (uint64_t)addr, cnt);
+    ipc_block_free(block, cnt);
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Removes pages that are about to be sent from the address space of the current task
+ * Returns their physical address or NULL if they aren't a contiguous block in the IPC window
+ */
+phys_addr_t ipc_detach_pages(uint64_t addr, uint32_t cnt){
+    if(addr < IPC_WINDOW_BASE || addr + ((uint64_t)cnt * 4096) > IPC_WINDOW_BASE + IPC_WINDOW_SIZE || (addr & 0xFFF))
+        return NULL;
+    task_t* task = mtask_get_task(mtask_get_uid());
+    uint64_t cr3 = task->state.cr3;
+    uint8_t* phys = vmem_translate(cr3, (virt_addr_t)addr);
+    if(phys == NULL)
+        return NULL;
+    for(uint32_t i = 1; i < cnt; i++)
+        if(vmem_translate(cr3, (virt_addr_t)(addr + (i * 4096))) != phys + (i * 4096))
+            return NULL;
+    for(uint32_t i = 0; i < cnt; i++)
+        vmem_unmap_page(cr3, (virt_addr_t)(addr + (i * 4096)));
+    uint64_t rflags = mtask_crit_enter();
+    ipc_range_free(task, addr, cnt);
+    mtask_crit_leave(rflags);
+    return phys;
+}
+
+/*
+ * Puts a message into the ring
+ * Must be called with interrupts disabled, the ring must not be full
+ */
+void ipc_put(ipc_chan_t* chan, ipc_msg_t* msg, phys_addr_t pages){
+    ipc_msg_t* slot = &chan->ring[chan->head & (chan->size - 1)];
+    *slot = *msg;
+    slot->pages = (uint64_t)pages;
+    slot->sender = mtask_get_uid();
+    chan->head++;
+    ipc_wake_all(&chan->rx_wait);
+}
+
+/*
+ * Sends a message, waiting for free space in the channel
+ * If msg->page_cnt isn't zero, the pages at msg->pages (allocated with
+ *   ipc_alloc_pages()) are moved to the receiver
+ * Returns 0 if the pages can't be sent or the channel is closed
+ */
+uint8_t ipc_send(ipc_chan_t* chan, ipc_msg_t* msg){
+    phys_addr_t pages = NULL;
+    if(msg->page_cnt > 0){
+        pages = ipc_detach_pages(msg->pages, msg->page_cnt);
+        if(pages == NULL)
+            return 0;
+    }
+    while(1){
+        uint64_t rflags = mtask_crit_enter();
+        //Nobody will receive from a closed channel, the pages are freed
+        if(chan->closed){
+            if(pages != NULL)
+                ipc_block_free(pages, msg->page_cnt);
+            mtask_crit_leave(rflags);
+            return 0;
+        }
+        if(chan->head - chan->tail < chan->size){
+            ipc_put(chan, msg, pages);
+            mtask_crit_leave(rflags);
+            return 1;
+        }
+        //The channel is full
+        ipc_wait(&chan->tx_wait, rflags);
+    }
+}
+
+/*
+ * Sends a message without pages if there's free space in the channel
+ * Can be called from interrupt handlers
+ * Returns 0 if the channel is full or closed
+ */
+uint8_t ipc_try_send(ipc_chan_t* chan, ipc_msg_t* msg){
+    uint64_t rflags = mtask_crit_enter();
+    if(chan->closed || chan->head - chan->tail >= chan->size){
+        mtask_crit_leave(rflags);
+        return 0;
+    }
+    msg->page_cnt = 0;
+    ipc_put(chan, msg, NULL);
+    mtask_crit_leave(rflags);
+    return 1;
+}
+
+/*
+ * Takes a message from the ring and maps its pages into the current task
+ * Must be called with interrupts disabled, the ring must not be empty
+ * Returns 0 (leaving the message in the ring) if the pages don't fit into the IPC window
+ */
+uint8_t ipc_take(ipc_chan_t* chan, ipc_msg_t* msg){
+    ipc_msg_t* slot = &chan->ring[chan->tail & (chan->size - 1)];
+    uint64_t addr = 0;
+    if(slot->page_cnt > 0){
+        addr = ipc_range_alloc(mtask_get_task(mtask_get_uid()), slot->page_cnt);
+        if(addr == 0)
+            return 0;
+    }
+    *msg = *slot;
+    chan->tail++;
+    ipc_wake_all(&chan->tx_wait);
+    if(msg->page_cnt == 0)
+        return 1;
+    uint8_t* phys = (uint8_t*)msg->pages;
+    msg->pages = addr;
+    vmem_map(mtask_get_task(mtask_get_uid())->state.cr3, phys, phys + (msg->page_cnt * 4096), (virt_addr_t)addr,
+             VMEM_PAGE_WRITE | VMEM_PAGE_USER);
+    return 1;
+}
+
+/*
+ * Receives a message, waiting for one if the channel is empty
+ * Returns 0 if the message carries pages that don't fit into the IPC window
+ *   of the task (the message stays in the channel)
+ */
+uint8_t ipc_recv(ipc_chan_t* chan, ipc_msg_t* msg){
+    while(1){
+        uint64_t rflags = mtask_crit_enter();
+        if(chan->head != chan->tail){
+            uint8_t ok = ipc_take(chan, msg);
+            mtask_crit_leave(rflags);
+            return ok;
+        }
+        //The channel is empty
+        ipc_wait(&chan->rx_wait, rflags);
+    }
+}
+
+/*
+ * Receives a message if there is one
+ * Returns 0 if the channel is empty or if the pages of the message
+ *   don't fit into the IPC window of the task
+ */
+uint8_t ipc_try_recv(ipc_chan_t* chan, ipc_msg_t* msg){
+    uint64_t rflags = mtask_crit_enter();
+    if(chan->head == chan->tail){
+        mtask_crit_leave(rflags);
+        return 0;
+    }
+    uint8_t ok = ipc_take(chan, msg);
+    mtask_crit_leave(rflags);
+    return ok;
+}
+
+/*
+ * Frees the IPC resources of a task that has exited:
+ *   the pages mapped in its IPC window, the pages of the messages
+ *   waiting in its channels and the window bookkeeping
+ * Must be called before its page tables are freed
+ */
+void ipc_task_cleanup(task_t* task){
+    uint64_t cr3 = task->state.cr3;
+    ipc_range_t* range = (ipc_range_t*)task->ipc_ranges;
+    //Collect runs of physically contiguous pages between the free ranges of the window
+    uint8_t* run = NULL;
+    uint32_t run_cnt = 0;
+    for(uint64_t addr = IPC_WINDOW_BASE; addr < task->ipc_window_next; addr += 4096){
+        uint8_t* phys = NULL;
+        if(range != NULL && addr >= range->start){
+            //Skip the free range
+            addr = range->start + ((uint64_t)range->cnt * 4096) - 4096;
+            range = range->next;
+        } else {
+            phys = vmem_translate(cr3, (virt_addr_t)addr);
+        }
+        if(run != NULL && phys == run + ((uint64_t)run_cnt * 4096)){
+            run_cnt++;
+            continue;
+        }
+        if(run != NULL){
+            uint64_t rflags = mtask_crit_enter();
+            ipc_block_free(run, run_cnt);
+            mtask_crit_leave(rflags);
+        }
+        run = phys;
+        run_cnt = 1;
+    }
+    uint64_t rflags = mtask_crit_enter();
+    if(run != NULL)
+        ipc_block_free(run, run_cnt);
+    //Close its channels and free the pages nobody will receive
+    for(ipc_chan_t* chan = ipc_chans; chan != NULL; chan = chan->next){
+        if(chan->owner != task->uid || chan->closed)
+            continue;
+        chan->closed = 1;
+        for(; chan->tail != chan->head; chan->tail++){
+            ipc_msg_t* slot = &chan->ring[chan->tail & (chan->size - 1)];
+            if(slot->page_cnt > 0)
+                ipc_block_free((phys_addr_t)slot->pages, slot->page_cnt);
+        }
+        //Let the senders see that it's closed
+        ipc_wake_all(&chan->tx_wait);
+    }
+    mtask_crit_leave(rflags);
+    //Free the bookkeeping
+    range = (ipc_range_t*)task->ipc_ranges;
+    while(range != NULL){
+        ipc_range_t* next = range->next;
+        free(range);
+        range = next;
+    }
+    task->ipc_ranges = NULL;
+    task->ipc_window_next = IPC_WINDOW_BASE;
+}
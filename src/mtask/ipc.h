@@ -0,0 +1,71 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "../stdlib.h"
+#include "./mtask.h"
+
+//Pages transferred between tasks are mapped in this virtual address range
+//  (right above the identity-mapped physical memory)
+#define IPC_WINDOW_BASE                     0x200000000ULL
+#define IPC_WINDOW_SIZE                     0x40000000ULL
+
+//Inline message payload size
+#define IPC_MSG_DATA_SIZE                   40
+//Maximum amount of tasks recorded as waiting on a channel
+//  (others poll with a timeout)
+#define IPC_WAITQ_SIZE                      8
+//Poll interval of the tasks that didn't fit into the wait queue (us)
+#define IPC_POLL_US                         1000
+
+//Message
+typedef struct {
+    //Message type (not interpreted by the kernel)
+    uint32_t type;
+    //Amount of pages transferred with the message
+    uint32_t page_cnt;
+    //Address of the pages (in the address space of the sender when
+    //  sending and in that of the receiver after receiving)
+    uint64_t pages;
+    //UID of the sender (filled in by the kernel)
+    uint64_t sender;
+    //Inline payload
+    uint8_t data[IPC_MSG_DATA_SIZE];
+} ipc_msg_t;
+
+//Tasks waiting on a channel
+typedef struct {
+    uint64_t uids[IPC_WAITQ_SIZE];
+    uint8_t cnt;
+} ipc_waitq_t;
+
+//Channel
+typedef struct _ipc_chan_s {
+    struct _ipc_chan_s* next;
+    //UID of the task that has created the channel and receives from it
+    uint64_t owner;
+    //Set once the owner has exited, nothing can be sent anymore
+    uint8_t closed;
+    //Message ring
+    ipc_msg_t* ring;
+    //Ring size (a power of two)
+    uint32_t size;
+    //Total amount of messages sent and received
+    uint32_t head;
+    uint32_t tail;
+    //Tasks waiting for a message or for free space
+    ipc_waitq_t rx_wait;
+    ipc_waitq_t tx_wait;
+} ipc_chan_t;
+
+ipc_chan_t* ipc_chan_create(uint32_t size);
+
+uint8_t ipc_send(ipc_chan_t* chan, ipc_msg_t* msg);
+uint8_t ipc_try_send(ipc_chan_t* chan, ipc_msg_t* msg);
+uint8_t ipc_recv(ipc_chan_t* chan, ipc_msg_t* msg);
+uint8_t ipc_try_recv(ipc_chan_t* chan, ipc_msg_t* msg);
+
+void* ipc_alloc_pages(uint32_t cnt);
+void ipc_free_pages(void* addr, uint32_t cnt);
+void ipc_task_cleanup(task_t* task);
+
+#endif
@@ -0,0 +1,256 @@
+//Neutron Project
+//Kernel timers
+//Callbacks are kept in a hierarchical timer wheel. The wheel doesn't tick:
+//  ktimer_run() jumps straight to the next non-empty slot, so the
+//  hardware timer only has to fire when something is actually due
+
+#include "./ktimer.h"
+#include "./mtask.h"
+#include "../stdlib.h"
+#include "../drivers/timr.h"
+#include "../drivers/clock.h"
+
+//Wheel slots and their occupancy bitmaps
+ktimer_t* ktimer_slots[KTIMER_LEVELS][KTIMER_SLOTS];
+uint64_t ktimer_bitmap[KTIMER_LEVELS];
+//The time the wheel has been advanced to (in level 0 slots)
+uint64_t ktimer_clk;
+//Timers that are due and about to have their callbacks run
+ktimer_t* ktimer_expired;
+
+/*
+ * Returns the head of the list a timer is in
+ */
+ktimer_t** ktimer_head(ktimer_t* timer){
+    if(timer->level == KTIMER_LEVEL_EXPIRED)
+        return &ktimer_expired;
+    return &ktimer_slots[timer->level][timer->slot];
+}
+
+/*
+ * Adds a timer to the list it belongs to
+ * Must be called with interrupts disabled
+ */
+void ktimer_link(ktimer_t* timer){
+    ktimer_t** head = ktimer_head(timer);
+    timer->prev = NULL;
+    timer->next = *head;
+    if(timer->next != NULL)
+        timer->next->prev = timer;
+    *head = timer;
+    if(timer->level != KTIMER_LEVEL_EXPIRED)
+        ktimer_bitmap[timer->level] |= 1ULL << timer->slot;
+}
+
+/*
+ * Puts a timer into the slot its deadline belongs to
+ * Must be called with interrupts disabled
+ */
+void ktimer_insert(ktimer_t* timer){
+    uint64_t expires = timer->deadline >> KTIMER_RES_SHIFT;
+    //Overdue timers go into the current slot
+    if(expires < ktimer_clk)
+        expires = ktimer_clk;
+    uint64_t delta = expires - ktimer_clk;
+    //Timers that are too far away are parked in the last level
+    //  and sorted out again when it gets cascaded
+    if(delta >> (KTIMER_LEVELS * KTIMER_SLOT_BITS)){
+        delta = (1ULL << (KTIMER_LEVELS * KTIMER_SLOT_BITS)) - 1;
+        expires = ktimer_clk + delta;
+    }
+    //Choose the level
+    uint8_t level = 0;
+    while(delta >> ((level + 1) * KTIMER_SLOT_BITS))
+        level++;
+    uint8_t slot = (expires >> (level * KTIMER_SLOT_BITS)) & (KTIMER_SLOTS - 1);
+    timer->level = level;
+    timer->slot = slot;
+    ktimer_link(timer);
+}
+
+/*
+ * Takes a timer out of the list it's in
+ * Must be called with interrupts disabled
+ */
+void ktimer_unlink(ktimer_t* timer){
+    ktimer_t** head = ktimer_head(timer);
+    if(timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        *head = timer->next;
+    if(timer->next != NULL)
+        timer->next->prev = timer->prev;
+    if(timer->level != KTIMER_LEVEL_EXPIRED && *head == NULL)
+        ktimer_bitmap[timer->level] &= ~(1ULL << timer->slot);
+}
+
+/*
+ * Takes all timers out of a slot
+ * Must be called with interrupts disabled
+ */
+ktimer_t* ktimer_take_slot(uint8_t level, uint8_t slot){
+    ktimer_t* list = ktimer_slots[level][slot];
+    ktimer_slots[level][slot] = NULL;
+    ktimer_bitmap[level] &= ~(1ULL << slot);
+    return list;
+}
+
+/*
+ * Returns the time (in level 0 slots) at which the wheel has to be
+ *   processed next, or 0xFFFFFFFFFFFFFFFF if it's empty
+ * For level 0 that's the moment the slot is due,
+ *   for other levels that's the moment the slot is cascaded
+ * Must be called with interrupts disabled
+ */
+uint64_t ktimer_next_slot(uint8_t* level_out){
+    uint64_t best = 0xFFFFFFFFFFFFFFFF;
+    for(uint8_t level = 0; level < KTIMER_LEVELS; level++){
+        if(ktimer_bitmap[level] == 0)
+            continue;
+        uint8_t shift = level * KTIMER_SLOT_BITS;
+        uint64_t pos = ktimer_clk >> shift;
+        //Level 0 includes the current slot, other levels are at least one slot ahead
+        uint8_t first = (pos + (level ? 1 : 0)) & (KTIMER_SLOTS - 1);
+        uint64_t rot = (ktimer_bitmap[level] >> first) | (ktimer_bitmap[level] << ((KTIMER_SLOTS - first) & (KTIMER_SLOTS - 1)));
+        uint64_t at = (pos + (level ? 1 : 0) + __builtin_ctzll(rot)) << shift;
+        if(at < best){
+            best = at;
+            if(level_out != NULL)
+                *level_out = level;
+        }
+    }
+    return best;
+}
+
+/*
+ * Initializes the timer wheel
+ */
+void ktimer_init_wheel(void){
+    for(uint8_t level = 0; level < KTIMER_LEVELS; level++){
+        for(uint8_t slot = 0; slot < KTIMER_SLOTS; slot++)
+            ktimer_slots[level][slot] = NULL;
+        ktimer_bitmap[level] = 0;
+    }
+    ktimer_expired = NULL;
+    ktimer_clk = clock_monotonic_ns() >> KTIMER_RES_SHIFT;
+}
+
+/*
+ * Initializes a timer
+ */
+void ktimer_init(ktimer_t* timer, void(*func)(void*), void* args){
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->func = func;
+    timer->args = args;
+    timer->deadline = 0;
+    timer->armed = 0;
+}
+
+/*
+ * Arms a timer to fire at an absolute clock_monotonic_ns() value
+ * Re-arms it if it's armed already
+ * Can be called from interrupt handlers and timer callbacks
+ */
+void ktimer_arm(ktimer_t* timer, uint64_t deadline){
+    uint64_t rflags = mtask_crit_enter();
+    if(timer->armed)
+        ktimer_unlink(timer);
+    timer->deadline = deadline;
+    timer->armed = 1;
+    ktimer_insert(timer);
+    //Make sure the hardware timer fires in time
+    timr_arm_before(clock_monotonic_to_tsc(deadline));
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Arms a timer to fire after a certain amount of nanoseconds
+ */
+void ktimer_arm_in(ktimer_t* timer, uint64_t ns){
+    ktimer_arm(timer, clock_monotonic_ns() + ns);
+}
+
+/*
+ * Disarms a timer
+ * Returns 0 if it wasn't armed (e.g. because it has fired already)
+ */
+uint8_t ktimer_cancel(ktimer_t* timer){
+    uint64_t rflags = mtask_crit_enter();
+    uint8_t armed = timer->armed;
+    if(armed){
+        ktimer_unlink(timer);
+        timer->armed = 0;
+    }
+    mtask_crit_leave(rflags);
+    return armed;
+}
+
+/*
+ * Advances the wheel and runs the callbacks of all due timers
+ * (called by the scheduler with interrupts disabled)
+ */
+void ktimer_run(uint64_t now){
+    uint64_t target = now >> KTIMER_RES_SHIFT;
+    while(1){
+        uint64_t next = ktimer_next_slot(NULL);
+        if(next > target){
+            ktimer_clk = target;
+            break;
+        }
+        ktimer_clk = next;
+        //Cascade the levels that have reached a slot boundary, coarsest first
+        for(uint8_t level = KTIMER_LEVELS - 1; level > 0; level--){
+            uint8_t shift = level * KTIMER_SLOT_BITS;
+            if(ktimer_clk & ((1ULL << shift) - 1))
+                continue;
+            ktimer_t* timer = ktimer_take_slot(level, (ktimer_clk >> shift) & (KTIMER_SLOTS - 1));
+            while(timer != NULL){
+                ktimer_t* next_timer = timer->next;
+                ktimer_insert(timer);
+                timer = next_timer;
+            }
+        }
+        //Move the due timers of the level 0 slot onto the expired list
+        //  (some may be due later within the slot)
+        ktimer_t* timer = ktimer_slots[0][ktimer_clk & (KTIMER_SLOTS - 1)];
+        while(timer != NULL){
+            ktimer_t* next_timer = timer->next;
+            if(timer->deadline <= now){
+                ktimer_unlink(timer);
+                timer->level = KTIMER_LEVEL_EXPIRED;
+                ktimer_link(timer);
+            }
+            timer = next_timer;
+        }
+        //Run their callbacks
+        //The callbacks are free to arm and cancel any timers, these ones included
+        while((timer = ktimer_expired) != NULL){
+            ktimer_unlink(timer);
+            timer->armed = 0;
+            timer->func(timer->args);
+        }
+        if(ktimer_clk == target)
+            break;
+    }
+}
+
+/*
+ * Returns the clock_monotonic_ns() value the hardware timer has to fire at
+ *   for the wheel to be processed in time (0 if no timers are armed)
+ * Must be called with interrupts disabled
+ */
+uint64_t ktimer_next(void){
+    uint8_t level;
+    uint64_t next = ktimer_next_slot(&level);
+    if(next == 0xFFFFFFFFFFFFFFFF)
+        return 0;
+    if(level > 0)
+        return next << KTIMER_RES_SHIFT;
+    //Level 0 slots hold the exact deadlines
+    uint64_t best = 0xFFFFFFFFFFFFFFFF;
+    for(ktimer_t* timer = ktimer_slots[0][next & (KTIMER_SLOTS - 1)]; timer != NULL; timer = timer->next)
+        if(timer->deadline < best)
+            best = timer->deadline;
+    return best ? best : 1;
+}
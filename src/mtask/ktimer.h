@@ -0,0 +1,43 @@
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include "../stdlib.h"
+
+//Timer wheel geometry
+//Level 0 slots are 2^KTIMER_RES_SHIFT ns (~1 us) wide, every next level is 64 times coarser
+#define KTIMER_RES_SHIFT                    10
+#define KTIMER_LEVELS                       6
+#define KTIMER_SLOT_BITS                    6
+#define KTIMER_SLOTS                        (1 << KTIMER_SLOT_BITS)
+//Level of timers that are due and about to have their callbacks run
+#define KTIMER_LEVEL_EXPIRED                0xFF
+
+//Kernel timer
+//The structure is owned by the caller and must stay valid while the timer is armed
+//The callback runs in the timer interrupt with interrupts disabled,
+//  so it should only do short things like mtask_wake() or workq_enqueue()
+typedef struct _ktimer_s {
+    struct _ktimer_s* next;
+    struct _ktimer_s* prev;
+    //Callback and its argument
+    void(*func)(void*);
+    void* args;
+    //Absolute deadline (clock_monotonic_ns() value)
+    uint64_t deadline;
+    //Wheel slot the timer is in
+    //  (KTIMER_LEVEL_EXPIRED while it's waiting for its callback to run)
+    uint8_t level;
+    uint8_t slot;
+    //Set while the timer is armed
+    volatile uint8_t armed;
+} ktimer_t;
+
+void ktimer_init_wheel(void);
+void ktimer_init(ktimer_t* timer, void(*func)(void*), void* args);
+void ktimer_arm(ktimer_t* timer, uint64_t deadline);
+void ktimer_arm_in(ktimer_t* timer, uint64_t ns);
+uint8_t ktimer_cancel(ktimer_t* timer);
+void ktimer_run(uint64_t now);
+uint64_t ktimer_next(void);
+
+#endif
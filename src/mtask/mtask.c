@@ -2,86 +2,348 @@
 //MTask - Multitasking engine
 
 #include "./mtask.h"
+#include "./trace.h"
+#include "./ipc.h"
+#include "./elf.h"
+#include "./ktimer.h"
 #include "../stdlib.h"
+#include "../cpuid.h"
 #include "../drivers/timr.h"
+#include "../drivers/clock.h"
 #include "../drivers/gfx.h"
 #include "../vmem/vmem.h"
+#include "../gui/windows.h"
+#include "../gdt.h"
+#include "../percpu.h"
 
-task_t* mtask_task_list;
-uint32_t mtask_next_task;
-uint64_t mtask_next_uid;
+//Structure describing a stack that can be reused
+typedef struct _mtask_stack_s {
+    struct _mtask_stack_s* next;
+    uint64_t size;
+} mtask_stack_t;
+
+//Defined in mtask_sw.s
+void mtask_exit_tramp(void);
+void mtask_iret_user(uint64_t entry, uint64_t user_rsp, uint64_t arg) __attribute__((noreturn));
+
+//The task table (an array of pointers, so that tasks never move in memory)
+task_t** mtask_task_list;
+//The amount of slots the task table can currently hold
+uint32_t mtask_task_cap;
+//The amount of slots that have ever been used
+uint32_t mtask_task_cnt;
+//The first slot in the free slot list
+uint32_t mtask_free_slot;
+//The first slot in the list of tasks waiting to be reaped
+uint32_t mtask_zombie_slot;
+//Stacks of reaped tasks
+mtask_stack_t* mtask_free_stacks;
+//The reaper task
+task_t* mtask_reaper;
+//The idle task
+task_t* mtask_idle;
+//Set when a task becomes runnable outside of the scheduler
+volatile uint8_t mtask_resched;
+//Amount of deadline class tasks
+uint32_t mtask_dl_cnt;
 uint32_t mtask_cur_task_no;
-uint8_t mtask_enabled;
+//The current task (mirrored in the per-CPU block for the assembly code)
 task_t* mtask_cur_task;
 
 /*
- * Returns the current task pointer
- * (used only by mtask_sw.s)
+ * Is multitasking enabled?
  */
-task_t* mtask_get_cur_task(void){
-    return mtask_cur_task;
+uint64_t mtask_is_enabled(void){
+    return percpu_get()->mtask_enabled;
 }
 
 /*
- * Is multitasking enabled?
- * (used only by mtask_sw.s)
+ * Makes a task current
  */
-uint64_t mtask_is_enabled(void){
-    return mtask_enabled;
+void mtask_set_cur_task(task_t* task){
+    mtask_cur_task = task;
+    percpu_get()->cur_task = task;
+}
+
+/*
+ * Sets the kernel stack used on interrupts and system calls in user mode
+ */
+void mtask_set_kstack(task_t* task){
+    uint64_t top = ((uint64_t)task->stack_base + task->stack_size) & ~0xFULL;
+    gdt_set_kstack(top);
+    percpu_get()->kstack = top;
+}
+
+/*
+ * Saves RFLAGS and disables interrupts
+ * Returns the value that should be passed to mtask_crit_leave()
+ */
+uint64_t mtask_crit_enter(void){
+    uint64_t rflags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r" (rflags));
+    return rflags;
+}
+
+/*
+ * Restores RFLAGS saved by mtask_crit_enter()
+ */
+void mtask_crit_leave(uint64_t rflags){
+    __asm__ volatile("push %0; popfq" : : "r" (rflags) : "cc");
+}
+
+/*
+ * Allocates a task structure
+ * Its XSAVE area needs to be 64-byte aligned
+ */
+task_t* mtask_alloc_task(void){
+    uint64_t raw = (uint64_t)calloc(sizeof(task_t) + 64, 1);
+    uint64_t xstate_offs = __builtin_offsetof(task_t, state.xstate);
+    return (task_t*)(raw + ((64 - ((raw + xstate_offs) % 64)) % 64));
 }
 
 /*
  * Initializes the multitasking system
  */
 void mtask_init(void){
-    //Allocate a buffer for the task list
-    mtask_task_list = (task_t*)malloc((MTASK_TASK_COUNT * sizeof(task_t)) + 16);
-    //Clear it
-    memset(mtask_task_list, 0, (MTASK_TASK_COUNT * sizeof(task_t)) + 16);
-    //It needs to be 16-byte aligned
-    mtask_task_list = (task_t*)((uint64_t)mtask_task_list + (uint64_t)(16 - ((uint64_t)mtask_task_list % 16)));
+    //Allocate the task table
+    mtask_task_cap = MTASK_TASK_TABLE_INIT;
+    mtask_task_list = (task_t**)calloc(mtask_task_cap, sizeof(task_t*));
     
+    mtask_task_cnt = 0;
+    mtask_free_slot = MTASK_SLOT_NONE;
+    mtask_zombie_slot = MTASK_SLOT_NONE;
+    mtask_free_stacks = NULL;
+    mtask_reaper = NULL;
+    mtask_idle = NULL;
+    mtask_resched = 0;
+    mtask_dl_cnt = 0;
     mtask_cur_task_no = 0;
-    mtask_next_task = 0;
-    mtask_next_uid = 0;
-    mtask_enabled = 0;
-    //Initialize the scheduling timer
+    mtask_set_cur_task(NULL);
+    percpu_get()->mtask_enabled = 0;
+    //Initialize the scheduling timer and the kernel timers
     timr_init();
+    ktimer_init_wheel();
 }
 
 /*
  * Gets an UID of the currently running task
  */
 uint64_t mtask_get_uid(void){
-    return mtask_task_list[mtask_cur_task_no].uid;
+    return mtask_cur_task->uid;
+}
+
+/*
+ * Returns the task with a certain UID or NULL if it doesn't exist (anymore)
+ */
+task_t* mtask_get_task(uint64_t uid){
+    uint32_t slot = MTASK_UID_SLOT(uid);
+    if(slot >= mtask_task_cnt)
+        return NULL;
+    task_t* task = mtask_task_list[slot];
+    //A stale UID refers to an older generation of the slot
+    if(!task->valid || task->uid != uid)
+        return NULL;
+    return task;
 }
 
 /*
- * Returns the task list
+ * Returns the task table
+ * Slots [0; mtask_get_task_cnt()) are allocated, but not necessarily valid
  */
-task_t* mtask_get_task_list(void){
+task_t** mtask_get_task_list(void){
     return mtask_task_list;
 }
 
+/*
+ * Returns the amount of allocated task table slots
+ */
+uint32_t mtask_get_task_cnt(void){
+    return mtask_task_cnt;
+}
+
 /*
  * Stops the scheduler, effectively freezing the system
  */
 void mtask_stop(void){
-    mtask_enabled = 0;
+    percpu_get()->mtask_enabled = 0;
     timr_stop();
 }
 
 /*
- * Creates a task
+ * Takes a slot from the free list or allocates a new one, growing the table if needed
+ * Must be called with interrupts disabled
+ */
+task_t* mtask_take_slot(void){
+    //Reuse a free slot if there is one
+    if(mtask_free_slot != MTASK_SLOT_NONE){
+        task_t* task = mtask_task_list[mtask_free_slot];
+        mtask_free_slot = task->next_free;
+        task->generation++;
+        return task;
+    }
+    //Grow the table if it's full
+    if(mtask_task_cnt == mtask_task_cap){
+        task_t** new_list = (task_t**)calloc(mtask_task_cap * 2, sizeof(task_t*));
+        memcpy(new_list, mtask_task_list, mtask_task_cap * sizeof(task_t*));
+        free(mtask_task_list);
+        mtask_task_list = new_list;
+        mtask_task_cap *= 2;
+    }
+    //Allocate a new slot
+    task_t* task = mtask_alloc_task();
+    task->slot = mtask_task_cnt;
+    task->generation = 0;
+    mtask_task_list[mtask_task_cnt++] = task;
+    return task;
+}
+
+/*
+ * Puts the slot of a stopped task into the free list
+ * Must be called with interrupts disabled
+ */
+void mtask_release_slot(task_t* task){
+    task->next_free = mtask_free_slot;
+    mtask_free_slot = task->slot;
+}
+
+/*
+ * Allocates a task stack, reusing one of a reaped task if possible
+ * Returns the actual size through *size
+ */
+void* mtask_alloc_stack(uint64_t* size){
+    uint64_t rflags = mtask_crit_enter();
+    //Find the first stack that's large enough
+    mtask_stack_t** link = &mtask_free_stacks;
+    while(*link != NULL){
+        mtask_stack_t* stack = *link;
+        if(stack->size >= *size){
+            *link = stack->next;
+            mtask_crit_leave(rflags);
+            *size = stack->size;
+            return memset(stack, 0, stack->size);
+        }
+        link = &stack->next;
+    }
+    mtask_crit_leave(rflags);
+    //Allocate a new one
+    return calloc(*size, 1);
+}
+
+/*
+ * Frees the resources of zombie tasks
+ */
+void mtask_reaper_task(void* args){
+    while(1){
+        //Take the zombie list
+        uint64_t rflags = mtask_crit_enter();
+        uint32_t slot = mtask_zombie_slot;
+        mtask_zombie_slot = MTASK_SLOT_NONE;
+        mtask_crit_leave(rflags);
+
+        while(slot != MTASK_SLOT_NONE){
+            task_t* task = mtask_task_list[slot];
+            slot = task->next_free;
+            //Have its windows closed
+            gui_close_task_windows(task->uid);
+            //Free its IPC pages and close its channels
+            ipc_task_cleanup(task);
+            //Free its page tables
+            vmem_free_pml4(task->state.cr3);
+            //Recycle the pages of its program
+            elf_task_cleanup(task);
+            //Free its stack
+            rflags = mtask_crit_enter();
+            mtask_stack_t* stack = (mtask_stack_t*)task->stack_base;
+            stack->size = task->stack_size;
+            stack->next = mtask_free_stacks;
+            mtask_free_stacks = stack;
+            //Finally, the slot can be reused
+            mtask_release_slot(task);
+            mtask_crit_leave(rflags);
+        }
+
+        //Wait for more zombies
+        mtask_wait();
+    }
+}
+
+/*
+ * Runs when there's nothing else to run
+ */
+void mtask_idle_task(void* args){
+    uint32_t ecx;
+    cpuid_get_feat(NULL, &ecx);
+    uint8_t use_mwait = (ecx & CPUID_FEAT_ECX_MONITOR) > 0;
+    //MWAIT has to be able to treat disabled interrupts as break events (leaf 5 ECX[1]),
+    //  otherwise HLT is used
+    uint32_t max;
+    cpuid_get_leaf(0, 0, &max, NULL, NULL, NULL);
+    if(use_mwait && max >= 5){
+        cpuid_get_leaf(5, 0, NULL, NULL, &ecx, NULL);
+        use_mwait = (ecx & CPUID_FEAT_5_ECX_EMX) && (ecx & CPUID_FEAT_5_ECX_IBE);
+    } else {
+        use_mwait = 0;
+    }
+    while(1){
+        //Interrupts are disabled while checking the flag so that a wake-up
+        //  can't slip in between the check and the halt
+        __asm__ volatile("cli");
+        if(use_mwait){
+            __asm__ volatile("monitor" : : "a" (&mtask_resched), "c" (0), "d" (0));
+            //ECX bit 0: wake up on interrupts even though they're disabled
+            if(!mtask_resched)
+                __asm__ volatile("mwait" : : "a" (0), "c" (1));
+            __asm__ volatile("sti");
+        } else if(!mtask_resched) {
+            //STI only takes effect after the next instruction
+            __asm__ volatile("sti; hlt");
+        } else {
+            __asm__ volatile("sti");
+        }
+        mtask_resched = 0;
+        //Let the scheduler see if something became runnable
+        mtask_yield();
+    }
+}
+
+/*
+ * Turns a task into a zombie and hands it over to the reaper
+ * Must be called with interrupts disabled
+ */
+void mtask_make_zombie(task_t* task){
+    if(task->sched_class == MTASK_SCHED_DEADLINE)
+        mtask_dl_cnt--;
+    task->valid = 0;
+    task->state_code = TASK_STATE_ZOMBIE;
+    task->next_free = mtask_zombie_slot;
+    mtask_zombie_slot = task->slot;
+    mtask_wake(mtask_reaper);
+}
+
+/*
+ * Creates a normal class task
  * If it's the first task ever created, starts multitasking
  * Returns the UID
  */
 uint64_t mtask_create_task(uint64_t stack_size, char* name, uint8_t priority, void(*func)(void*), void* args){
-    task_t* task = &mtask_task_list[mtask_next_task];
+    return mtask_create_task_sched(stack_size, name, priority, NULL, func, args);
+}
+
+/*
+ * Creates a task with specific scheduling parameters (normal class if NULL)
+ * If it's the first task ever created, starts multitasking
+ * Returns the UID
+ */
+uint64_t mtask_create_task_sched(uint64_t stack_size, char* name, uint8_t priority, mtask_sched_t* sched,
+                                 void(*func)(void*), void* args){
+    //Grab a slot
+    uint64_t rflags = mtask_crit_enter();
+    task_t* task = mtask_take_slot();
+    mtask_crit_leave(rflags);
     //Clear the task registers (except for RCX, set it to the argument pointer)
     task->state = (task_state_t){0, 0, (uint64_t)args, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     //Asign an UID
-    task->uid = mtask_next_uid++;
+    task->uid = MTASK_UID(task->slot, task->generation);
     //Assign the priority
     task->priority = priority;
     task->prio_cnt = task->priority;
@@ -91,34 +353,73 @@ uint64_t mtask_create_task(uint64_t stack_size, char* name, uint8_t priority, vo
     uint64_t cr3 = vmem_create_pml4(task->uid);
     task->state.cr3 = cr3;
     //Allocate memory for the task stack
-    void* task_stack = calloc(stack_size, 1);
+    void* task_stack = mtask_alloc_stack(&stack_size);
+    task->stack_base = task_stack;
+    task->stack_size = stack_size;
     //Map the memory
-    vmem_map(cr3, 0, (phys_addr_t)(8ULL * 1024 * 1024 * 1024), 0);
-    //Set the framebuffer memory type as write-combining
-    vmem_pat_set_range(cr3, gfx_buf_another(), gfx_buf_another() + (gfx_res_x() * gfx_res_y()), 1);
-    //Assign the task RSP
-    task->state.rsp = (uint64_t)((uint8_t*)task_stack + stack_size - 6);
+    vmem_map(cr3, 0, (phys_addr_t)VMEM_IDENTITY_END, 0, VMEM_PAGE_WRITE);
+    //Set the memory types of the framebuffer and device memory
+    vmem_apply_types(cr3);
+    //Assign the task RSP, leaving space for the return address and the
+    //  register parameter area the calling convention requires
+    uint64_t stack_top = ((uint64_t)task_stack + stack_size) & ~0xFULL;
+    task->state.rsp = stack_top - 40;
+    //If the task function returns, it will return to the exit trampoline
+    *(uint64_t*)task->state.rsp = (uint64_t)mtask_exit_tramp;
     //Assign the task RIP
     task->state.rip = (uint64_t)func;
     //Assign the task and RFLAGS
-    uint64_t rflags;
-    __asm__ volatile("pushfq; pop %0" : "=m" (rflags));
-    task->state.rflags = rflags;
+    uint64_t task_rflags;
+    __asm__ volatile("pushfq; pop %0" : "=m" (task_rflags));
+    task->state.rflags = task_rflags;
     //Reset some vars
-    task->valid = 1;
     task->state_code = TASK_STATE_RUNNING;
     task->blocked_till = 0;
+    task->cpu_time = 0;
+    task->wait_time = 0;
+    task->sw_voluntary = 0;
+    task->sw_involuntary = 0;
+    task->yielding = 0;
+    task->wake_pending = 0;
+    task->fibers = NULL;
+    task->ipc_window_next = IPC_WINDOW_BASE;
+    task->ipc_ranges = NULL;
+    task->user = 0;
+    task->elf = NULL;
+    task->elf_pages = NULL;
+    task->run_start = task->ready_since = rdtsc();
+    //Set the scheduling class
+    task->sched_class = MTASK_SCHED_NORMAL;
+    if(sched != NULL && sched->sched_class == MTASK_SCHED_DEADLINE){
+        task->dl_runtime = timr_us_to_tsc(sched->runtime_us);
+        task->dl_period = timr_us_to_tsc(sched->period_us);
+        //The first period starts right away
+        task->dl_deadline = task->run_start + task->dl_period;
+        task->dl_budget = task->dl_runtime;
+        task->dl_charged_at = task->run_start;
+    }
+    //The task may only be scheduled once it's fully set up
+    rflags = mtask_crit_enter();
+    if(sched != NULL && sched->sched_class == MTASK_SCHED_DEADLINE){
+        task->sched_class = MTASK_SCHED_DEADLINE;
+        mtask_dl_cnt++;
+    }
+    task->valid = 1;
+    mtask_crit_leave(rflags);
 
     //Check if it's the first task ever created
-    if(mtask_next_task++ == 0){
+    if(mtask_cur_task == NULL){
         //Assign the current task
-        mtask_cur_task = task;
-        mtask_cur_task_no = 0;
-        //Call the switcher
-        //It should switch to the newly created task
+        mtask_set_cur_task(task);
+        mtask_cur_task_no = task->slot;
         __asm__ volatile("cli");
-        mtask_enabled = 1;
         vmem_init();
+        //Create the reaper and the idle task
+        mtask_reaper = mtask_get_task(mtask_create_task(8192, "Reaper", 1, mtask_reaper_task, NULL));
+        mtask_idle = mtask_get_task(mtask_create_task(8192, "Idle", 0, mtask_idle_task, NULL));
+        //Call the switcher
+        //It should switch to the newly created task
+        percpu_get()->mtask_enabled = 1;
         __asm__ volatile("jmp mtask_restore_state");
     }
 
@@ -129,47 +430,247 @@ uint64_t mtask_create_task(uint64_t stack_size, char* name, uint8_t priority, vo
  * Destroys the task with a certain UID
  */
 void mtask_stop_task(uint64_t uid){
-    //Find the task and destoy it
-    for(uint32_t i = 0; i < MTASK_TASK_COUNT; i++)
-        if(mtask_task_list[i].uid == uid)
-            mtask_task_list[i].valid = 0;
-    //Hang if we're terminating the current task
-    if(uid == mtask_get_uid())
-        while(1);
+    uint64_t rflags = mtask_crit_enter();
+    //Find the task in O(1) using its UID
+    task_t* task = mtask_get_task(uid);
+    if(task == NULL){
+        mtask_crit_leave(rflags);
+        return;
+    }
+    //If we're terminating the current task, it will never return from here
+    if(task == mtask_cur_task){
+        mtask_crit_leave(rflags);
+        mtask_exit();
+    }
+    //Leave the rest to the reaper
+    mtask_make_zombie(task);
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Switches the current task into user mode
+ * From now on, its stack is only used by the kernel on interrupts and system calls
+ */
+void mtask_enter_user(uint64_t entry, uint64_t user_rsp, uint64_t arg){
+    __asm__ volatile("cli");
+    mtask_cur_task->user = 1;
+    mtask_set_kstack(mtask_cur_task);
+    mtask_iret_user(entry, user_rsp, arg);
+}
+
+/*
+ * Terminates the current task
+ * (task functions that return end up here too)
+ */
+void mtask_exit(void){
+    __asm__ volatile("cli");
+    mtask_make_zombie(mtask_cur_task);
+    //Switch away from this task forever
+    while(1)
+        mtask_yield();
+}
+
+/*
+ * Unblocks a task if its block has ended
+ * Otherwise, updates the nearest moment a task has to be woken up at
+ */
+void mtask_check_block(task_t* task, uint64_t now, uint64_t* next_wakeup){
+    if(task->state_code == TASK_STATE_BlOCKED_CYCLES ||
+       (task->state_code == TASK_STATE_BLOCKED_WAIT && task->blocked_till)){
+        if(now >= task->blocked_till){
+            task->state_code = TASK_STATE_RUNNING;
+            //The task has been ready since its block ended
+            task->ready_since = task->blocked_till;
+            task->blocked_till = 0;
+            trace_rec(TRACE_EVT_WAKE, task->slot, 0);
+        } else if(task->valid && (*next_wakeup == 0 || task->blocked_till < *next_wakeup)) {
+            *next_wakeup = task->blocked_till;
+        }
+    }
+}
+
+/*
+ * Picks the runnable deadline class task with the earliest deadline
+ *   that has budget left (or NULL if there's none)
+ */
+task_t* mtask_pick_dl(uint64_t now, uint64_t* next_wakeup){
+    task_t* best = NULL;
+    for(uint32_t i = 0; i < mtask_task_cnt; i++){
+        task_t* task = mtask_task_list[i];
+        if(!task->valid || task->sched_class != MTASK_SCHED_DEADLINE)
+            continue;
+        //Start a new period if the current one is over
+        if(now >= task->dl_deadline){
+            //Keep the periods aligned unless we've fallen behind more than one
+            if(now - task->dl_deadline < task->dl_period)
+                task->dl_deadline += task->dl_period;
+            else
+                task->dl_deadline = now + task->dl_period;
+            task->dl_budget = task->dl_runtime;
+        }
+        mtask_check_block(task, now, next_wakeup);
+        if(task->state_code != TASK_STATE_RUNNING)
+            continue;
+        if(task->dl_budget == 0){
+            //Throttled till the next period
+            if(*next_wakeup == 0 || task->dl_deadline < *next_wakeup)
+                *next_wakeup = task->dl_deadline;
+            continue;
+        }
+        if(best == NULL || task->dl_deadline < best->dl_deadline)
+            best = task;
+    }
+    return best;
 }
 
 /*
  * Chooses the next task to be run
  */
 void mtask_schedule(void){
-    //If the currently running task still has time available
-    if(mtask_cur_task->prio_cnt > 0) {
-        //Decrease its available time
-        mtask_cur_task->prio_cnt--;
+    task_t* prev_task = mtask_cur_task;
+    //Run the kernel timers that are due
+    ktimer_run(clock_monotonic_ns());
+    uint64_t now = rdtsc();
+    //The nearest moment a blocked task has to be woken up at
+    uint64_t next_wakeup = 0;
+    //Charge the deadline class task for the time it has been running
+    if(prev_task->sched_class == MTASK_SCHED_DEADLINE){
+        uint64_t used = now - prev_task->dl_charged_at;
+        prev_task->dl_budget = (used >= prev_task->dl_budget) ? 0 : (prev_task->dl_budget - used);
+        prev_task->dl_charged_at = now;
+    }
+    //Deadline class tasks with budget left go first
+    task_t* dl_task = (mtask_dl_cnt > 0) ? mtask_pick_dl(now, &next_wakeup) : NULL;
+
+    if(dl_task != NULL){
+        mtask_cur_task_no = dl_task->slot;
+    } else if(prev_task->sched_class == MTASK_SCHED_NORMAL && prev_task->prio_cnt > 0 &&
+              prev_task->valid && !prev_task->yielding) {
+        //If the currently running task still has time available, decrease it
+        prev_task->prio_cnt--;
     } else {
         //If not, restore its time
-        mtask_cur_task->prio_cnt = mtask_cur_task->priority;
+        prev_task->prio_cnt = prev_task->priority;
         //Go find a new task
-        while(1){
+        uint8_t found = 0;
+        for(uint32_t i = 0; i < mtask_task_cnt; i++){
             //We scan through the task list to find a next task that's valid and not blocked
             mtask_cur_task_no++;
-            if(mtask_cur_task_no >= mtask_next_task)
+            if(mtask_cur_task_no >= mtask_task_cnt)
                 mtask_cur_task_no = 0;
 
+            task_t* task = mtask_task_list[mtask_cur_task_no];
+            //The idle task only runs when nothing else can,
+            //  deadline class tasks are handled separately
+            if(task == mtask_idle || task->sched_class != MTASK_SCHED_NORMAL)
+                continue;
             //Remove blocks on tasks that need to be unblocked
-            if(mtask_task_list[mtask_cur_task_no].state_code == TASK_STATE_BlOCKED_CYCLES){
-                if(rdtsc() >= mtask_task_list[mtask_cur_task_no].blocked_till){
-                    mtask_task_list[mtask_cur_task_no].state_code = TASK_STATE_RUNNING;
-                    mtask_task_list[mtask_cur_task_no].blocked_till = 0;
-                }
-            }
+            mtask_check_block(task, now, &next_wakeup);
 
-            if(mtask_task_list[mtask_cur_task_no].valid && (mtask_task_list[mtask_cur_task_no].state_code == TASK_STATE_RUNNING))
+            if(task->valid && (task->state_code == TASK_STATE_RUNNING)){
+                found = 1;
                 break;
+            }
+        }
+        if(!found){
+            //Everything is blocked, run the idle task
+            mtask_cur_task_no = mtask_idle->slot;
+        }
+    }
+
+    mtask_set_cur_task(mtask_task_list[mtask_cur_task_no]);
+    //Do the accounting if the task has changed
+    if(prev_task != mtask_cur_task){
+        prev_task->cpu_time += now - prev_task->run_start;
+        if(prev_task->yielding || !prev_task->valid || prev_task->state_code != TASK_STATE_RUNNING){
+            prev_task->sw_voluntary++;
+        } else {
+            prev_task->sw_involuntary++;
+            //It's still ready to run
+            prev_task->ready_since = now;
         }
+        mtask_cur_task->wait_time += now - mtask_cur_task->ready_since;
+        mtask_cur_task->run_start = now;
+        mtask_cur_task->dl_charged_at = now;
+        //Interrupts in user mode switch to the kernel stack of the task
+        if(mtask_cur_task->user)
+            mtask_set_kstack(mtask_cur_task);
+        trace_rec(TRACE_EVT_SWITCH, mtask_cur_task->slot, prev_task->slot);
     }
+    prev_task->yielding = 0;
 
-    mtask_cur_task = &mtask_task_list[mtask_cur_task_no];
+    //Arm the timer for the nearest event: the end of the time slice
+    //  (there's no ticking while idle), the end of the deadline budget,
+    //  the nearest block to end or the nearest kernel timer
+    uint64_t next_evt = (mtask_cur_task == mtask_idle) ? 0 : (now + timr_tick_cycles());
+    if(mtask_cur_task->sched_class == MTASK_SCHED_DEADLINE && now + mtask_cur_task->dl_budget < next_evt)
+        next_evt = now + mtask_cur_task->dl_budget;
+    if(next_wakeup != 0 && (next_evt == 0 || next_wakeup < next_evt))
+        next_evt = next_wakeup;
+    uint64_t ktimer_evt = ktimer_next();
+    if(ktimer_evt != 0){
+        ktimer_evt = clock_monotonic_to_tsc(ktimer_evt);
+        if(next_evt == 0 || ktimer_evt < next_evt)
+            next_evt = ktimer_evt;
+    }
+    timr_arm(next_evt);
+}
+
+/*
+ * Gives up the rest of the current task's time slice
+ */
+void mtask_yield(void){
+    mtask_cur_task->yielding = 1;
+    //Invoke the scheduler through the timer interrupt vector
+    __asm__ volatile("int $32");
+}
+
+/*
+ * Blocks the current task until mtask_wake() is called on it
+ * Returns immediately if it has been called since the last wait
+ */
+void mtask_wait(void){
+    mtask_wait_till(0);
+}
+
+/*
+ * Blocks the current task until mtask_wake() is called on it
+ *   or until the TSC reaches a certain value (0 means no timeout)
+ * Returns immediately if mtask_wake() has been called since the last wait
+ */
+void mtask_wait_till(uint64_t tsc){
+    uint64_t rflags = mtask_crit_enter();
+    if(mtask_cur_task->wake_pending){
+        mtask_cur_task->wake_pending = 0;
+        mtask_crit_leave(rflags);
+        return;
+    }
+    mtask_cur_task->blocked_till = tsc;
+    mtask_cur_task->state_code = TASK_STATE_BLOCKED_WAIT;
+    trace_rec(TRACE_EVT_BLOCK, mtask_cur_task->slot, 0);
+    mtask_crit_leave(rflags);
+    //The state will be reset by mtask_wake() or by the scheduler
+    while(mtask_cur_task->state_code != TASK_STATE_RUNNING)
+        mtask_yield();
+}
+
+/*
+ * Unblocks a task that called mtask_wait()
+ * Can be called from interrupt handlers
+ */
+void mtask_wake(task_t* task){
+    uint64_t rflags = mtask_crit_enter();
+    if(task->state_code == TASK_STATE_BLOCKED_WAIT){
+        task->state_code = TASK_STATE_RUNNING;
+        task->blocked_till = 0;
+        task->ready_since = rdtsc();
+        mtask_resched = 1;
+        trace_rec(TRACE_EVT_WAKE, task->slot, 0);
+    } else {
+        //Running or blocked for some other reason: the next wait returns immediately
+        task->wake_pending = 1;
+    }
+    mtask_crit_leave(rflags);
 }
 
 /*
@@ -179,6 +680,32 @@ void mtask_dly_cycles(uint64_t cycles){
     //Set the block
     mtask_cur_task->blocked_till = rdtsc() + cycles;
     mtask_cur_task->state_code = TASK_STATE_BlOCKED_CYCLES;
-    //This variable will be set by the scheduler
-    while(mtask_cur_task->state_code != TASK_STATE_RUNNING);
-}
\ No newline at end of file
+    trace_rec(TRACE_EVT_BLOCK, mtask_cur_task->slot, 0);
+    //Let other tasks run while we're waiting
+    //The state will be reset by the scheduler
+    while(mtask_cur_task->state_code != TASK_STATE_RUNNING)
+        mtask_yield();
+}
+
+/*
+ * Reads CPU time and context switch statistics of a task
+ * Returns 0 if there's no task with such UID
+ */
+uint8_t mtask_get_stats(uint64_t uid, task_stats_t* stats){
+    uint64_t rflags = mtask_crit_enter();
+    task_t* task = mtask_get_task(uid);
+    if(task == NULL){
+        mtask_crit_leave(rflags);
+        return 0;
+    }
+    stats->tsc = rdtsc();
+    stats->cpu_time = task->cpu_time;
+    stats->wait_time = task->wait_time;
+    //Account for the time the current task has been running since the last switch
+    if(task == mtask_cur_task)
+        stats->cpu_time += stats->tsc - task->run_start;
+    stats->sw_voluntary = task->sw_voluntary;
+    stats->sw_involuntary = task->sw_involuntary;
+    mtask_crit_leave(rflags);
+    return 1;
+}
@@ -7,7 +7,7 @@ typedef struct {
     uint64_t rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp;
     uint64_t r8,  r9,  r10, r11, r12, r13, r14, r15;
     uint64_t cr3, rip, rflags, switch_cnt;
-    uint8_t align[16];
+    uint64_t cs, ss;
     uint8_t xstate[1024];
 } __attribute__((packed)) task_state_t;
 
@@ -23,26 +23,128 @@ typedef struct {
     volatile uint8_t state_code;
     uint64_t blocked_till;
 
-    uint8_t padding[60];
+    //Task table slot this task occupies
+    uint32_t slot;
+    //Generation of that slot (incremented every time it's reused)
+    uint32_t generation;
+    //Next slot in the free slot list or in the zombie list
+    uint32_t next_free;
+
+    //CPU time used by the task (TSC cycles)
+    uint64_t cpu_time;
+    //TSC value at the moment the task was last switched to
+    uint64_t run_start;
+    //TSC value at the moment the task became ready to run
+    uint64_t ready_since;
+    //Total time spent waiting in the run queue (TSC cycles)
+    uint64_t wait_time;
+    //Context switches caused by the task giving up the CPU
+    uint64_t sw_voluntary;
+    //Context switches caused by the task running out of time
+    uint64_t sw_involuntary;
+    //Set by mtask_yield()
+    volatile uint8_t yielding;
+    //Set by mtask_wake() if the task wasn't waiting at that moment
+    volatile uint8_t wake_pending;
+
+    //Task stack
+    void* stack_base;
+    uint64_t stack_size;
+
+    //Scheduling class
+    uint8_t sched_class;
+    //Deadline class: runtime budget and period (TSC cycles)
+    uint64_t dl_runtime;
+    uint64_t dl_period;
+    //Deadline class: end of the current period and the budget left in it
+    uint64_t dl_deadline;
+    uint64_t dl_budget;
+    //Deadline class: TSC value the budget was last charged at
+    uint64_t dl_charged_at;
+
+    //Fiber scheduler running in the task (see fiber.h)
+    void* fibers;
+    //Next free address in the IPC window (see ipc.h)
+    uint64_t ipc_window_next;
+    //Free ranges of the IPC window below ipc_window_next
+    void* ipc_ranges;
+    //Set once the task has entered user mode
+    //  (its stack then serves as the kernel stack)
+    uint8_t user;
+    //The program the task runs (see elf.h)
+    void* elf;
+    //Private pages of the program (freed when the task exits)
+    void* elf_pages;
 } __attribute__((packed)) task_t;
 
-#define MTASK_TASK_COUNT                    32
+//Scheduling parameters passed to mtask_create_task_sched()
+typedef struct {
+    uint8_t sched_class;
+    //Deadline class: the task is guaranteed to run for runtime_us every period_us
+    uint64_t runtime_us;
+    uint64_t period_us;
+} mtask_sched_t;
+
+//Task statistics returned by mtask_get_stats()
+typedef struct {
+    uint64_t cpu_time;
+    uint64_t wait_time;
+    uint64_t sw_voluntary;
+    uint64_t sw_involuntary;
+    uint64_t tsc;
+} task_stats_t;
+
+//Initial size of the task table (it grows as needed)
+#define MTASK_TASK_TABLE_INIT               32
+//Marks the end of the free slot list
+#define MTASK_SLOT_NONE                     0xFFFFFFFF
+
+//UIDs are generation-indexed handles: the lower half is the
+//  task table slot, the upper half is the slot generation
+#define MTASK_UID(SLOT, GEN)                (((uint64_t)(GEN) << 32) | (SLOT))
+#define MTASK_UID_SLOT(UID)                 ((uint32_t)((UID) & 0xFFFFFFFF))
 
 #define TASK_STATE_RUNNING                  0
 #define TASK_STATE_BlOCKED_CYCLES           1
 #define TASK_STATE_BLOCKED_MS               2
+#define TASK_STATE_BLOCKED_WAIT             3
+#define TASK_STATE_ZOMBIE                   4
+
+//Scheduling classes
 
+//Round-robin, time slice defined by the priority
+#define MTASK_SCHED_NORMAL                  0
+//Runtime budget per period, earliest deadline first
+//Preempts normal tasks while it has budget left
+#define MTASK_SCHED_DEADLINE                1
+
+uint64_t mtask_crit_enter(void);
+void mtask_crit_leave(uint64_t rflags);
+
+uint64_t mtask_is_enabled(void);
 void mtask_init(void);
 void mtask_stop(void);
 uint64_t mtask_create_task(uint64_t stack_size, char* name, uint8_t priority, void(*func)(void*), void* args);
+uint64_t mtask_create_task_sched(uint64_t stack_size, char* name, uint8_t priority, mtask_sched_t* sched,
+                                 void(*func)(void*), void* args);
 void mtask_stop_task(uint64_t uid);
+void mtask_exit(void) __attribute__((noreturn));
+void mtask_enter_user(uint64_t entry, uint64_t user_rsp, uint64_t arg) __attribute__((noreturn));
 uint64_t mtask_get_uid(void);
-task_t* mtask_get_task_list(void);
+task_t* mtask_get_task(uint64_t uid);
+task_t** mtask_get_task_list(void);
+uint32_t mtask_get_task_cnt(void);
 
 void mtask_save_state(void);
 void mtask_restore_state(void);
 void mtask_schedule(void);
 
+void mtask_yield(void);
+void mtask_wait(void);
+void mtask_wait_till(uint64_t tsc);
+void mtask_wake(task_t* task);
 void mtask_dly_cycles(uint64_t cycles);
 
-#endif
\ No newline at end of file
+uint8_t mtask_get_stats(uint64_t uid, task_stats_t* stats);
+
+#endif
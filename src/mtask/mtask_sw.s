@@ -1,12 +1,12 @@
 .intel_syntax noprefix
-.globl   mtask_save_state, mtask_restore_state
+.globl   mtask_save_state, mtask_restore_state, mtask_exit_tramp, mtask_iret_user
 .align   8
 
 mtask_save_state:
     ;//Save RAX
     push rax
     ;//Load the current task pointer into RAX
-    call mtask_get_cur_task
+    mov rax, gs:[8]
     ;//Store RAX
     pop [rax+  0]
     ;//Store the rest of GPRs
@@ -34,6 +34,11 @@ mtask_save_state:
     mov [rax+136], r9
     mov [rax+144], r10
     mov [rax+ 56], r11
+    ;//Store the segments
+    mov r8,  [rsp+16] ;//CS
+    mov r9,  [rsp+40] ;//SS
+    mov [rax+160], r8
+    mov [rax+168], r9
     ;//Save MM, XMM-ZMM and ST registers
     xchg rax, rbx
     mov edx, 0xFFFFFFFF
@@ -46,7 +51,10 @@ mtask_save_state:
 
 mtask_restore_state:
     ;//Load the current task pointer into RAX
-    call mtask_get_cur_task
+    mov rax, gs:[8]
+    ;//Returning to user mode is done differently
+    test qword ptr [rax+160], 3
+    jnz mtask_restore_user
     ;//Load RSP
     mov rsp, [rax+ 56]
     ;//Load non-GPRs
@@ -89,3 +97,80 @@ mtask_restore_state:
     sti
     ;//Load RIP
     ret
+
+mtask_exit_tramp:
+    ;//Task functions return here
+    ;//Reserve the register parameter area and terminate the task
+    sub rsp, 32
+    call mtask_exit
+
+mtask_restore_user:
+    ;//Build an IRET frame at the top of the kernel stack of the task
+    mov rsp, gs:[24]
+    push qword ptr [rax+168] ;//SS
+    push qword ptr [rax+ 56] ;//RSP
+    push qword ptr [rax+144] ;//RFLAGS
+    push qword ptr [rax+160] ;//CS
+    push qword ptr [rax+136] ;//RIP
+    ;//Interrupts are always enabled in user mode
+    or qword ptr [rsp+16], 0x200
+    ;//Load CR3
+    mov rbx, [rax+128]
+    mov cr3, rbx
+    ;//Load MM, XMM-ZMM and ST registers
+    xchg rax, rbx
+    mov edx, 0xFFFFFFFF
+    mov eax, 0xFFFFFFFF
+    xrstor [rbx+176]
+    xchg rax, rbx
+    ;//Load GPRs
+    mov rbx, [rax+  8]
+    mov rcx, [rax+ 16]
+    mov rdx, [rax+ 24]
+    mov rsi, [rax+ 32]
+    mov rdi, [rax+ 40]
+    mov rbp, [rax+ 48]
+    mov r8,  [rax+ 64]
+    mov r9,  [rax+ 72]
+    mov r10, [rax+ 80]
+    mov r11, [rax+ 88]
+    mov r12, [rax+ 96]
+    mov r13, [rax+104]
+    mov r14, [rax+112]
+    ;//Send EOI
+    mov r15, 0xFEE000B0
+    mov dword ptr [r15], 0
+    ;//Load R15
+    mov r15, [rax+120]
+    ;//Load RAX
+    mov rax, [rax+  0]
+    ;//Switch to the user GS base
+    swapgs
+    iretq
+
+mtask_iret_user:
+    ;//Enters user mode for the first time
+    ;//RCX = entry point, RDX = user stack, R8 = argument (passed in RCX)
+    push 0x1B ;//SS (user data, RPL 3)
+    push rdx  ;//RSP
+    push 0x202 ;//RFLAGS (IF)
+    push 0x23 ;//CS (user code, RPL 3)
+    push rcx  ;//RIP
+    mov rcx, r8
+    ;//Don't leak kernel data
+    xor eax, eax
+    xor ebx, ebx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    xor r11d, r11d
+    xor r12d, r12d
+    xor r13d, r13d
+    xor r14d, r14d
+    xor r15d, r15d
+    swapgs
+    iretq
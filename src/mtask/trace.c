@@ -0,0 +1,181 @@
+//Neutron Project
+//Scheduler event tracing
+//Events are recorded into a ring buffer and drained as text lines
+//  through the debug port and/or the serial port;
+//  traceconv/traceconv.py turns the stream into Chrome trace JSON
+
+#include "./trace.h"
+#include "./mtask.h"
+#include "../stdlib.h"
+#include "../drivers/serial.h"
+#include "../drivers/clock.h"
+
+//The event ring buffer
+trace_evt_t* trace_buf = NULL;
+//Total amount of events written and drained
+volatile uint64_t trace_head = 0;
+volatile uint64_t trace_tail = 0;
+//Is tracing on?
+volatile uint8_t trace_enabled = 0;
+//Output channels
+uint8_t trace_outputs = 0;
+//UID of the drain task
+uint64_t trace_drain_uid;
+
+/*
+ * Records an event
+ */
+void trace_rec(uint8_t type, uint32_t arg, uint32_t arg2){
+    if(!trace_enabled)
+        return;
+    uint64_t rflags = mtask_crit_enter();
+    //If the buffer is full, the oldest event is overwritten
+    if(trace_head - trace_tail >= TRACE_BUF_SIZE)
+        trace_tail++;
+    trace_evt_t* evt = &trace_buf[trace_head & (TRACE_BUF_SIZE - 1)];
+    evt->tsc = rdtsc();
+    evt->arg = arg;
+    evt->arg2 = arg2;
+    evt->type = type;
+    trace_head++;
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Records an ISR entry
+ * (called by the ISR wrappers)
+ */
+void trace_isr_enter(uint64_t vector){
+    trace_rec(TRACE_EVT_ISR_ENTER, vector, 0);
+}
+
+/*
+ * Records an ISR exit
+ * (called by the ISR wrappers)
+ */
+void trace_isr_exit(uint64_t vector){
+    trace_rec(TRACE_EVT_ISR_EXIT, vector, 0);
+}
+
+/*
+ * Sends a line to the selected outputs
+ */
+void trace_out(char* str){
+    if(trace_outputs & TRACE_OUT_E9)
+        puts_e9(str);
+    if(trace_outputs & TRACE_OUT_SERIAL)
+        serial_puts(SERIAL_COM1, str);
+}
+
+/*
+ * Sends the names of all tasks
+ */
+void trace_out_names(void){
+    char temp[128];
+    char temp2[20];
+    char name[sizeof(((task_t*)0)->name)];
+    for(uint32_t i = 0; ; i++){
+        //The task table can be reallocated, copy the name out of it
+        uint64_t rflags = mtask_crit_enter();
+        if(i >= mtask_get_task_cnt()){
+            mtask_crit_leave(rflags);
+            break;
+        }
+        task_t* task = mtask_get_task_list()[i];
+        uint8_t valid = task->valid;
+        memcpy(name, task->name, sizeof(name));
+        mtask_crit_leave(rflags);
+        name[sizeof(name) - 1] = 0;
+        if(!valid)
+            continue;
+        temp[0] = 0;
+        strcat(temp, "N ");
+        strcat(temp, sprintub16(temp2, i, 1));
+        strcat(temp, " ");
+        strcat(temp, name);
+        strcat(temp, "\n");
+        trace_out(temp);
+    }
+}
+
+/*
+ * Sends all events recorded so far
+ * Line format: "E <type> <TSC> <arg> <arg2>", all numbers are hexadecimal
+ */
+void trace_drain(void){
+    char temp[80];
+    char temp2[20];
+    //Send task names first, so that the events can be attributed
+    trace_out_names();
+    while(1){
+        //Fetch an event
+        uint64_t rflags = mtask_crit_enter();
+        if(trace_tail == trace_head){
+            mtask_crit_leave(rflags);
+            break;
+        }
+        trace_evt_t evt = trace_buf[trace_tail & (TRACE_BUF_SIZE - 1)];
+        trace_tail++;
+        mtask_crit_leave(rflags);
+        //Print it
+        temp[0] = 0;
+        strcat(temp, "E ");
+        strcat(temp, sprintub16(temp2, evt.type, 1));
+        strcat(temp, " ");
+        strcat(temp, sprintub16(temp2, evt.tsc, 1));
+        strcat(temp, " ");
+        strcat(temp, sprintub16(temp2, evt.arg, 1));
+        strcat(temp, " ");
+        strcat(temp, sprintub16(temp2, evt.arg2, 1));
+        strcat(temp, "\n");
+        trace_out(temp);
+    }
+}
+
+/*
+ * The task that periodically drains the trace buffer
+ */
+void trace_drain_task(void* args){
+    while(1){
+        trace_drain();
+        mtask_dly_cycles(100000000);
+    }
+}
+
+/*
+ * Starts tracing
+ */
+void trace_start(uint8_t outputs){
+    if(trace_enabled)
+        return;
+    trace_outputs = outputs;
+    if(outputs & TRACE_OUT_SERIAL)
+        serial_init(SERIAL_COM1, 115200);
+    //Allocate the buffer
+    if(trace_buf == NULL)
+        trace_buf = (trace_evt_t*)calloc(TRACE_BUF_SIZE, sizeof(trace_evt_t));
+    trace_head = trace_tail = 0;
+    trace_out("H neutron-trace 1\n");
+    //Tell the converter how fast the TSC ticks
+    char temp[32];
+    char temp2[20];
+    temp[0] = 0;
+    strcat(temp, "F ");
+    strcat(temp, sprintub16(temp2, clock_tsc_hz(), 1));
+    strcat(temp, "\n");
+    trace_out(temp);
+    trace_enabled = 1;
+    //Create the drain task
+    trace_drain_uid = mtask_create_task(8192, "Trace drain", 1, trace_drain_task, NULL);
+}
+
+/*
+ * Stops tracing
+ */
+void trace_stop(void){
+    if(!trace_enabled)
+        return;
+    trace_enabled = 0;
+    mtask_stop_task(trace_drain_uid);
+    trace_drain();
+}
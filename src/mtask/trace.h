@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../stdlib.h"
+
+//Start tracing as soon as multitasking is up?
+//#define TRACE_ON_BOOT
+
+//Amount of events the trace buffer can hold (has to be a power of two)
+#define TRACE_BUF_SIZE                      8192
+
+//Event types
+
+#define TRACE_EVT_SWITCH                    1
+#define TRACE_EVT_WAKE                      2
+#define TRACE_EVT_BLOCK                     3
+#define TRACE_EVT_ISR_ENTER                 4
+#define TRACE_EVT_ISR_EXIT                  5
+
+//Output channels
+
+#define TRACE_OUT_E9                        (1 << 0)
+#define TRACE_OUT_SERIAL                    (1 << 1)
+
+//Trace event
+typedef struct {
+    //TSC value at the moment the event happened
+    uint64_t tsc;
+    //Switch: next task slot; wake, block: task slot; ISR: vector
+    uint32_t arg;
+    //Switch: previous task slot
+    uint32_t arg2;
+    //Event type
+    uint8_t type;
+    uint8_t reserved;
+} __attribute__((packed)) trace_evt_t;
+
+void trace_start(uint8_t outputs);
+void trace_stop(void);
+void trace_rec(uint8_t type, uint32_t arg, uint32_t arg2);
+void trace_isr_enter(uint64_t vector);
+void trace_isr_exit(uint64_t vector);
+void trace_drain(void);
+
+#endif
@@ -0,0 +1,164 @@
+//Neutron Project
+//Work queues
+//Interrupt handlers queue work items without taking any locks,
+//  worker tasks run them later in task context
+
+#include "./workq.h"
+#include "./mtask.h"
+#include "../stdlib.h"
+
+//Queue heads (items are pushed in LIFO order, workers reverse them)
+workq_item_t* volatile workq_heads[WORKQ_PRIO_CNT];
+//Worker tasks
+task_t* volatile workq_workers[WORKQ_PRIO_CNT];
+//Delayed items that haven't been seen by the timer task yet
+workq_item_t* volatile workq_delayed_new;
+//Delayed items sorted by deadline (owned by the timer task)
+workq_item_t* workq_delayed;
+//Delayed work timer task
+task_t* volatile workq_timer;
+
+//Scheduler time slices of the worker tasks
+const uint8_t workq_task_prio[WORKQ_PRIO_CNT] = {50, 10, 1};
+char* const workq_task_names[WORKQ_PRIO_CNT] = {"Worker (high)", "Worker (normal)", "Worker (low)"};
+
+/*
+ * Pushes an item onto a lock-free stack
+ */
+void workq_push(workq_item_t* volatile* head, workq_item_t* item){
+    workq_item_t* old = *head;
+    do {
+        item->next = old;
+    } while(!__atomic_compare_exchange_n(head, &old, item, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Takes all items from a lock-free stack in the order they were pushed
+ */
+workq_item_t* workq_take_all(workq_item_t* volatile* head){
+    workq_item_t* item = __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
+    //Reverse the list
+    workq_item_t* fifo = NULL;
+    while(item != NULL){
+        workq_item_t* next = item->next;
+        item->next = fifo;
+        fifo = item;
+        item = next;
+    }
+    return fifo;
+}
+
+/*
+ * Worker task, runs the items of one queue
+ */
+void workq_worker(void* args){
+    workq_item_t* volatile* head = (workq_item_t* volatile*)args;
+    while(1){
+        workq_item_t* item = workq_take_all(head);
+        while(item != NULL){
+            //Fetch everything before the item can be queued again
+            workq_item_t* next = item->next;
+            void(*func)(void*) = item->func;
+            void* func_args = item->args;
+            __atomic_store_n(&item->pending, 0, __ATOMIC_RELEASE);
+            func(func_args);
+            item = next;
+        }
+        //Wait for more work
+        //The items might have been queued while a work function was sleeping
+        //  (its own wait could have consumed the wakeup), so look at the queue first;
+        //  anything queued after that leaves a pending wakeup
+        uint64_t rflags = mtask_crit_enter();
+        uint8_t idle = (*head == NULL);
+        mtask_crit_leave(rflags);
+        if(idle)
+            mtask_wait();
+    }
+}
+
+/*
+ * Delayed work timer task, moves items into their queues when they're due
+ */
+void workq_timer_task(void* args){
+    while(1){
+        //Sort the new items into the list
+        workq_item_t* item = workq_take_all(&workq_delayed_new);
+        while(item != NULL){
+            workq_item_t* next = item->next;
+            workq_item_t** link = &workq_delayed;
+            while(*link != NULL && (*link)->deadline <= item->deadline)
+                link = &(*link)->next;
+            item->next = *link;
+            *link = item;
+            item = next;
+        }
+        //Queue the items that are due
+        uint64_t now = rdtsc();
+        while(workq_delayed != NULL && workq_delayed->deadline <= now){
+            item = workq_delayed;
+            workq_delayed = item->next;
+            workq_push(&workq_heads[item->prio], item);
+            mtask_wake(workq_workers[item->prio]);
+        }
+        //Sleep till the next deadline or till a new item arrives
+        mtask_wait_till(workq_delayed == NULL ? 0 : workq_delayed->deadline);
+    }
+}
+
+/*
+ * Creates the worker tasks
+ */
+void workq_init(void){
+    workq_delayed_new = NULL;
+    workq_delayed = NULL;
+    for(uint8_t i = 0; i < WORKQ_PRIO_CNT; i++){
+        workq_heads[i] = NULL;
+        workq_workers[i] = mtask_get_task(mtask_create_task(8192, workq_task_names[i], workq_task_prio[i],
+                                                            workq_worker, (void*)&workq_heads[i]));
+    }
+    workq_timer = mtask_get_task(mtask_create_task(8192, "Work timer", 1, workq_timer_task, NULL));
+}
+
+/*
+ * Initializes a work item
+ */
+void workq_item_init(workq_item_t* item, void(*func)(void*), void* args){
+    item->next = NULL;
+    item->func = func;
+    item->args = args;
+    item->deadline = 0;
+    item->prio = WORKQ_PRIO_NORMAL;
+    item->pending = 0;
+}
+
+/*
+ * Queues a work item
+ * Can be called from interrupt handlers
+ * Returns 0 if the item is already queued
+ */
+uint8_t workq_enqueue(uint8_t prio, workq_item_t* item){
+    if(__atomic_exchange_n(&item->pending, 1, __ATOMIC_ACQUIRE))
+        return 0;
+    item->prio = prio;
+    workq_push(&workq_heads[prio], item);
+    //The worker may not exist yet if we're called early on
+    if(workq_workers[prio] != NULL)
+        mtask_wake(workq_workers[prio]);
+    return 1;
+}
+
+/*
+ * Queues a work item after a certain amount of CPU cycles
+ * Can be called from interrupt handlers
+ * Returns 0 if the item is already queued
+ */
+uint8_t workq_enqueue_delayed(uint8_t prio, workq_item_t* item, uint64_t cycles){
+    if(__atomic_exchange_n(&item->pending, 1, __ATOMIC_ACQUIRE))
+        return 0;
+    item->prio = prio;
+    item->deadline = rdtsc() + cycles;
+    workq_push(&workq_delayed_new, item);
+    if(workq_timer != NULL)
+        mtask_wake(workq_timer);
+    return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include "../stdlib.h"
+
+//Work queue priorities (every queue has its own worker task)
+
+#define WORKQ_PRIO_HIGH                     0
+#define WORKQ_PRIO_NORMAL                   1
+#define WORKQ_PRIO_LOW                      2
+#define WORKQ_PRIO_CNT                      3
+
+//Work item
+//The structure is owned by the caller and must stay valid until the work function is called
+typedef struct _workq_item_s {
+    //Next item in the queue
+    struct _workq_item_s* next;
+    //Work function and its argument
+    void(*func)(void*);
+    void* args;
+    //TSC value at which delayed work should be queued
+    uint64_t deadline;
+    //Queue priority
+    uint8_t prio;
+    //Set while the item is queued
+    volatile uint8_t pending;
+} workq_item_t;
+
+void workq_init(void);
+void workq_item_init(workq_item_t* item, void(*func)(void*), void* args);
+uint8_t workq_enqueue(uint8_t prio, workq_item_t* item);
+uint8_t workq_enqueue_delayed(uint8_t prio, workq_item_t* item, uint64_t cycles);
+
+#endif
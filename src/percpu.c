@@ -0,0 +1,21 @@
+//Neutron Project
+//Per-CPU data
+
+#include "./percpu.h"
+#include "./stdlib.h"
+#include "./cpuid.h"
+
+/*
+ * Allocates the per-CPU block of the current CPU and points GS to it
+ * Must be called after the GDT has been loaded (loading GS clears the base)
+ */
+void percpu_init(void){
+    percpu_t* percpu = (percpu_t*)calloc(1, sizeof(percpu_t));
+    percpu->self = percpu;
+    //The local APIC isn't mapped yet, CPUID reports the initial APIC ID in EBX[31:24]
+    uint32_t ebx;
+    cpuid_get_leaf(1, 0, NULL, &ebx, NULL, NULL);
+    percpu->cpu_id = ebx >> 24;
+    wrmsr(MSR_IA32_GS_BASE, (uint64_t)percpu);
+    wrmsr(MSR_IA32_KERNEL_GS_BASE, 0);
+}
@@ -0,0 +1,43 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include "./stdlib.h"
+
+//GS base MSRs
+//While in the kernel, GS points to the per-CPU block;
+//  SWAPGS exchanges it with the user value on every user/kernel transition
+
+#define MSR_IA32_GS_BASE                    0xC0000101
+#define MSR_IA32_KERNEL_GS_BASE             0xC0000102
+
+//Per-CPU data block
+//The assembly code accesses the fields through GS:[offset], keep the offsets in sync
+typedef struct _percpu_s {
+    //GS:[0]  pointer to this block
+    struct _percpu_s* self;
+    //GS:[8]  the task that's running (task_t*)
+    void* cur_task;
+    //GS:[16] is the scheduler running?
+    uint64_t mtask_enabled;
+    //GS:[24] kernel stack top of the running user mode task
+    uint64_t kstack;
+    //GS:[32] scratch area for the entry stubs
+    uint64_t scratch[4];
+    //GS:[64] TSC value the scheduler timer interrupt was entered at
+    uint64_t timer_entry_tsc;
+    //Local APIC ID
+    uint32_t cpu_id;
+} percpu_t;
+
+void percpu_init(void);
+
+/*
+ * Returns the per-CPU block of the CPU we're running on
+ */
+static inline percpu_t* percpu_get(void){
+    percpu_t* percpu;
+    __asm__ volatile("mov %%gs:0, %0" : "=r" (percpu));
+    return percpu;
+}
+
+#endif
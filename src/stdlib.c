@@ -41,6 +41,14 @@ void abort(){
     while(1);
 }
 
+/*
+ * Print a string to the Bochs/QEMU debug port (0xE9)
+ */
+void puts_e9(char* str){
+    while(*str)
+        outb(0xE9, *(str++));
+}
+
 /*
  * Initialize the dynamic memory allocator
  */
@@ -212,6 +220,29 @@ void* calloc(uint64_t num, size_t size){
         return NULL;
 }
 
+/*
+ * Allocate a zeroed block of memory aligned by a power of two
+ * (meant for structures shared with devices, free it with free_aligned())
+ */
+void* calloc_aligned(size_t size, size_t align){
+    //The original pointer is kept right in front of the block
+    uint8_t* mem = (uint8_t*)calloc(size + align + sizeof(void*), 1);
+    if(mem == NULL)
+        return NULL;
+    uint8_t* block = mem + sizeof(void*);
+    block += (align - ((uint64_t)block & (align - 1))) & (align - 1);
+    ((void**)block)[-1] = mem;
+    return block;
+}
+
+/*
+ * Free a block allocated with calloc_aligned()
+ */
+void free_aligned(void* ptr){
+    if(ptr != NULL)
+        free(((void**)ptr)[-1]);
+}
+
 /*
  * Fill a chunk of memory with certain values
  */
@@ -327,7 +358,16 @@ uint16_t inw(uint16_t port){
  * Read a number of words from I/O port and store it in memory
  */
 void rep_insw(uint16_t port, uint32_t count, uint16_t* buf){
-    __asm__ volatile("rep insw" : : "c" (count), "D" (buf), "d" (port));
+    uint64_t cnt = count;
+    __asm__ volatile("rep insw" : "+c" (cnt), "+D" (buf) : "d" (port) : "memory");
+}
+
+/*
+ * Write a number of words from memory to I/O port
+ */
+void rep_outsw(uint16_t port, uint32_t count, uint16_t* buf){
+    uint64_t cnt = count;
+    __asm__ volatile("rep outsw" : "+c" (cnt), "+S" (buf) : "d" (port) : "memory");
 }
 
 /*
@@ -71,6 +71,8 @@ struct idt_entry {
 #define IDT_ENTRY(OFFS, CSEL, TYPE) ((struct idt_entry){.offset_1 = (OFFS) & 0xFFFF, .selector = (CSEL), .intr_stack_table = 0, .type_attr = (TYPE), .offset_2 = (OFFS) >> 16, .offset_3 = (OFFS) >> 32, .reserved = 0})
 //A macro that creates Kernel ISR IDT entries
 #define IDT_ENTRY_ISR(OFFS, CS) (IDT_ENTRY((OFFS), (CS), 0b10001110))
+//A macro that creates Kernel ISR IDT entries that switch to an Interrupt Stack Table stack
+#define IDT_ENTRY_ISR_IST(OFFS, CS, IST) ((struct idt_entry){.offset_1 = (OFFS) & 0xFFFF, .selector = (CS), .intr_stack_table = (IST), .type_attr = 0b10001110, .offset_2 = (OFFS) >> 16, .offset_3 = (OFFS) >> 32, .reserved = 0})
 
 //Panic codes
 
@@ -109,6 +111,8 @@ uint64_t dram_init(void);
 void* malloc(size_t size);
 void free(void* ptr);
 void* calloc(uint64_t num, size_t size);
+void* calloc_aligned(size_t size, size_t align);
+void free_aligned(void* ptr);
 
 //Memory operation functions
 
@@ -124,6 +128,7 @@ uint16_t inw(uint16_t port);
 void outb(uint16_t port, uint8_t value);
 uint8_t inb(uint16_t port);
 void rep_insw(uint16_t port, uint32_t count, uint16_t* buf);
+void rep_outsw(uint16_t port, uint32_t count, uint16_t* buf);
 
 //FIFO buffer operations
 
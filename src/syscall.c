@@ -0,0 +1,93 @@
+//Neutron Project
+//System calls
+//User mode enters the kernel through SYSCALL, the entry stub in syscall.s
+//  dispatches the call through syscall_table
+
+#include "./syscall.h"
+#include "./stdlib.h"
+#include "./gdt.h"
+#include "./mtask/mtask.h"
+#include "./vmem/vmem.h"
+
+//Defined in syscall.s
+void syscall_entry(void);
+void syscall_bench_user(void);
+
+uint64_t syscall_nop(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6){
+    return 0;
+}
+
+uint64_t syscall_exit(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6){
+    mtask_exit();
+}
+
+uint64_t syscall_yield(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6){
+    mtask_yield();
+    return 0;
+}
+
+uint64_t syscall_get_uid(uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6){
+    return mtask_get_uid();
+}
+
+uint64_t syscall_delay(uint64_t cycles, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6){
+    mtask_dly_cycles(cycles);
+    return 0;
+}
+
+#ifdef SYSCALL_BENCH_ON_BOOT
+uint64_t syscall_bench_done(uint64_t cycles, uint64_t iterations, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6){
+    if(iterations == 0)
+        return 0;
+    char temp[64];
+    puts_e9("syscall benchmark: ");
+    puts_e9(sprintu(temp, cycles / iterations, 1));
+    puts_e9(" cycles per call\n");
+    return 0;
+}
+#endif
+
+//The system call table
+const syscall_handler_t syscall_table[SYSCALL_CNT] = {
+    [SYSCALL_NOP]        = syscall_nop,
+    [SYSCALL_EXIT]       = syscall_exit,
+    [SYSCALL_YIELD]      = syscall_yield,
+    [SYSCALL_GET_UID]    = syscall_get_uid,
+    [SYSCALL_DELAY]      = syscall_delay,
+#ifdef SYSCALL_BENCH_ON_BOOT
+    [SYSCALL_BENCH_DONE] = syscall_bench_done
+#endif
+};
+const uint64_t syscall_cnt = SYSCALL_CNT;
+
+/*
+ * Enables the SYSCALL instruction
+ */
+void syscall_init(void){
+    wrmsr(MSR_IA32_EFER, rdmsr(MSR_IA32_EFER) | EFER_SCE);
+    //SYSCALL loads CS from STAR[47:32] and SS from STAR[47:32] + 8
+    //SYSRET loads CS from STAR[63:48] + 16 and SS from STAR[63:48] + 8
+    wrmsr(MSR_IA32_STAR, ((uint64_t)(GDT_SEL_KDATA | 3) << 48) | ((uint64_t)GDT_SEL_KCODE << 32));
+    wrmsr(MSR_IA32_LSTAR, (uint64_t)syscall_entry);
+    //Clear IF, DF and TF on entry
+    wrmsr(MSR_IA32_FMASK, (1 << 9) | (1 << 10) | (1 << 8));
+}
+
+/*
+ * Measures the latency of a system call from user mode
+ * The result is printed to the debug port
+ */
+void syscall_bench_task(void* args){
+    uint64_t cr3 = mtask_get_task(mtask_get_uid())->state.cr3;
+    //Map the page with the user mode part
+    uint64_t code = (uint64_t)syscall_bench_user & ~0xFFFULL;
+    vmem_map(cr3, (phys_addr_t)code, (phys_addr_t)(code + 4096), (virt_addr_t)VMEM_USER_BASE, VMEM_PAGE_USER);
+    //Allocate a user stack
+    uint8_t* stack = (uint8_t*)calloc(8192, 1);
+    stack += 4096 - ((uint64_t)stack % 4096); //align by 4 kB
+    uint64_t stack_va = VMEM_USER_BASE + 0x100000;
+    vmem_map(cr3, stack, stack + 4096, (virt_addr_t)stack_va, VMEM_PAGE_USER | VMEM_PAGE_WRITE);
+    //Run it
+    mtask_enter_user(VMEM_USER_BASE + ((uint64_t)syscall_bench_user & 0xFFF), stack_va + 4096 - 8,
+                     SYSCALL_BENCH_ITERATIONS);
+}
@@ -0,0 +1,42 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "./stdlib.h"
+
+//Run the system call latency benchmark on boot?
+//#define SYSCALL_BENCH_ON_BOOT
+
+//System call related MSRs
+
+#define MSR_IA32_EFER                       0xC0000080
+#define MSR_IA32_STAR                       0xC0000081
+#define MSR_IA32_LSTAR                      0xC0000082
+#define MSR_IA32_FMASK                      0xC0000084
+#define EFER_SCE                            (1 << 0)
+
+//System call numbers
+//The number goes into RAX, arguments into RDI, RSI, RDX, R10, R8 and R9,
+//  the result comes back in RAX. RCX, RDX, R8-R11 and XMM0-XMM5 are clobbered
+
+#define SYSCALL_NOP                         0
+#define SYSCALL_EXIT                        1
+#define SYSCALL_YIELD                       2
+#define SYSCALL_GET_UID                     3
+#define SYSCALL_DELAY                       4
+//Only there while the benchmark is built in
+#define SYSCALL_BENCH_DONE                  5
+#ifdef SYSCALL_BENCH_ON_BOOT
+#define SYSCALL_CNT                         6
+#else
+#define SYSCALL_CNT                         5
+#endif
+
+//Amount of system calls made by the benchmark
+#define SYSCALL_BENCH_ITERATIONS            1000000
+
+typedef uint64_t(*syscall_handler_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+void syscall_init(void);
+void syscall_bench_task(void* args);
+
+#endif
@@ -0,0 +1,71 @@
+.intel_syntax noprefix
+.globl   syscall_entry, syscall_bench_user
+.align   8
+
+syscall_entry:
+    ;//Interrupts are disabled by FMASK until we're on the kernel stack
+    ;//Switch to the kernel GS base and the kernel stack of the task
+    swapgs
+    mov gs:[32], rsp
+    mov rsp, gs:[24]
+    ;//Save the user RSP, RFLAGS and RIP
+    push qword ptr gs:[32]
+    push r11
+    push rcx
+    sti
+    ;//Check the system call number
+    cmp rax, [rip + syscall_cnt]
+    jae syscall_bad
+    ;//Move the arguments to where the kernel calling convention expects them
+    sub rsp, 56
+    mov [rsp+32], r8
+    mov [rsp+40], r9
+    mov rcx, rdi
+    mov r8,  rdx
+    mov rdx, rsi
+    mov r9,  r10
+    ;//Call the handler
+    lea r11, [rip + syscall_table]
+    call [r11 + rax*8]
+    add rsp, 56
+syscall_ret:
+    cli
+    ;//Restore the user RIP, RFLAGS and RSP
+    pop rcx
+    pop r11
+    pop rsp
+    swapgs
+    sysretq
+syscall_bad:
+    mov rax, -1
+    jmp syscall_ret
+
+;//User mode part of the system call benchmark
+;//Gets mapped into the user address space on its own, so it has to be
+;//  position-independent and must not cross a page boundary
+.balign 4096
+syscall_bench_user:
+    ;//RCX = amount of iterations
+    mov r12, rcx
+    mov r14, rcx
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r13, rax
+syscall_bench_loop:
+    xor eax, eax ;//SYSCALL_NOP
+    syscall
+    dec r12
+    jnz syscall_bench_loop
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r13
+    ;//Report the result
+    mov rdi, rax
+    mov rsi, r14
+    mov eax, 5 ;//SYSCALL_BENCH_DONE
+    syscall
+    mov eax, 1 ;//SYSCALL_EXIT
+    syscall
+.balign 4096
@@ -5,9 +5,12 @@
 #include "../stdlib.h"
 #include "../cpuid.h"
 #include "../drivers/gfx.h"
+#include "../mtask/mtask.h"
 
 //A flag that indicates whether PCIDs are supported or not
 uint8_t pcid_supported = 0;
+//The list of freed paging structures
+void* vmem_free_tables = NULL;
 
 uint8_t vmem_pcid_supported(void){
     return pcid_supported;
@@ -35,13 +38,67 @@ void vmem_init(void){
     __asm__ volatile("mov %0, %%cr4" : : "r" (cr4));
 }
 
+/*
+ * Allocates a zeroed 4 kB aligned paging structure,
+ *   reusing one that has been freed if possible
+ */
+phys_addr_t vmem_alloc_table(void){
+    uint64_t rflags = mtask_crit_enter();
+    phys_addr_t table = vmem_free_tables;
+    if(table != NULL)
+        vmem_free_tables = *(void**)table;
+    mtask_crit_leave(rflags);
+    if(table != NULL)
+        return memset(table, 0, 4096);
+    table = calloc(8192, 1); //allocate 8 kB even though we only need 4
+    return (uint8_t*)table + 4096 - ((uint64_t)table % 4096); //align by 4 kB
+}
+
+/*
+ * Puts a paging structure into the free list
+ */
+void vmem_free_table(phys_addr_t table){
+    uint64_t rflags = mtask_crit_enter();
+    *(void**)table = vmem_free_tables;
+    vmem_free_tables = table;
+    mtask_crit_leave(rflags);
+}
+
+/*
+ * Frees a PML4 structure and all paging structures it references
+ * (the pages themselves are not freed)
+ * Must not be called on the CR3 that's currently loaded
+ */
+void vmem_free_pml4(uint64_t cr3){
+    uint64_t* pml4 = (uint64_t*)(cr3 & 0xFFFFFFFFFFFFF000);
+    for(uint32_t i = 0; i < 512; i++){
+        if(!(pml4[i] & 1))
+            continue;
+        uint64_t* pdpt = (uint64_t*)(pml4[i] & 0x7FFFFFFFFFFFF000);
+        for(uint32_t j = 0; j < 512; j++){
+            //Skip 1 GB pages
+            if(!(pdpt[j] & 1) || (pdpt[j] & (1 << 7)))
+                continue;
+            uint64_t* pd = (uint64_t*)(pdpt[j] & 0x7FFFFFFFFFFFF000);
+            for(uint32_t k = 0; k < 512; k++){
+                //Skip 2 MB pages
+                if(!(pd[k] & 1) || (pd[k] & (1 << 7)))
+                    continue;
+                vmem_free_table((phys_addr_t)(pd[k] & 0x7FFFFFFFFFFFF000));
+            }
+            vmem_free_table(pd);
+        }
+        vmem_free_table(pdpt);
+    }
+    vmem_free_table(pml4);
+}
+
 /*
  * Creates a PML4 structure, returns a value that can be entered into CR3
  */
 uint64_t vmem_create_pml4(uint16_t pcid){
     uint64_t cr3 = 0;
-    phys_addr_t pml4 = calloc(8192, 1); //allocate 8 kB even though we only need 4
-    pml4 = (uint8_t*)pml4 + 4096 - ((uint64_t)pml4 % 4096); //align by 4 kB
+    phys_addr_t pml4 = vmem_alloc_table();
     //Set the PML4 pointer
     cr3 = (uint64_t)pml4;
     //Set the PCID
@@ -65,8 +122,7 @@ void vmem_create_pdpt(uint64_t cr3, virt_addr_t at){
     //Calculate the address of the entry
     phys_addr_t pml4e_addr = (uint8_t*)pml4_addr + (pml4e_idx * 8);
     //Allocate space for the PDPT
-    phys_addr_t pdpt = calloc(8192, 1); //allocate 8 kB even though we only need 4
-    pdpt = (uint8_t*)pdpt + 4096 - ((uint64_t)pdpt % 4096); //align by 4 kB
+    phys_addr_t pdpt = vmem_alloc_table();
     //Generate the entry
     uint64_t pml4e = 0;
     pml4e |= (1 << 0); //it's present
@@ -117,8 +173,7 @@ void vmem_create_pd(uint64_t cr3, virt_addr_t at){
         vmem_create_pdpt(cr3, at); //Create it if not
     
     //Allocate space for the PD
-    phys_addr_t pd = calloc(8192, 1); //allocate 8 kB even though we only need 4
-    pd = (uint8_t*)pd + 4096 - ((uint64_t)pd % 4096); //align by 4 kB
+    phys_addr_t pd = vmem_alloc_table();
     //Extract entry index from "at"
     uint64_t pdpte_idx = ((uint64_t)at >> 30) & 0x1FF;
     //Calculate the address of the entry
@@ -173,8 +228,7 @@ void vmem_create_pt(uint64_t cr3, virt_addr_t at){
         vmem_create_pd(cr3, at); //Create it if not
     
     //Allocate space for the PT
-    phys_addr_t pt = calloc(8192, 1); //allocate 8 kB even though we only need 4
-    pt = (uint8_t*)pt + 4096 - ((uint64_t)pt % 4096); //align by 4 kB
+    phys_addr_t pt = vmem_alloc_table();
     //Extract entry index from "at"
     uint64_t pde_idx = ((uint64_t)at >> 21) & 0x1FF;
     //Calculate the address of the entry
@@ -223,7 +277,7 @@ phys_addr_t vmem_addr_pt(uint64_t cr3, virt_addr_t at){
  * Creates a page mapped to a specific physical address that
  *   can be accessed using the specific "at" mask and CR3 value
  */
-void vmem_create_page(uint64_t cr3, virt_addr_t at, phys_addr_t from){
+void vmem_create_page(uint64_t cr3, virt_addr_t at, phys_addr_t from, uint64_t flags){
     //Check if that entry is present
     if(!vmem_present_pt(cr3, at))
         vmem_create_pt(cr3, at); //Create it if not
@@ -235,8 +289,7 @@ void vmem_create_page(uint64_t cr3, virt_addr_t at, phys_addr_t from){
     //Generate the entry
     uint64_t pte = 0;
     pte |= (1 << 0); //it's present
-    pte |= (1 << 1); //writes are allowed
-    pte |= (1 << 2); //user access is allowed
+    pte |= flags & (VMEM_PAGE_WRITE | VMEM_PAGE_USER); //writes and user access
     pte &= ~((1 << 3) | (1 << 4)); //enable caching on access to this PDPT
     pte &= ~(1 << 5); //clear the "accessed" bit
     pte |= (uint64_t)from & 0xFFFFFFFFFFFFF000; //set the address
@@ -272,14 +325,41 @@ phys_addr_t vmem_addr_page(uint64_t cr3, virt_addr_t at){
 
 
 
+/*
+ * Returns the physical address a virtual address is mapped to
+ *   or NULL if it isn't mapped
+ */
+phys_addr_t vmem_translate(uint64_t cr3, virt_addr_t at){
+    if(!vmem_present_pdpt(cr3, at) || !vmem_present_pd(cr3, at) ||
+       !vmem_present_pt(cr3, at) || !vmem_present_page(cr3, at))
+        return NULL;
+    return (uint8_t*)vmem_addr_page(cr3, at) + ((uint64_t)at & 0xFFF);
+}
+
+/*
+ * Removes the mapping of a page
+ */
+void vmem_unmap_page(uint64_t cr3, virt_addr_t at){
+    if(vmem_translate(cr3, at) == NULL)
+        return;
+    //Clear the entry
+    uint64_t pte_idx = ((uint64_t)at >> 12) & 0x1FF;
+    *(uint64_t*)((uint8_t*)vmem_addr_pt(cr3, at) + (pte_idx * 8)) = 0;
+    //Invalidate the TLB entry if that's the address space we're in
+    //  (other ones get flushed when CR3 is loaded)
+    if((vmem_get_cr3() & 0xFFFFFFFFFFFFF000) == (cr3 & 0xFFFFFFFFFFFFF000))
+        __asm__ volatile("invlpg (%0)" : : "r" (at) : "memory");
+}
+
 /*
  * Maps a virtual address range to a physical address range
+ * (flags is a combination of VMEM_PAGE_*)
  */
-void vmem_map(uint64_t cr3, phys_addr_t p_st, phys_addr_t p_end, virt_addr_t v_st){
+void vmem_map(uint64_t cr3, phys_addr_t p_st, phys_addr_t p_end, virt_addr_t v_st, uint64_t flags){
     //Loop through the range
     for(uint64_t offs = 0; offs < p_end - p_st; offs += 4096){
         //Map one page
-        vmem_create_page(cr3, (uint8_t*)v_st + offs, (uint8_t*)p_st + offs);
+        vmem_create_page(cr3, (uint8_t*)v_st + offs, (uint8_t*)p_st + offs, flags);
     }
 }
 
@@ -354,35 +434,88 @@ void vmem_pat_set(uint8_t idx, uint8_t mem_type){
 
 /*
  * For a specific descriptor (CR3), sets memory type in a virtual memory address range
+ * Pages that aren't mapped with 4 kB pages are left alone
  */
 void vmem_pat_set_range(uint64_t cr3, virt_addr_t st, virt_addr_t end, uint8_t mem_type){
     //Fetch PAT
     uint64_t pat = rdmsr(MSR_IA32_PAT);
     //Go through it to see if the memory type we need exists
-    uint8_t pat_idx = 7;
-    for(uint8_t idx = 0; idx < 8; idx++)
+    uint8_t pat_idx = 0xFF;
+    for(uint8_t idx = 0; idx < 8 && pat_idx == 0xFF; idx++)
         if(((pat >> (idx * 8)) & 0xFF) == mem_type)
             pat_idx = idx;
-    //pat_idx is now set to the entry number in PAT with
-    //  the memory type we need. If no such entries
-    //  exist, overwrite the 7th (counting from 0) entry
-    if(pat_idx == 7)
+    //If no such entries exist, overwrite the 7th (counting from 0) entry
+    if(pat_idx == 0xFF){
+        pat_idx = 7;
         vmem_pat_set(pat_idx, mem_type);
+    }
+    uint8_t cur = (vmem_get_cr3() & 0xFFFFFFFFFFFFF000) == (cr3 & 0xFFFFFFFFFFFFF000);
     //Go through addresses
-    for(uint64_t offs = 0; offs <= end - st; offs += 4 * 1024){
-        //From CR3, get the PT entry describing a page
-        uint64_t* pt = vmem_addr_pt(cr3, st);
-        //Calculate the entry offset
-        uint64_t* pte = pt + (((uint64_t)((uint64_t)st + offs) >> 12) & 0x1FF);
+    for(uint64_t addr = (uint64_t)st & ~0xFFFULL; addr < (uint64_t)end; addr += 4 * 1024){
+        virt_addr_t at = (virt_addr_t)addr;
+        //Skip holes and large pages (the firmware maps memory that way)
+        if(!vmem_present_pdpt(cr3, at) || !vmem_present_pd(cr3, at))
+            continue;
+        uint64_t* pdpte = (uint64_t*)vmem_addr_pdpt(cr3, at) + ((addr >> 30) & 0x1FF);
+        if(*pdpte & (1 << 7))
+            continue;
+        uint64_t* pde = (uint64_t*)vmem_addr_pd(cr3, at) + ((addr >> 21) & 0x1FF);
+        if(!(*pde & 1) || (*pde & (1 << 7)))
+            continue;
+        //From CR3, get the PT entry describing the page
+        uint64_t* pte = (uint64_t*)vmem_addr_pt(cr3, at) + ((addr >> 12) & 0x1FF);
+        if(!(*pte & 1))
+            continue;
         //Clear PWT, PCD and PAT bits of the entry
         *pte &= ~((1 << 3) | (1 << 4) | (1 << 7));
         //Set bits according to the PAT index
         *pte |= (pat_idx & 1) << 3;
         *pte |= ((pat_idx & 2) >> 1) << 4;
         *pte |= ((pat_idx & 4) >> 2) << 7;
+        if(cur)
+            __asm__ volatile("invlpg (%0)" : : "r" (at) : "memory");
     }
 }
 
+//Physical ranges with a memory type other than WB
+typedef struct {
+    uint64_t st, end;
+    uint8_t mem_type;
+} vmem_type_range_t;
+vmem_type_range_t vmem_type_ranges[VMEM_MAX_TYPE_RANGES];
+uint32_t vmem_type_range_cnt = 0;
+
+/*
+ * Sets the memory type of a physical range in the identity map of the current
+ *   address space and of every address space created after that
+ * Returns 0 if the range isn't identity-mapped or there's no space to remember it
+ */
+uint8_t vmem_set_type(phys_addr_t st, phys_addr_t end, uint8_t mem_type){
+    if((uint64_t)end > VMEM_IDENTITY_END || end <= st)
+        return 0;
+    uint64_t rflags = mtask_crit_enter();
+    if(vmem_type_range_cnt >= VMEM_MAX_TYPE_RANGES){
+        mtask_crit_leave(rflags);
+        return 0;
+    }
+    vmem_type_range_t* range = &vmem_type_ranges[vmem_type_range_cnt++];
+    range->st = (uint64_t)st;
+    range->end = (uint64_t)end;
+    range->mem_type = mem_type;
+    mtask_crit_leave(rflags);
+    vmem_pat_set_range(vmem_get_cr3(), st, end, mem_type);
+    return 1;
+}
+
+/*
+ * Applies the memory types set with vmem_set_type() to a new address space
+ */
+void vmem_apply_types(uint64_t cr3){
+    for(uint32_t i = 0; i < vmem_type_range_cnt; i++)
+        vmem_pat_set_range(cr3, (virt_addr_t)vmem_type_ranges[i].st, (virt_addr_t)vmem_type_ranges[i].end,
+                           vmem_type_ranges[i].mem_type);
+}
+
 /*
  * Reads the current CR3 value
  */
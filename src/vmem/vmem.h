@@ -3,6 +3,28 @@
 //Page Attribute Table MSR
 #define MSR_IA32_PAT                0x277
 
+//Memory types (PAT encodings)
+#define VMEM_TYPE_UC                0
+#define VMEM_TYPE_WC                1
+#define VMEM_TYPE_WT                4
+#define VMEM_TYPE_WP                5
+#define VMEM_TYPE_WB                6
+#define VMEM_TYPE_UC_MINUS          7
+
+//Amount of physical ranges vmem_set_type() can remember
+#define VMEM_MAX_TYPE_RANGES        32
+//End of the kernel identity map every address space gets
+#define VMEM_IDENTITY_END           (8ULL * 1024 * 1024 * 1024)
+
+//Page flags
+
+#define VMEM_PAGE_WRITE             (1 << 1)
+#define VMEM_PAGE_USER              (1 << 2)
+
+//User mode code and data live above this address
+//  (the kernel identity-maps physical memory below it, supervisor-only)
+#define VMEM_USER_BASE              0x8000000000ULL
+
 typedef void* virt_addr_t;
 typedef void* phys_addr_t;
 
@@ -11,7 +33,11 @@ uint8_t vmem_pcid_supported(void);
 
 void vmem_init(void);
 
+phys_addr_t vmem_alloc_table(void);
+void vmem_free_table(phys_addr_t table);
+
 uint64_t vmem_create_pml4(uint16_t pcid);
+void vmem_free_pml4(uint64_t cr3);
 
 void vmem_create_pdpt(uint64_t cr3, virt_addr_t at);
 uint8_t vmem_present_pdpt(uint64_t cr3, virt_addr_t at);
@@ -25,12 +51,16 @@ void vmem_create_pt(uint64_t cr3, virt_addr_t at);
 uint8_t vmem_present_pt(uint64_t cr3, virt_addr_t at);
 phys_addr_t vmem_addr_pt(uint64_t cr3, virt_addr_t at);
 
-void vmem_create_page(uint64_t cr3, virt_addr_t at, phys_addr_t from);
+void vmem_create_page(uint64_t cr3, virt_addr_t at, phys_addr_t from, uint64_t flags);
 uint8_t vmem_present_page(uint64_t cr3, virt_addr_t at);
 phys_addr_t vmem_addr_page(uint64_t cr3, virt_addr_t at);
 
-void vmem_map(uint64_t cr3, phys_addr_t p_st, phys_addr_t p_end, virt_addr_t v_st);
+phys_addr_t vmem_translate(uint64_t cr3, virt_addr_t at);
+void vmem_unmap_page(uint64_t cr3, virt_addr_t at);
+void vmem_map(uint64_t cr3, phys_addr_t p_st, phys_addr_t p_end, virt_addr_t v_st, uint64_t flags);
 
 void vmem_pat_print(void);
 void vmem_pat_set(uint8_t idx, uint8_t mem_type);
-void vmem_pat_set_range(uint64_t cr3, virt_addr_t st, virt_addr_t end, uint8_t mem_type);
\ No newline at end of file
+void vmem_pat_set_range(uint64_t cr3, virt_addr_t st, virt_addr_t end, uint8_t mem_type);
+uint8_t vmem_set_type(phys_addr_t st, phys_addr_t end, uint8_t mem_type);
+void vmem_apply_types(uint64_t cr3);
\ No newline at end of file
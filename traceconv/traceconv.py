@@ -0,0 +1,89 @@
+# Neutron Project
+# Converts the scheduler trace stream (see src/mtask/trace.c) into Chrome trace JSON
+# The result can be opened in chrome://tracing or ui.perfetto.dev
+#
+# Capture the stream with QEMU:
+#   -debugcon file:trace.txt        (TRACE_OUT_E9)
+#   -serial file:trace.txt          (TRACE_OUT_SERIAL)
+
+import sys, json
+
+EVT_SWITCH = 1
+EVT_WAKE = 2
+EVT_BLOCK = 3
+EVT_ISR_ENTER = 4
+EVT_ISR_EXIT = 5
+
+ISR_TID = 1000000
+
+def usage():
+	print('Usage: python3 traceconv.py <trace.txt> <trace.json> [-f <TSC frequency in MHz>]')
+	sys.exit(1)
+
+if len(sys.argv) < 3:
+	usage()
+in_file = sys.argv[1]
+out_file = sys.argv[2]
+tsc_mhz = 1000.0
+if '-f' in sys.argv:
+	idx = sys.argv.index('-f')
+	if idx + 1 >= len(sys.argv):
+		usage()
+	tsc_mhz = float(sys.argv[idx + 1])
+
+names = dict()
+events = list()
+tsc_base = None
+running = None
+running_since = 0
+
+def ts(tsc):
+	return (tsc - tsc_base) / tsc_mhz
+
+def task_name(slot):
+	return names.get(slot, 'task ' + str(slot))
+
+with open(in_file, 'r', errors='replace') as f:
+	for line in f:
+		parts = line.split()
+		if len(parts) == 0:
+			continue
+		if parts[0] == 'F' and len(parts) >= 2:
+			# The kernel knows its TSC frequency (in Hz)
+			if '-f' not in sys.argv and int(parts[1], 16) != 0:
+				tsc_mhz = int(parts[1], 16) / 1000000
+		elif parts[0] == 'N' and len(parts) >= 3:
+			names[int(parts[1], 16)] = ' '.join(parts[2:])
+		elif parts[0] == 'E' and len(parts) >= 5:
+			evt_type = int(parts[1], 16)
+			tsc = int(parts[2], 16)
+			arg = int(parts[3], 16)
+			arg2 = int(parts[4], 16)
+			if tsc_base is None:
+				tsc_base = tsc
+			if evt_type == EVT_SWITCH:
+				# Close the slice of the previous task
+				prev = running if running is not None else arg2
+				if running is not None:
+					events.append({'name': task_name(prev), 'ph': 'X', 'pid': 1, 'tid': prev,
+						'ts': ts(running_since), 'dur': ts(tsc) - ts(running_since)})
+				running = arg
+				running_since = tsc
+			elif evt_type == EVT_WAKE:
+				events.append({'name': 'wake', 'ph': 'i', 's': 't', 'pid': 1, 'tid': arg, 'ts': ts(tsc)})
+			elif evt_type == EVT_BLOCK:
+				events.append({'name': 'block', 'ph': 'i', 's': 't', 'pid': 1, 'tid': arg, 'ts': ts(tsc)})
+			elif evt_type == EVT_ISR_ENTER:
+				events.append({'name': 'vector ' + str(arg), 'ph': 'B', 'pid': 1, 'tid': ISR_TID, 'ts': ts(tsc)})
+			elif evt_type == EVT_ISR_EXIT:
+				events.append({'name': 'vector ' + str(arg), 'ph': 'E', 'pid': 1, 'tid': ISR_TID, 'ts': ts(tsc)})
+
+# Name the tracks
+meta = [{'name': 'process_name', 'ph': 'M', 'pid': 1, 'args': {'name': 'Neutron'}},
+        {'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': ISR_TID, 'args': {'name': 'Interrupts'}}]
+for slot in names:
+	meta.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': slot, 'args': {'name': names[slot]}})
+
+with open(out_file, 'w') as f:
+	json.dump({'traceEvents': meta + events, 'displayTimeUnit': 'ns'}, f)
+print(f'{len(events)} events written to {out_file}')